@@ -0,0 +1,318 @@
+/*--------------------------------------------------------------------------
+File:   arith_decoder.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "arith_decoder.h"
+
+#include "dct_utils.h"
+#include "profile.h"
+#include "utils.h"
+
+#include <string.h>
+
+/*
+Probability estimation state machine, Table D.2 in the spec. Each entry packs Qe in the top 16 bits,
+the next index after an MPS in the next 8, then whether an LPS swaps the MPS (bit 7) and the next index
+after an LPS, so the bin update after a decision is one xor with the byte that's already loaded.
+The extra last entry is the fixed even chance the sign bits use.
+*/
+#define QM(qe, next_lps, next_mps, switch_mps) (((uint32_t)(qe) << 16) | ((next_mps) << 8) | ((switch_mps) << 7) | (next_lps))
+
+static const uint32_t QM_STATES[114] =
+{
+  QM(0x5a1d,   1,   1, 1), QM(0x2586,  14,   2, 0), QM(0x1114,  16,   3, 0), QM(0x080b,  18,   4, 0),
+  QM(0x03d8,  20,   5, 0), QM(0x01da,  23,   6, 0), QM(0x00e5,  25,   7, 0), QM(0x006f,  28,   8, 0),
+  QM(0x0036,  30,   9, 0), QM(0x001a,  33,  10, 0), QM(0x000d,  35,  11, 0), QM(0x0006,   9,  12, 0),
+  QM(0x0003,  10,  13, 0), QM(0x0001,  12,  13, 0), QM(0x5a7f,  15,  15, 1), QM(0x3f25,  36,  16, 0),
+  QM(0x2cf2,  38,  17, 0), QM(0x207c,  39,  18, 0), QM(0x17b9,  40,  19, 0), QM(0x1182,  42,  20, 0),
+  QM(0x0cef,  43,  21, 0), QM(0x09a1,  45,  22, 0), QM(0x072f,  46,  23, 0), QM(0x055c,  48,  24, 0),
+  QM(0x0406,  49,  25, 0), QM(0x0303,  51,  26, 0), QM(0x0240,  52,  27, 0), QM(0x01b1,  54,  28, 0),
+  QM(0x0144,  56,  29, 0), QM(0x00f5,  57,  30, 0), QM(0x00b7,  59,  31, 0), QM(0x008a,  60,  32, 0),
+  QM(0x0068,  62,  33, 0), QM(0x004e,  63,  34, 0), QM(0x003b,  32,  35, 0), QM(0x002c,  33,   9, 0),
+  QM(0x5ae1,  37,  37, 1), QM(0x484c,  64,  38, 0), QM(0x3a0d,  65,  39, 0), QM(0x2ef1,  67,  40, 0),
+  QM(0x261f,  68,  41, 0), QM(0x1f33,  69,  42, 0), QM(0x19a8,  70,  43, 0), QM(0x1518,  72,  44, 0),
+  QM(0x1177,  73,  45, 0), QM(0x0e74,  74,  46, 0), QM(0x0bfb,  75,  47, 0), QM(0x09f8,  77,  48, 0),
+  QM(0x0861,  78,  49, 0), QM(0x0706,  79,  50, 0), QM(0x05cd,  48,  51, 0), QM(0x04de,  50,  52, 0),
+  QM(0x040f,  50,  53, 0), QM(0x0363,  51,  54, 0), QM(0x02d4,  52,  55, 0), QM(0x025c,  53,  56, 0),
+  QM(0x01f8,  54,  57, 0), QM(0x01a4,  55,  58, 0), QM(0x0160,  56,  59, 0), QM(0x0125,  57,  60, 0),
+  QM(0x00f6,  58,  61, 0), QM(0x00cb,  59,  62, 0), QM(0x00ab,  61,  63, 0), QM(0x008f,  61,  32, 0),
+  QM(0x5b12,  65,  65, 1), QM(0x4d04,  80,  66, 0), QM(0x412c,  81,  67, 0), QM(0x37d8,  82,  68, 0),
+  QM(0x2fe8,  83,  69, 0), QM(0x293c,  84,  70, 0), QM(0x2379,  86,  71, 0), QM(0x1edf,  87,  72, 0),
+  QM(0x1aa9,  87,  73, 0), QM(0x174e,  72,  74, 0), QM(0x1424,  72,  75, 0), QM(0x119c,  74,  76, 0),
+  QM(0x0f6b,  74,  77, 0), QM(0x0d51,  75,  78, 0), QM(0x0bb6,  77,  79, 0), QM(0x0a40,  77,  48, 0),
+  QM(0x5832,  80,  81, 1), QM(0x4d1c,  88,  82, 0), QM(0x438e,  89,  83, 0), QM(0x3bdd,  90,  84, 0),
+  QM(0x34ee,  91,  85, 0), QM(0x2eae,  92,  86, 0), QM(0x299a,  93,  87, 0), QM(0x2516,  86,  71, 0),
+  QM(0x5570,  88,  89, 1), QM(0x4ca9,  95,  90, 0), QM(0x44d9,  96,  91, 0), QM(0x3e22,  97,  92, 0),
+  QM(0x3824,  99,  93, 0), QM(0x32b4,  99,  94, 0), QM(0x2e17,  93,  86, 0), QM(0x56a8,  95,  96, 1),
+  QM(0x4f46, 101,  97, 0), QM(0x47e5, 102,  98, 0), QM(0x41cf, 103,  99, 0), QM(0x3c3d, 104, 100, 0),
+  QM(0x375e,  99,  93, 0), QM(0x5231, 105, 102, 0), QM(0x4c0f, 106, 103, 0), QM(0x4639, 107, 104, 0),
+  QM(0x415e, 103,  99, 0), QM(0x5627, 105, 106, 1), QM(0x50e7, 108, 107, 0), QM(0x4b85, 109, 103, 0),
+  QM(0x5597, 110, 109, 0), QM(0x504f, 111, 107, 0), QM(0x5a10, 110, 111, 1), QM(0x5522, 112, 109, 0),
+  QM(0x59eb, 112, 111, 1), QM(0x5a1d, 113, 113, 0)
+};
+
+#define QM_FIXED_STATE 113
+
+// Bins of the DC statistics, Table F.4: S0 per context at 0, 4, 8, 12 and 16, then X1 and M1.
+#define DC_X1 20
+#define DC_M_OFFSET 14
+
+// Bins of the AC statistics, Table F.5: SE, S0 and SN/SP for each k, then X2 for the low and high bands.
+#define AC_X2_LOW 189
+#define AC_X2_HIGH 217
+#define AC_M_OFFSET 14
+
+void arith_conditioning_default(arith_conditioning_t* conditioning)
+{
+  conditioning->dc_lower = 0;
+  conditioning->dc_upper = 1;
+  conditioning->ac_kx = 5;
+}
+
+// A 0xFF is either a stuffed one, followed by 0x00, or the start of a marker, after which the decoder only gets zeros.
+static unsigned arith_next_byte_slow(arith_state_t* state)
+{
+  if (state->cur >= state->end)
+    return 0;
+
+  const unsigned char* next = state->cur + 1;
+  while (next < state->end && *next == 0xFF)
+    ++next;
+
+  if (next < state->end && *next == 0x00)
+  {
+    state->cur = next + 1;
+    return 0xFF;
+  }
+
+  state->end = state->cur;
+  return 0;
+}
+
+static inline unsigned arith_next_byte(arith_state_t* state)
+{
+  if (state->cur < state->end && *state->cur != 0xFF)
+    return *state->cur++;
+
+  return arith_next_byte_slow(state);
+}
+
+/*
+Decodes one binary decision with the statistics in bin, see D.2.4 and D.2.5. Renormalization pulls in
+a byte whenever the 8 bits buffered past the top 16 of c run out. Callers decode a whole block from a
+local copy of the state, so nothing in here goes through memory apart from the bin itself.
+*/
+static inline unsigned arith_decode(arith_state_t* state, unsigned char* bin)
+{
+  while (state->a < 0x8000)
+  {
+    if (--state->ct < 0)
+    {
+      state->c = (state->c << 8) | arith_next_byte(state);
+      state->ct += 8;
+    }
+    state->a <<= 1;
+  }
+
+  const unsigned bin_value = *bin;
+  const uint32_t entry = QM_STATES[bin_value & 0x7F];
+  const uint32_t qe = entry >> 16;
+  const unsigned next_mps = (entry >> 8) & 0xFF, next_lps = entry & 0xFF;
+  unsigned symbol = bin_value >> 7;
+
+  state->a -= qe;
+  const uint32_t lower = state->a << state->ct;
+  if (state->c >= lower)
+  {
+    // The code is in the Qe sized part. Conditional exchange: whichever of the two is smaller is the LPS.
+    state->c -= lower;
+    if (state->a < qe)
+    {
+      *bin = (unsigned char)((bin_value & 0x80) ^ next_mps);
+    }
+    else
+    {
+      *bin = (unsigned char)((bin_value & 0x80) ^ next_lps);
+      symbol ^= 1;
+    }
+    state->a = qe;
+  }
+  else if (state->a < 0x8000)
+  {
+    // Only a renormalization moves the estimate on after an MPS.
+    if (state->a < qe)
+    {
+      *bin = (unsigned char)((bin_value & 0x80) ^ next_lps);
+      symbol ^= 1;
+    }
+    else
+    {
+      *bin = (unsigned char)((bin_value & 0x80) ^ next_mps);
+    }
+  }
+
+  return symbol;
+}
+
+// Loads the first two bytes of an interval, see D.2.3, so the hot loop never has to check for a fresh decoder.
+static void arith_state_reset(arith_state_t* state)
+{
+  state->c = arith_next_byte(state) << 8;
+  state->c |= arith_next_byte(state);
+  state->a = 0x10000;
+  state->ct = 0;
+}
+
+void arith_decoder_init(arith_decoder_t* decoder, const unsigned char* data, size_t len)
+{
+  memset(decoder, 0, sizeof(arith_decoder_t));
+  decoder->state.cur = data;
+  decoder->state.end = decoder->scan_end = data + len;
+  decoder->fixed_bin = QM_FIXED_STATE;
+  arith_state_reset(&decoder->state);
+}
+
+void arith_decoder_add_component(arith_decoder_t* decoder, unsigned char dc_table, unsigned char ac_table,
+                                 const arith_conditioning_t* dc_conditioning, const arith_conditioning_t* ac_conditioning)
+{
+  const unsigned char s = decoder->num_components++;
+  decoder->dc_tables[s] = dc_table;
+  decoder->ac_tables[s] = ac_table;
+
+  // F.1.4.4.1.2: differences below 2^(L-1) count as zero, above 2^(U-1) as large.
+  decoder->dc_small[s] = (1 << dc_conditioning->dc_lower) >> 1;
+  decoder->dc_large[s] = (1 << dc_conditioning->dc_upper) >> 1;
+  decoder->ac_kx[s] = ac_conditioning->ac_kx;
+}
+
+void arith_decoder_restart(arith_decoder_t* decoder)
+{
+  // The interval normally ends right at the marker, anything in front of it is skipped like the spec's decoders do.
+  const unsigned char* it = decoder->state.cur;
+  while (it + 1 < decoder->scan_end && !(it[0] == 0xFF && it[1] >= 0xD0 && it[1] <= 0xD7))
+    ++it;
+
+  decoder->state.cur = it + 1 < decoder->scan_end ? it + 2 : decoder->scan_end;
+  decoder->state.end = decoder->scan_end;
+  arith_state_reset(&decoder->state);
+
+  memset(decoder->dc_context, 0, sizeof(decoder->dc_context));
+  memset(decoder->dc_stats, 0, sizeof(decoder->dc_stats));
+  memset(decoder->ac_stats, 0, sizeof(decoder->ac_stats));
+}
+
+// Magnitude bit patterns, F.2.4.3.2: the bits below the leading one, from the bin after the category's.
+static inline int arith_decode_magnitude(arith_state_t* state, unsigned char* bin, int m)
+{
+  int value = m;
+  while (m >>= 1)
+  {
+    if (arith_decode(state, bin))
+      value |= m;
+  }
+  return value + 1;
+}
+
+bool arith_decode_dct_block(arith_decoder_t* decoder, unsigned char s, int16_t* scratch_block, int* prev_dc_val)
+{
+  PROFILE_COUNT(PC_BLOCKS, 1);
+
+  arith_state_t state = decoder->state;
+  bool valid = true;
+
+  // DC difference, F.2.4.1.
+  unsigned char* dc_stats = decoder->dc_stats[decoder->dc_tables[s]];
+  unsigned char* bin = dc_stats + decoder->dc_context[s];
+  if (arith_decode(&state, bin) == 0)
+  {
+    decoder->dc_context[s] = 0;
+  }
+  else
+  {
+    const unsigned sign = arith_decode(&state, bin + 1);
+    bin += 2 + sign;
+
+    int m = (int)arith_decode(&state, bin);
+    if (m != 0)
+    {
+      bin = dc_stats + DC_X1;
+      while (arith_decode(&state, bin))
+      {
+        m <<= 1;
+        ++bin;
+        if (m == 0x8000)
+        {
+          valid = false;
+          break;
+        }
+      }
+    }
+
+    if (m < decoder->dc_small[s])
+      decoder->dc_context[s] = 0;
+    else if (m > decoder->dc_large[s])
+      decoder->dc_context[s] = (unsigned char)(12 + sign * 4);
+    else
+      decoder->dc_context[s] = (unsigned char)(4 + sign * 4);
+
+    const int value = valid ? arith_decode_magnitude(&state, bin + DC_M_OFFSET, m) : 0;
+    *prev_dc_val = dc_predictor_add(*prev_dc_val, sign ? -value : value);
+  }
+  scratch_block[0] = (int16_t)*prev_dc_val;
+
+  // AC coefficients, F.2.4.2. Every k has its own end of block and zero run bins.
+  unsigned char* ac_stats = decoder->ac_stats[decoder->ac_tables[s]];
+  const unsigned kx = decoder->ac_kx[s];
+  for (unsigned k = 1; k <= 63 && valid; ++k)
+  {
+    bin = ac_stats + 3 * (k - 1);
+    if (arith_decode(&state, bin))
+    {
+      PROFILE_COUNT(PC_EOBS, 1);
+      PROFILE_COUNT(PC_DC_ONLY_BLOCKS, k == 1);
+      break;
+    }
+
+    while (arith_decode(&state, bin + 1) == 0)
+    {
+      bin += 3;
+      if (++k > 63)
+      {
+        valid = false;
+        break;
+      }
+    }
+
+    if (!valid)
+      break;
+
+    const unsigned sign = arith_decode(&state, &decoder->fixed_bin);
+    bin += 2;
+
+    int m = (int)arith_decode(&state, bin);
+    if (m != 0 && arith_decode(&state, bin))
+    {
+      m <<= 1;
+      bin = ac_stats + (k <= kx ? AC_X2_LOW : AC_X2_HIGH);
+      while (arith_decode(&state, bin))
+      {
+        m <<= 1;
+        ++bin;
+        if (m == 0x8000)
+        {
+          valid = false;
+          break;
+        }
+      }
+    }
+
+    if (!valid)
+      break;
+
+    const int value = arith_decode_magnitude(&state, bin + AC_M_OFFSET, m);
+    scratch_block[get_zig_zagged_index((unsigned char)k)] = (int16_t)(sign ? -value : value);
+  }
+
+  decoder->state = state;
+  return valid;
+}
@@ -0,0 +1,94 @@
+/*--------------------------------------------------------------------------/
+File:   arith_decoder.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef ARITH_DECODER_H
+#define ARITH_DECODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Conditioning table destinations, same count as huffman tables.
+#define ARITH_TABLES 4
+#define ARITH_MAX_SCAN_COMPONENTS 4
+
+// Statistics bins per conditioning table, see F.1.4.4.1 and F.1.4.4.2 in the spec.
+#define ARITH_DC_STAT_BINS 64
+#define ARITH_AC_STAT_BINS 256
+
+// Conditioning a DAC segment can set per table. dc_lower and dc_upper are L and U, ac_kx is Kx.
+typedef struct _arith_conditioning
+{
+  unsigned char dc_lower;
+  unsigned char dc_upper;
+  unsigned char ac_kx;
+} arith_conditioning_t;
+
+// Spec defaults for tables no DAC segment mentions.
+void arith_conditioning_default(arith_conditioning_t* conditioning);
+
+/*
+----------------
+Arithmetic Decoding:
+----------------
+QM-coder entropy decoding for SOF9 frames, see Annex D and F.2.4 in the spec. Unlike huffman coded
+scans this works on the raw entropy coded bytes: the decoder undoes the 0xFF00 stuffing itself and
+is fed zeros once it runs into a marker, which is how the encoder expects its trailing zeros back.
+
+Each statistics bin is one byte: the index into the probability estimate table in the low 7 bits
+and the more probable symbol in the top one.
+*/
+typedef struct _arith_state
+{
+  const unsigned char* cur;
+
+  // End of the current restart interval. Set to cur once a marker is reached.
+  const unsigned char* end;
+
+  // Code register and interval size, see D.2. ct counts the bits buffered in c beyond the top 16.
+  uint32_t c;
+  uint32_t a;
+  int ct;
+} arith_state_t;
+
+typedef struct _arith_decoder
+{
+  arith_state_t state;
+  const unsigned char* scan_end;
+
+  // Which tables each component of the scan uses, in scan order.
+  unsigned char num_components;
+  unsigned char dc_tables[ARITH_MAX_SCAN_COMPONENTS];
+  unsigned char ac_tables[ARITH_MAX_SCAN_COMPONENTS];
+
+  // The conditioning of each component's tables, turned into the thresholds the DC context is picked by.
+  int dc_small[ARITH_MAX_SCAN_COMPONENTS];
+  int dc_large[ARITH_MAX_SCAN_COMPONENTS];
+  unsigned char ac_kx[ARITH_MAX_SCAN_COMPONENTS];
+
+  // The DC statistics each component starts its next block from, from the previous block's difference.
+  unsigned char dc_context[ARITH_MAX_SCAN_COMPONENTS];
+
+  unsigned char dc_stats[ARITH_TABLES][ARITH_DC_STAT_BINS];
+  unsigned char ac_stats[ARITH_TABLES][ARITH_AC_STAT_BINS];
+
+  // Sign bits are coded at an even chance that never adapts.
+  unsigned char fixed_bin;
+} arith_decoder_t;
+
+// Sets the decoder up over the len bytes of entropy coded data at data, still stuffed. Components are added afterwards.
+void arith_decoder_init(arith_decoder_t* decoder, const unsigned char* data, size_t len);
+
+// Adds the next component of the scan, with the tables its SOS entry picked.
+void arith_decoder_add_component(arith_decoder_t* decoder, unsigned char dc_table, unsigned char ac_table,
+                                 const arith_conditioning_t* dc_conditioning, const arith_conditioning_t* ac_conditioning);
+
+// Skips past the next restart marker and starts the statistics over.
+void arith_decoder_restart(arith_decoder_t* decoder);
+
+// Same contract as bits_to_dct_block: decodes one block of scan component s into the zeroed scratch_block,
+// with prev_dc_val as the DC predictor. Returns false on data that can't be valid.
+bool arith_decode_dct_block(arith_decoder_t* decoder, unsigned char s, int16_t* scratch_block, int* prev_dc_val);
+
+#endif
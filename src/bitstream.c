@@ -0,0 +1,202 @@
+/*--------------------------------------------------------------------------
+File:   bitstream.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "bitstream.h"
+
+#include "mem_budget.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void bit_reader_init(bit_reader_t* reader, const unsigned char* buf, size_t len)
+{
+  reader->start = reader->cur = buf;
+  reader->end = buf + len;
+  reader->accum = 0;
+  reader->bit_count = 0;
+  reader->overrun_bytes = 0;
+
+  bit_reader_refill(reader);
+}
+
+size_t bit_reader_position(const bit_reader_t* reader)
+{
+  const size_t loaded_bytes = (size_t)(reader->cur - reader->start) + reader->overrun_bytes;
+  return loaded_bytes * 8 - reader->bit_count;
+}
+
+bool bit_reader_overrun(const bit_reader_t* reader)
+{
+  return bit_reader_position(reader) > (size_t)(reader->end - reader->start) * 8;
+}
+
+void bit_writer_init(bit_writer_t* writer, size_t initial_capacity)
+{
+  writer->buf = (unsigned char*)malloc(initial_capacity);
+  writer->len = 0;
+  writer->capacity = writer->buf ? initial_capacity : 0;
+  writer->accum = 0;
+  writer->bit_count = 0;
+  writer->failed = writer->buf == NULL;
+}
+
+bool bit_writer_reserve(bit_writer_t* writer, size_t count)
+{
+  if (writer->failed)
+    return false;
+
+  if (writer->len + count <= writer->capacity)
+    return true;
+
+  size_t capacity = writer->capacity ? writer->capacity : 256;
+  while (capacity < writer->len + count)
+    capacity *= 2;
+
+  unsigned char* buf = (unsigned char*)realloc(writer->buf, capacity);
+  if (buf == NULL)
+  {
+    writer->failed = true;
+    return false;
+  }
+
+  writer->buf = buf;
+  writer->capacity = capacity;
+  return true;
+}
+
+void bit_writer_put_bytes(bit_writer_t* writer, const unsigned char* bytes, size_t count)
+{
+  if (!bit_writer_reserve(writer, count))
+    return;
+
+  memcpy(writer->buf + writer->len, bytes, count);
+  writer->len += count;
+}
+
+void bit_writer_flush(bit_writer_t* writer)
+{
+  // Pad to the byte boundary with ones, so the padding can never be mistaken for a code.
+  const unsigned pad = (8 - (writer->bit_count & 7)) & 7;
+  if (pad != 0)
+    bit_writer_put_bits(writer, 0x7F, pad);
+
+  if (!bit_writer_reserve(writer, 8))
+    return;
+
+  while (writer->bit_count >= 8)
+  {
+    writer->bit_count -= 8;
+    const unsigned char byte = (unsigned char)(writer->accum >> writer->bit_count);
+    writer->buf[writer->len++] = byte;
+    if (byte == 0xFF)
+      writer->buf[writer->len++] = 0x00;
+  }
+
+  writer->accum = 0;
+}
+
+unsigned char* bit_writer_release(bit_writer_t* writer, size_t* out_len)
+{
+  unsigned char* buf = writer->failed ? NULL : writer->buf;
+  *out_len = buf ? writer->len : 0;
+
+  if (buf == NULL)
+    free(writer->buf);
+
+  writer->buf = NULL;
+  writer->len = writer->capacity = 0;
+  return buf;
+}
+
+void bit_writer_cleanup(bit_writer_t* writer)
+{
+  free(writer->buf);
+  writer->buf = NULL;
+  writer->len = writer->capacity = 0;
+}
+
+size_t bitstream_scan_length(const unsigned char* src, size_t src_len)
+{
+  size_t read = 0;
+  while (read < src_len)
+  {
+    const unsigned char* marker = (const unsigned char*)memchr(src + read, 0xFF, src_len - read);
+    if (marker == NULL)
+      return src_len;
+
+    read = (size_t)(marker - src);
+    if (read + 1 >= src_len)
+      return src_len;
+
+    // Stuffed bytes, restart markers and fill bytes all belong to the scan.
+    const unsigned char next = src[read + 1];
+    if (next == 0x00 || (next >= 0xD0 && next <= 0xD7))
+      read += 2;
+    else if (next == 0xFF)
+      ++read;
+    else
+      return read;
+  }
+
+  return src_len;
+}
+
+size_t bitstream_unstuff(const unsigned char* src, size_t src_len, unsigned char** out_buf, size_t* out_len)
+{
+  // The scan can't be longer than what's left of the file, so that bounds the output.
+  unsigned char* dst = (unsigned char*)mem_malloc(src_len + BITSTREAM_GUARD_BYTES);
+  if (dst == NULL)
+  {
+    *out_buf = NULL;
+    *out_len = 0;
+    return 0;
+  }
+
+  size_t read = 0, written = 0;
+  while (read < src_len)
+  {
+    // Copy everything up to the next 0xFF in one go.
+    const unsigned char* marker = (const unsigned char*)memchr(src + read, 0xFF, src_len - read);
+    const size_t span = marker ? (size_t)(marker - (src + read)) : src_len - read;
+
+    memcpy(dst + written, src + read, span);
+    written += span;
+    read += span;
+
+    if (marker == NULL || read + 1 >= src_len)
+    {
+      read = src_len;
+      break;
+    }
+
+    const unsigned char next = src[read + 1];
+    if (next == 0x00)
+    {
+      // Stuffed byte. Keep the 0xFF and drop the zero.
+      dst[written++] = 0xFF;
+      read += 2;
+    }
+    else if (next >= 0xD0 && next <= 0xD7)
+    {
+      // Restart marker. Not part of the entropy coded data.
+      read += 2;
+    }
+    else if (next == 0xFF)
+    {
+      // Fill byte in front of a marker.
+      ++read;
+    }
+    else
+    {
+      // A real marker, this is the end of the scan.
+      break;
+    }
+  }
+
+  memset(dst + written, 0, BITSTREAM_GUARD_BYTES);
+
+  *out_buf = dst;
+  *out_len = written;
+  return read;
+}
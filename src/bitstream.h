@@ -0,0 +1,168 @@
+/*--------------------------------------------------------------------------/
+File:   bitstream.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Every buffer handed to the bit reader must be followed by this many zeroed bytes.
+// Refills always load 8 bytes at once, and the guard keeps that load in bounds without a per-read check.
+#define BITSTREAM_GUARD_BYTES 8
+
+/*
+----------------
+Bit Reader:
+----------------
+MSB-first reader over unstuffed entropy coded data. The accumulator is kept left aligned,
+so peeking is a single shift. Bounds are only looked at once per refill: reads past the end
+are fed zeros from the guard region and counted, which makes overruns detectable afterwards.
+*/
+typedef struct _bit_reader
+{
+  const unsigned char* start;
+  const unsigned char* cur;
+  const unsigned char* end;
+
+  uint64_t accum;
+  unsigned bit_count;
+
+  // Number of guard bytes loaded into the accumulator after the end of the data.
+  size_t overrun_bytes;
+} bit_reader_t;
+
+// Sets up a reader over buf. buf must have BITSTREAM_GUARD_BYTES of zeros after len.
+void bit_reader_init(bit_reader_t* reader, const unsigned char* buf, size_t len);
+
+// True if more bits were consumed than the data holds.
+bool bit_reader_overrun(const bit_reader_t* reader);
+
+// Number of bits consumed so far.
+size_t bit_reader_position(const bit_reader_t* reader);
+
+// Returns the number of bytes of entropy coded data at src, up to the marker that ends the scan.
+size_t bitstream_scan_length(const unsigned char* src, size_t src_len);
+
+// Copies the entropy coded segment at src into a new buffer, dropping stuffed 0x00 bytes and restart markers.
+// Stops at the first marker that ends the scan. The output is followed by BITSTREAM_GUARD_BYTES of zeros.
+// Returns the number of source bytes that belong to the scan. The caller frees *out_buf with mem_free.
+size_t bitstream_unstuff(const unsigned char* src, size_t src_len, unsigned char** out_buf, size_t* out_len);
+
+static inline uint64_t bitstream_load_be64(const unsigned char* p)
+{
+  // Compilers turn this into a single load and byte swap.
+  return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+         ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] <<  8) |  (uint64_t)p[7];
+}
+
+// Tops the accumulator up to at least 56 bits. Branch free apart from the end of data check.
+static inline void bit_reader_refill(bit_reader_t* reader)
+{
+  reader->accum |= bitstream_load_be64(reader->cur) >> reader->bit_count;
+  reader->cur += (63 - reader->bit_count) >> 3;
+  reader->bit_count |= 56;
+
+  if (reader->cur > reader->end)
+  {
+    // Anything past end came from the zeroed guard. Park the cursor so later loads stay inside it.
+    reader->overrun_bytes += (size_t)(reader->cur - reader->end);
+    reader->cur = reader->end;
+  }
+}
+
+// Returns the next count bits without consuming them. count must be 1..56 and already buffered.
+static inline unsigned bit_reader_peek(const bit_reader_t* reader, unsigned count)
+{
+  return (unsigned)(reader->accum >> (64 - count));
+}
+
+// Drops count already buffered bits.
+static inline void bit_reader_consume(bit_reader_t* reader, unsigned count)
+{
+  reader->accum <<= count;
+  reader->bit_count -= count;
+}
+
+// Reads count bits (0..25), refilling if needed.
+static inline unsigned bit_reader_read(bit_reader_t* reader, unsigned count)
+{
+  if (count == 0)
+    return 0;
+
+  if (reader->bit_count < count)
+    bit_reader_refill(reader);
+
+  const unsigned bits = bit_reader_peek(reader, count);
+  bit_reader_consume(reader, count);
+  return bits;
+}
+
+// Drops the bits left in the current byte. Restart intervals always end on a byte boundary.
+static inline void bit_reader_align(bit_reader_t* reader)
+{
+  bit_reader_consume(reader, reader->bit_count & 7);
+}
+
+/*
+----------------
+Bit Writer:
+----------------
+The other direction: MSB-first writer into a growing heap buffer. Entropy coded bits get
+a 0x00 stuffed after every 0xFF, raw bytes (markers and headers) go in as they are.
+Running out of memory sets failed and turns every later write into a no-op.
+*/
+typedef struct _bit_writer
+{
+  unsigned char* buf;
+  size_t len;
+  size_t capacity;
+
+  uint64_t accum;
+  unsigned bit_count;
+
+  bool failed;
+} bit_writer_t;
+
+void bit_writer_init(bit_writer_t* writer, size_t initial_capacity);
+
+// Appends bytes without stuffing. Only valid on a byte boundary, see bit_writer_flush.
+void bit_writer_put_bytes(bit_writer_t* writer, const unsigned char* bytes, size_t count);
+
+// Writes any bits still in the accumulator, padding the last byte with ones.
+void bit_writer_flush(bit_writer_t* writer);
+
+// Hands the buffer over to the caller, who frees it. The writer is left empty.
+unsigned char* bit_writer_release(bit_writer_t* writer, size_t* out_len);
+
+void bit_writer_cleanup(bit_writer_t* writer);
+
+// Makes sure count more bytes fit. Stuffing can double what the accumulator holds.
+bool bit_writer_reserve(bit_writer_t* writer, size_t count);
+
+// Appends count bits (0..24) of bits, MSB first.
+static inline void bit_writer_put_bits(bit_writer_t* writer, unsigned bits, unsigned count)
+{
+  writer->accum = (writer->accum << count) | (bits & ((1u << count) - 1));
+  writer->bit_count += count;
+
+  if (writer->bit_count < 32)
+    return;
+
+  // Four bytes can turn into eight with stuffing.
+  if (!bit_writer_reserve(writer, 8))
+    return;
+
+  while (writer->bit_count >= 8)
+  {
+    writer->bit_count -= 8;
+    const unsigned char byte = (unsigned char)(writer->accum >> writer->bit_count);
+    writer->buf[writer->len++] = byte;
+    if (byte == 0xFF)
+      writer->buf[writer->len++] = 0x00;
+  }
+}
+
+#endif
@@ -0,0 +1,349 @@
+/*--------------------------------------------------------------------------
+File:   color_convert.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "color_convert.h"
+
+#include "mem_budget.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// RGB -> Y weights, in 16.16 fixed point.
+#define FIX_R_Y  19595 // 0.299
+#define FIX_G_Y  38470 // 0.587
+#define FIX_B_Y   7471 // 0.114
+
+// YCbCr -> RGB factors from the JFIF spec, in 16.16 fixed point.
+#define FIX_CR_R  91881 // 1.402
+#define FIX_CB_G  22554 // 0.344136
+#define FIX_CR_G  46802 // 0.714136
+#define FIX_CB_B 116130 // 1.772
+// RGB -> CbCr weights, in 16.16 fixed point. Y uses the weights above.
+#define FIX_R_CB  11059 // 0.168736
+#define FIX_G_CB  21709 // 0.331264
+#define FIX_B_CB  32768 // 0.5
+#define FIX_R_CR  32768 // 0.5
+#define FIX_G_CR  27439 // 0.418688
+#define FIX_B_CR   5329 // 0.081312
+#define FIX_HALF  32768
+
+// Chroma is centered on 128. One less than half keeps a full scale value from rounding up to 256.
+#define FIX_CHROMA_OFFSET ((128 << 16) + FIX_HALF - 1)
+
+static inline unsigned char clamp_byte(int value)
+{
+  return value < 0 ? 0 : (value > 255 ? 255 : (unsigned char)value);
+}
+
+bool color_converter_init(color_converter_t* converter, const jpeg_output_t* output, unsigned width,
+                          unsigned char num_planes, bool ycbcr, unsigned char h_max, unsigned char v_max)
+{
+  memset(converter, 0, sizeof(color_converter_t));
+
+  // Only greyscale and YCbCr are understood so far.
+  if (num_planes != 1 && num_planes != 3)
+    return false;
+
+  // Rows can run bottom up with a negative stride, but they can't overlap.
+  const ptrdiff_t stride = output->strides[0];
+  if (output->planes[0] == NULL || (size_t)(stride < 0 ? -stride : stride) < width * jpeg_pixel_format_size(output->format))
+    return false;
+
+  converter->scratch_rows = (unsigned char*)mem_malloc((size_t)width * num_planes * jpeg_pixel_format_sample_size(output->format));
+  if (converter->scratch_rows == NULL)
+    return false;
+
+  converter->output = output;
+  converter->width = width;
+  converter->num_planes = num_planes;
+  converter->ycbcr = ycbcr;
+  converter->h_max = h_max;
+  converter->v_max = v_max;
+  return true;
+}
+
+bool color_converter_init_planar(color_converter_t* converter, const jpeg_output_t* output, unsigned char num_planes,
+                                 unsigned char v_max, const size_t* plane_row_bytes, const unsigned* plane_rows)
+{
+  memset(converter, 0, sizeof(color_converter_t));
+
+  // NV12 packs both chroma components into its second plane.
+  const unsigned char output_planes = output->format == JPF_NV12 ? 2 : num_planes;
+  for (unsigned char p = 0; p != output_planes; ++p)
+  {
+    const ptrdiff_t stride = output->strides[p];
+    if (output->planes[p] == NULL || (size_t)(stride < 0 ? -stride : stride) < plane_row_bytes[p])
+      return false;
+
+    converter->plane_row_bytes[p] = plane_row_bytes[p];
+    converter->plane_rows[p] = plane_rows[p];
+  }
+
+  converter->output = output;
+  converter->num_planes = num_planes;
+  converter->v_max = v_max;
+  return true;
+}
+
+void color_converter_cleanup(color_converter_t* converter)
+{
+  mem_free(converter->scratch_rows);
+  converter->scratch_rows = NULL;
+}
+
+// Returns row r of the MCU row at full resolution, upsampling into scratch when the component is subsampled.
+static const unsigned char* upsample_row(const color_converter_t* converter, const color_plane_t* plane, unsigned r, unsigned char* scratch)
+{
+  const unsigned char* src = plane->data + (size_t)(r * plane->sample_factor_vert / converter->v_max) * plane->stride;
+
+  if (plane->sample_factor_horiz == converter->h_max)
+    return src;
+
+  const unsigned width = converter->width;
+  if (plane->sample_factor_horiz * 2 == converter->h_max)
+  {
+    for (unsigned x = 0; x != width; ++x)
+      scratch[x] = src[x >> 1];
+  }
+  else
+  {
+    for (unsigned x = 0; x != width; ++x)
+      scratch[x] = src[x * plane->sample_factor_horiz / converter->h_max];
+  }
+
+  return scratch;
+}
+
+static void ycbcr_to_packed(const unsigned char* y_row, const unsigned char* cb_row, const unsigned char* cr_row,
+                            unsigned char* out, unsigned width, unsigned char r_idx, unsigned char b_idx, unsigned char pixel_size)
+{
+  for (unsigned x = 0; x != width; ++x, out += pixel_size)
+  {
+    const int y = y_row[x];
+    const int cb = cb_row[x] - 128;
+    const int cr = cr_row[x] - 128;
+
+    out[r_idx] = clamp_byte(y + ((FIX_CR_R * cr + FIX_HALF) >> 16));
+    out[1]     = clamp_byte(y + ((-FIX_CB_G * cb - FIX_CR_G * cr + FIX_HALF) >> 16));
+    out[b_idx] = clamp_byte(y + ((FIX_CB_B * cb + FIX_HALF) >> 16));
+
+    if (pixel_size == 4)
+      out[3] = 0xFF;
+  }
+}
+
+static void rgb_to_packed(const unsigned char* r_row, const unsigned char* g_row, const unsigned char* b_row,
+                          unsigned char* out, unsigned width, unsigned char r_idx, unsigned char b_idx, unsigned char pixel_size)
+{
+  for (unsigned x = 0; x != width; ++x, out += pixel_size)
+  {
+    out[r_idx] = r_row[x];
+    out[1]     = g_row[x];
+    out[b_idx] = b_row[x];
+
+    if (pixel_size == 4)
+      out[3] = 0xFF;
+  }
+}
+
+static void rgb_to_gray(const unsigned char* r_row, const unsigned char* g_row, const unsigned char* b_row, unsigned char* out, unsigned width)
+{
+  for (unsigned x = 0; x != width; ++x)
+    out[x] = (unsigned char)((FIX_R_Y * r_row[x] + FIX_G_Y * g_row[x] + FIX_B_Y * b_row[x] + FIX_HALF) >> 16);
+}
+
+static void gray_to_packed(const unsigned char* y_row, unsigned char* out, unsigned width, unsigned char pixel_size)
+{
+  for (unsigned x = 0; x != width; ++x, out += pixel_size)
+  {
+    out[0] = out[1] = out[2] = y_row[x];
+
+    if (pixel_size == 4)
+      out[3] = 0xFF;
+  }
+}
+
+/*
+12 bit samples, from 16 bit planes into the 16 bit formats. Same conversions as the 8 bit ones with
+chroma centered on 2048 instead. The 16.16 products still fit an int with 12 bit inputs.
+*/
+#define SAMPLE_12_MAX 4095
+#define CHROMA_12_CENTER 2048
+
+static inline uint16_t clamp_sample_12(int value)
+{
+  return value < 0 ? 0 : (value > SAMPLE_12_MAX ? SAMPLE_12_MAX : (uint16_t)value);
+}
+
+static const uint16_t* upsample_row_16(const color_converter_t* converter, const color_plane_t* plane, unsigned r, uint16_t* scratch)
+{
+  const uint16_t* src = (const uint16_t*)(plane->data + (size_t)(r * plane->sample_factor_vert / converter->v_max) * plane->stride);
+  if (plane->sample_factor_horiz == converter->h_max)
+    return src;
+
+  for (unsigned x = 0; x != converter->width; ++x)
+    scratch[x] = src[x * plane->sample_factor_horiz / converter->h_max];
+
+  return scratch;
+}
+
+static void convert_row_16(const color_converter_t* converter, const uint16_t* const* rows, uint16_t* out)
+{
+  const unsigned width = converter->width;
+  const bool gray_out = converter->output->format == JPF_GRAY16;
+
+  if (gray_out && (converter->num_planes == 1 || converter->ycbcr))
+  {
+    memcpy(out, rows[0], sizeof(uint16_t) * width);
+    return;
+  }
+
+  for (unsigned x = 0; x != width; ++x)
+  {
+    if (converter->num_planes == 1)
+    {
+      out[0] = out[1] = out[2] = rows[0][x];
+      out += 3;
+      continue;
+    }
+
+    int r = rows[0][x], g = rows[1][x], b = rows[2][x];
+    if (converter->ycbcr)
+    {
+      const int y = rows[0][x], cb = rows[1][x] - CHROMA_12_CENTER, cr = rows[2][x] - CHROMA_12_CENTER;
+      r = y + ((FIX_CR_R * cr + FIX_HALF) >> 16);
+      g = y + ((-FIX_CB_G * cb - FIX_CR_G * cr + FIX_HALF) >> 16);
+      b = y + ((FIX_CB_B * cb + FIX_HALF) >> 16);
+    }
+
+    if (gray_out)
+    {
+      *out++ = (uint16_t)((FIX_R_Y * r + FIX_G_Y * g + FIX_B_Y * b + FIX_HALF) >> 16);
+    }
+    else
+    {
+      out[0] = clamp_sample_12(r);
+      out[1] = clamp_sample_12(g);
+      out[2] = clamp_sample_12(b);
+      out += 3;
+    }
+  }
+}
+
+// Copies the rows of every component that fall inside this MCU row to their output planes.
+static void copy_planar_rows(const color_converter_t* converter, const color_plane_t* planes, unsigned first_row, unsigned row_count)
+{
+  const jpeg_output_t* output = converter->output;
+  const unsigned char output_planes = output->format == JPF_NV12 ? 2 : converter->num_planes;
+
+  for (unsigned char p = 0; p != output_planes; ++p)
+  {
+    // MCU rows always start on a multiple of the MCU height, so the first row divides evenly.
+    const unsigned char v = planes[p].sample_factor_vert;
+    const unsigned first = first_row * v / converter->v_max;
+    unsigned end = ((first_row + row_count) * v + converter->v_max - 1) / converter->v_max;
+    if (end > converter->plane_rows[p])
+      end = converter->plane_rows[p];
+
+    const size_t row_bytes = converter->plane_row_bytes[p];
+    for (unsigned r = first; r < end; ++r)
+    {
+      unsigned char* out = output->planes[p] + (ptrdiff_t)r * output->strides[p];
+      const size_t src_offset = (size_t)(r - first) * planes[p].stride;
+
+      if (output->format == JPF_NV12 && p == 1)
+      {
+        const unsigned char* cb = planes[1].data + src_offset;
+        const unsigned char* cr = planes[2].data + src_offset;
+        for (size_t x = 0; x != row_bytes / 2; ++x)
+        {
+          out[2 * x] = cb[x];
+          out[2 * x + 1] = cr[x];
+        }
+      }
+      else
+      {
+        memcpy(out, planes[p].data + src_offset, row_bytes);
+      }
+    }
+  }
+}
+
+void color_convert_rows(color_converter_t* converter, const color_plane_t* planes, unsigned first_row, unsigned row_count)
+{
+  if (jpeg_pixel_format_is_planar(converter->output->format))
+  {
+    copy_planar_rows(converter, planes, first_row, row_count);
+    return;
+  }
+
+  const jpeg_output_t* output = converter->output;
+  const unsigned width = converter->width;
+  const unsigned char pixel_size = (unsigned char)jpeg_pixel_format_size(output->format);
+
+  if (jpeg_pixel_format_sample_size(output->format) == 2)
+  {
+    uint16_t* scratch = (uint16_t*)converter->scratch_rows;
+    for (unsigned r = 0; r != row_count; ++r)
+    {
+      const uint16_t* rows[3];
+      for (unsigned char c = 0; c != converter->num_planes; ++c)
+        rows[c] = upsample_row_16(converter, &planes[c], r, scratch + (size_t)c * width);
+
+      convert_row_16(converter, rows, (uint16_t*)(output->planes[0] + (ptrdiff_t)(first_row + r) * output->strides[0]));
+    }
+    return;
+  }
+
+  // Red and blue swap places between the RGB and BGR orders. Green and alpha never move.
+  const bool bgr = output->format == JPF_BGR24 || output->format == JPF_BGRA32;
+  const unsigned char r_idx = bgr ? 2 : 0, b_idx = bgr ? 0 : 2;
+
+  for (unsigned r = 0; r != row_count; ++r)
+  {
+    unsigned char* out = output->planes[0] + (ptrdiff_t)(first_row + r) * output->strides[0];
+
+    // Greyscale output only ever needs luma.
+    const unsigned char planes_needed = output->format == JPF_GRAY8 && converter->ycbcr ? 1 : converter->num_planes;
+
+    const unsigned char* rows[3];
+    for (unsigned char c = 0; c != planes_needed; ++c)
+      rows[c] = upsample_row(converter, &planes[c], r, converter->scratch_rows + (size_t)c * width);
+
+    if (output->format == JPF_GRAY8 && (converter->num_planes == 1 || converter->ycbcr))
+      memcpy(out, rows[0], width);
+    else if (output->format == JPF_GRAY8)
+      rgb_to_gray(rows[0], rows[1], rows[2], out, width);
+    else if (converter->num_planes == 1)
+      gray_to_packed(rows[0], out, width, pixel_size);
+    else if (converter->ycbcr)
+      ycbcr_to_packed(rows[0], rows[1], rows[2], out, width, r_idx, b_idx, pixel_size);
+    else
+      rgb_to_packed(rows[0], rows[1], rows[2], out, width, r_idx, b_idx, pixel_size);
+  }
+}
+
+void color_packed_to_ycbcr_row(const unsigned char* in, jpeg_pixel_format_t format, unsigned width,
+                               unsigned char* y, unsigned char* cb, unsigned char* cr)
+{
+  if (format == JPF_GRAY8)
+  {
+    memcpy(y, in, width);
+    return;
+  }
+
+  const unsigned char pixel_size = (unsigned char)jpeg_pixel_format_size(format);
+  const bool bgr = format == JPF_BGR24 || format == JPF_BGRA32;
+  const unsigned char r_idx = bgr ? 2 : 0, b_idx = bgr ? 0 : 2;
+
+  for (unsigned x = 0; x != width; ++x, in += pixel_size)
+  {
+    const int r = in[r_idx], g = in[1], b = in[b_idx];
+
+    y[x]  = (unsigned char)((FIX_R_Y * r + FIX_G_Y * g + FIX_B_Y * b + FIX_HALF) >> 16);
+    cb[x] = (unsigned char)((-FIX_R_CB * r - FIX_G_CB * g + FIX_B_CB * b + FIX_CHROMA_OFFSET) >> 16);
+    cr[x] = (unsigned char)((FIX_R_CR * r - FIX_G_CR * g - FIX_B_CR * b + FIX_CHROMA_OFFSET) >> 16);
+  }
+}
@@ -0,0 +1,64 @@
+/*--------------------------------------------------------------------------/
+File:   color_convert.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef COLOR_CONVERT_H
+#define COLOR_CONVERT_H
+
+#include "decoder.h"
+
+#include <stddef.h>
+
+// One component's samples for the MCU row being output.
+typedef struct _color_plane
+{
+  const unsigned char* data;
+  size_t stride;
+  unsigned char sample_factor_horiz;
+  unsigned char sample_factor_vert;
+} color_plane_t;
+
+/*
+----------------
+Color Converter:
+----------------
+Upsamples and color converts one MCU row at a time, straight into the caller's output.
+Holds one upsampled row per component as scratch, never a full frame.
+Planar formats skip both steps and copy each component's rows to its own plane.
+*/
+typedef struct _color_converter
+{
+  const jpeg_output_t* output;
+  unsigned width;
+  unsigned char num_planes;
+  bool ycbcr;
+  unsigned char h_max;
+  unsigned char v_max;
+  unsigned char* scratch_rows;
+
+  // Planar output only. Size of every output plane, from jpeg_plane_size.
+  size_t plane_row_bytes[MAX_COMPONENTS];
+  unsigned plane_rows[MAX_COMPONENTS];
+} color_converter_t;
+
+// Sets up a converter for an image width pixels wide. Three planes are either YCbCr or already RGB.
+// Returns false if the output format can't be produced from this many components or the scratch rows couldn't be allocated.
+bool color_converter_init(color_converter_t* converter, const jpeg_output_t* output, unsigned width,
+                          unsigned char num_planes, bool ycbcr, unsigned char h_max, unsigned char v_max);
+
+// Sets up a converter for a planar output format. The plane sizes must come from jpeg_plane_size,
+// which is also what decides whether the format fits the image.
+bool color_converter_init_planar(color_converter_t* converter, const jpeg_output_t* output, unsigned char num_planes,
+                                 unsigned char v_max, const size_t* plane_row_bytes, const unsigned* plane_rows);
+
+// Writes row_count rows from planes to the output, starting at output row first_row.
+void color_convert_rows(color_converter_t* converter, const color_plane_t* planes, unsigned first_row, unsigned row_count);
+
+void color_converter_cleanup(color_converter_t* converter);
+
+// The other direction, for the encoder: splits one row of a packed RGB format into Y, Cb and Cr.
+// Greyscale input only fills y.
+void color_packed_to_ycbcr_row(const unsigned char* in, jpeg_pixel_format_t format, unsigned width,
+                               unsigned char* y, unsigned char* cb, unsigned char* cr);
+
+#endif
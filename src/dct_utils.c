@@ -3,108 +3,405 @@ File:   dct_utils.cpp
 Date:   2021/12/29
 Author: kaiyen
 ---------------------------------------------------------------------------*/
+// M_PI and M_SQRT2 are not part of strict C99; this has to come before any system header is pulled in.
+#undef __STRICT_ANSI__
+#define _USE_MATH_DEFINES
+
 #include "dct_utils.h"
 
+#include "log.h"
 #include "print_utils.h"
+#include "profile.h"
 #include "utils.h"
 
-#undef __STRICT_ANSI__
-#define _USE_MATH_DEFINES
 #include <math.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static float* s_inverse_dct_table = NULL;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define ENABLE_DCT_LOG 0
+
+#if ENABLE_DCT_LOG
+#define DCT_LOG(...) LOG_TRACE(__VA_ARGS__)
+#else
+#define DCT_LOG(...)
+#endif
 
-void init_inverse_dct_table(unsigned char precision)
+// Baseline DC differences are at most 11 bits, 15 for 12-bit precision.
+static const unsigned char DC_MAX_BITS = 15;
+static const unsigned char AC_EOB = 0x00;
+
+// Row u holds C(u)/2 * cos((2x+1)u*pi/16) for x = 0..7, so one pass of the IDCT is an 8x8 matrix multiply.
+static float s_inverse_dct_table[DCT_BLOCK_SIZE];
+
+// The same table transposed, for the row pass of the forward DCT.
+static float s_forward_dct_table_t[DCT_BLOCK_SIZE];
+
+// The same table for the 12 bit IDCT, in fixed point with IDCT12_CONST_BITS fractional bits.
+// The SSE2 version stores rows 2p and 2p + 1 interleaved per column, so one madd sums two terms per lane.
+#define IDCT12_CONST_BITS 13
+#define IDCT12_PASS1_BITS 2
+static int16_t s_idct12_table[DCT_BLOCK_SIZE];
+#if defined(__SSE2__)
+static int16_t s_idct12_pairs[DCT_BLOCK_SIDE / 2][DCT_BLOCK_SIDE * 2];
+#endif
+
+// N point versions for the 1/2, 1/4 and 1/8 scaled IDCTs, row u holding C(u)/2 * cos((2x+1)u*pi/2N).
+// With the 1/2 folded in, a DC only block averages to the same value at every scale.
+static float s_scaled_idct_tables[3][DCT_BLOCK_SIZE / 4];
+
+void init_inverse_dct_table(void)
 {
-  s_inverse_dct_table = (float*)malloc(sizeof(float) * precision * precision);
-  if (s_inverse_dct_table == NULL)
+  for (unsigned char u = 0; u != DCT_BLOCK_SIDE; ++u)
   {
-    printf("ERROR: Failed to allocate inverse DCT Table!");
-    return;
+    // We can bake in the coefficient, C(0) is 1/sqrt(2) and 1 for the rest.
+    const float coeff = (u == 0 ? (float)(1.0 / M_SQRT2) : 1.0f) * 0.5f;
+    for (unsigned char x = 0; x != DCT_BLOCK_SIDE; ++x)
+    {
+      s_inverse_dct_table[u * DCT_BLOCK_SIDE + x] = coeff * cosf(((2.0f * (float)x + 1) * u * (float)M_PI) / 16.0f);
+      s_forward_dct_table_t[x * DCT_BLOCK_SIDE + u] = s_inverse_dct_table[u * DCT_BLOCK_SIDE + x];
+    }
   }
 
-  unsigned char i = 0, j;
-  unsigned offset;
-  float coeff = (1.0f / M_SQRT2) / 16.0f;
+  for (unsigned char i = 0; i != DCT_BLOCK_SIZE; ++i)
+    s_idct12_table[i] = (int16_t)lrintf(s_inverse_dct_table[i] * (float)(1 << IDCT12_CONST_BITS));
 
-  for (j = 0; j != precision; ++j)
+#if defined(__SSE2__)
+  for (unsigned char p = 0; p != DCT_BLOCK_SIDE / 2; ++p)
   {
-    s_inverse_dct_table[j] = coeff; // We can bake in the coefficient, since cos(0) is 1.
+    for (unsigned char x = 0; x != DCT_BLOCK_SIDE; ++x)
+    {
+      s_idct12_pairs[p][x * 2] = s_idct12_table[(p * 2) * DCT_BLOCK_SIDE + x];
+      s_idct12_pairs[p][x * 2 + 1] = s_idct12_table[(p * 2 + 1) * DCT_BLOCK_SIDE + x];
+    }
   }
+#endif
 
-  coeff = 1.0f;
+  for (unsigned char t = 0; t != 3; ++t)
+  {
+    const unsigned char size = 1 << t;
+    for (unsigned char u = 0; u != size; ++u)
+    {
+      const float coeff = (u == 0 ? (float)(1.0 / M_SQRT2) : 1.0f) * 0.5f;
+      for (unsigned char x = 0; x != size; ++x)
+        s_scaled_idct_tables[t][u * size + x] = coeff * cosf(((2.0f * (float)x + 1) * u * (float)M_PI) / (2.0f * size));
+    }
+  }
 
-  for (i = 1; i != precision; ++i)
+  if (LOG_ENABLED(LL_DEBUG))
+    print_block(LL_DEBUG, "Inverse DCT Table", "%+02.2f ", s_inverse_dct_table, DCT_BLOCK_SIDE, PT_FLOAT);
+}
+
+static inline unsigned char clamp_sample(float value)
+{
+  // Round to nearest and shift back from the signed range the encoder worked in.
+  const int sample = (int)lrintf(value) + 128;
+  return sample < 0 ? 0 : (sample > 255 ? 255 : (unsigned char)sample);
+}
+
+void idct_block(const int16_t* dct_block, const unsigned short* q_table, unsigned char* out, size_t out_stride)
+{
+  float dequantized[DCT_BLOCK_SIZE];
+  for (unsigned char i = 0; i != DCT_BLOCK_SIZE; ++i)
+    dequantized[i] = (float)(dct_block[i] * (int)q_table[i]);
+
+  // Rows first: tmp[v][x] = sum over u of F[v][u] * T[u][x]
+  float tmp[DCT_BLOCK_SIZE];
+  for (unsigned char v = 0; v != DCT_BLOCK_SIDE; ++v)
   {
-    offset = i * precision;
-    for (j = 0; j != precision; ++j)
+    const float* row = &dequantized[v * DCT_BLOCK_SIDE];
+    for (unsigned char x = 0; x != DCT_BLOCK_SIDE; ++x)
     {
-      s_inverse_dct_table[offset + j] = coeff * cosf(((2.0f * (float)j + 1) * i * M_PI) / 16.0f);
+      float sum = 0.0f;
+      for (unsigned char u = 0; u != DCT_BLOCK_SIDE; ++u)
+        sum += row[u] * s_inverse_dct_table[u * DCT_BLOCK_SIDE + x];
+      tmp[v * DCT_BLOCK_SIDE + x] = sum;
     }
   }
 
-  print_block("Inverse DCT Table", "%+02.2f ", s_inverse_dct_table, precision, PT_FLOAT);
+  // Then columns: out[y][x] = sum over v of tmp[v][x] * T[v][y]
+  for (unsigned char y = 0; y != DCT_BLOCK_SIDE; ++y, out += out_stride)
+  {
+    float sums[DCT_BLOCK_SIDE] = {0};
+    for (unsigned char v = 0; v != DCT_BLOCK_SIDE; ++v)
+    {
+      const float weight = s_inverse_dct_table[v * DCT_BLOCK_SIDE + y];
+      for (unsigned char x = 0; x != DCT_BLOCK_SIDE; ++x)
+        sums[x] += tmp[v * DCT_BLOCK_SIDE + x] * weight;
+    }
+
+    for (unsigned char x = 0; x != DCT_BLOCK_SIDE; ++x)
+      out[x] = clamp_sample(sums[x]);
+  }
 }
 
-// huff_tables is assumed to be a non-null array of 2 huffman table pointers.
-// scratch_block is assumed to be a buffer provided by the caller.
-unsigned bits_to_dct_block(unsigned char*const block, const huff_node_t** huff_tables, unsigned* scratch_block, unsigned* prev_dc_val)
+void idct_block_scaled(const int16_t* dct_block, const unsigned short* q_table, unsigned char* out, size_t out_stride, unsigned char size)
 {
-  const huff_node_t* huff_table_ptr = huff_tables[0];
-  // read one bit at a time.
-  unsigned cur_pos = 0;
-  unsigned char bits_to_read = huff_table_lookup(huff_table_ptr, block, &cur_pos);
+  if (size == DCT_BLOCK_SIDE)
+  {
+    idct_block(dct_block, q_table, out, out_stride);
+    return;
+  }
 
-  if (bits_to_read == 0x0) // 0 is the EOB indicator
+  const float* table = s_scaled_idct_tables[size == 1 ? 0 : (size == 2 ? 1 : 2)];
+
+  // Same two passes as idct_block, over the top left size x size corner only.
+  float tmp[DCT_BLOCK_SIZE / 4];
+  for (unsigned char v = 0; v != size; ++v)
   {
-    printf("DC EOB INDICATOR! cur_pos: %d\n", cur_pos);
+    for (unsigned char x = 0; x != size; ++x)
+    {
+      float sum = 0.0f;
+      for (unsigned char u = 0; u != size; ++u)
+      {
+        const unsigned char idx = v * DCT_BLOCK_SIDE + u;
+        sum += (float)(dct_block[idx] * (int)q_table[idx]) * table[u * size + x];
+      }
+      tmp[v * size + x] = sum;
+    }
   }
-  else
+
+  for (unsigned char y = 0; y != size; ++y, out += out_stride)
   {
-    // Huff table returns num bits to read from the stream.
-    // Bits read need to be decoded into a usable value, and THAT goes into the scratch table.
-    int read_bits = read_stream(block, cur_pos, bits_to_read, 0);
-    int decoded_dc_val = dc_ac_value_decode(read_bits, bits_to_read);
+    for (unsigned char x = 0; x != size; ++x)
+    {
+      float sum = 0.0f;
+      for (unsigned char v = 0; v != size; ++v)
+        sum += tmp[v * size + x] * table[v * size + y];
+      out[x] = clamp_sample(sum);
+    }
+  }
+}
 
-    printf("DC Read returned: %d.\n", decoded_dc_val);
+#if defined(__SSE2__)
+// Adds in[2p] * T[2p][x] + in[2p + 1] * T[2p + 1][x], with pair holding those two inputs in every lane.
+static inline void idct12_accumulate(__m128i pair, unsigned char p, __m128i* lo, __m128i* hi)
+{
+  *lo = _mm_add_epi32(*lo, _mm_madd_epi16(pair, _mm_loadu_si128((const __m128i*)s_idct12_pairs[p])));
+  *hi = _mm_add_epi32(*hi, _mm_madd_epi16(pair, _mm_loadu_si128((const __m128i*)(s_idct12_pairs[p] + DCT_BLOCK_SIDE))));
+}
+#endif
 
-    cur_pos += bits_to_read;
+/*
+One pass of the 12 bit IDCT: out[r][x] = sum over k of in[r][k] * T[k][x], rounded off by shift bits after
+adding bias and saturated to 16 bits. Inputs are 16 bit and the table has 13 fractional bits, so eight
+products always fit the 32 bit accumulators.
+*/
+static inline void idct12_pass(const int16_t* in, int16_t* out, int bias, int shift)
+{
+#if defined(__SSE2__)
+  const __m128i bias_v = _mm_set1_epi32(bias);
+  for (unsigned char r = 0; r != DCT_BLOCK_SIDE; ++r)
+  {
+    const __m128i row = _mm_loadu_si128((const __m128i*)(in + r * DCT_BLOCK_SIDE));
+    __m128i lo = bias_v, hi = bias_v;
+
+    // Each shuffle spreads one pair of inputs over every lane, see s_idct12_pairs.
+    idct12_accumulate(_mm_shuffle_epi32(row, 0x00), 0, &lo, &hi);
+    idct12_accumulate(_mm_shuffle_epi32(row, 0x55), 1, &lo, &hi);
+    idct12_accumulate(_mm_shuffle_epi32(row, 0xAA), 2, &lo, &hi);
+    idct12_accumulate(_mm_shuffle_epi32(row, 0xFF), 3, &lo, &hi);
 
-    scratch_block[0] = decoded_dc_val + *prev_dc_val;
-    *prev_dc_val = decoded_dc_val;
+    const __m128i packed = _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+    _mm_storeu_si128((__m128i*)(out + r * DCT_BLOCK_SIDE), packed);
   }
+#else
+  for (unsigned char r = 0; r != DCT_BLOCK_SIDE; ++r)
+  {
+    for (unsigned char x = 0; x != DCT_BLOCK_SIDE; ++x)
+    {
+      int32_t sum = bias;
+      for (unsigned char k = 0; k != DCT_BLOCK_SIDE; ++k)
+        sum += (int32_t)in[r * DCT_BLOCK_SIDE + k] * s_idct12_table[k * DCT_BLOCK_SIDE + x];
 
-  //We've read the DC value, now time for the 63 AC values.
-  huff_table_ptr = huff_tables[1];
+      sum >>= shift;
+      out[r * DCT_BLOCK_SIDE + x] = (int16_t)(sum < INT16_MIN ? INT16_MIN : (sum > INT16_MAX ? INT16_MAX : sum));
+    }
+  }
+#endif
+}
+
+static inline void transpose_8x8_16(const int16_t* in, int16_t* out)
+{
+#if defined(__SSE2__)
+  __m128i r[DCT_BLOCK_SIDE], t[DCT_BLOCK_SIDE];
+  for (unsigned char i = 0; i != DCT_BLOCK_SIDE; ++i)
+    r[i] = _mm_loadu_si128((const __m128i*)(in + i * DCT_BLOCK_SIDE));
+
+  // Pairs of rows into 32 bit, then 64 bit, then whole columns.
+  for (unsigned char i = 0; i != DCT_BLOCK_SIDE / 2; ++i)
+  {
+    t[i] = _mm_unpacklo_epi16(r[2 * i], r[2 * i + 1]);
+    t[i + 4] = _mm_unpackhi_epi16(r[2 * i], r[2 * i + 1]);
+  }
+  for (unsigned char i = 0; i != DCT_BLOCK_SIDE / 2; i += 2)
+  {
+    r[i] = _mm_unpacklo_epi32(t[i], t[i + 1]);
+    r[i + 1] = _mm_unpackhi_epi32(t[i], t[i + 1]);
+    r[i + 4] = _mm_unpacklo_epi32(t[i + 4], t[i + 5]);
+    r[i + 5] = _mm_unpackhi_epi32(t[i + 4], t[i + 5]);
+  }
 
-  if (huff_table_ptr == NULL)
+  static const unsigned char ORDER[DCT_BLOCK_SIDE / 2] = {0, 1, 4, 5};
+  for (unsigned char i = 0; i != DCT_BLOCK_SIDE / 2; ++i)
   {
-    printf("FUCK!\n");
+    const unsigned char a = ORDER[i];
+    _mm_storeu_si128((__m128i*)(out + (i * 2) * DCT_BLOCK_SIDE), _mm_unpacklo_epi64(r[a], r[a + 2]));
+    _mm_storeu_si128((__m128i*)(out + (i * 2 + 1) * DCT_BLOCK_SIDE), _mm_unpackhi_epi64(r[a], r[a + 2]));
   }
+#else
+  for (unsigned char y = 0; y != DCT_BLOCK_SIDE; ++y)
+  {
+    for (unsigned char x = 0; x != DCT_BLOCK_SIDE; ++x)
+      out[x * DCT_BLOCK_SIDE + y] = in[y * DCT_BLOCK_SIDE + x];
+  }
+#endif
+}
+
+void idct_block_12(const int16_t* dct_block, const unsigned short* q_table, uint16_t* out, size_t out_stride)
+{
+  // Dequantized coefficients of a valid 12 bit stream fit 16 bits. Stored transposed, so the first pass runs down the columns.
+  int16_t dequantized[DCT_BLOCK_SIZE];
+  for (unsigned char v = 0; v != DCT_BLOCK_SIDE; ++v)
+  {
+    for (unsigned char u = 0; u != DCT_BLOCK_SIDE; ++u)
+    {
+      const int32_t value = (int32_t)dct_block[v * DCT_BLOCK_SIDE + u] * q_table[v * DCT_BLOCK_SIDE + u];
+      dequantized[u * DCT_BLOCK_SIDE + v] = (int16_t)(value < INT16_MIN ? INT16_MIN : (value > INT16_MAX ? INT16_MAX : value));
+    }
+  }
+
+  // Columns, keeping IDCT12_PASS1_BITS of fraction, then back to rows for the second pass.
+  int16_t columns[DCT_BLOCK_SIZE], rows[DCT_BLOCK_SIZE];
+  static const int PASS1_SHIFT = IDCT12_CONST_BITS - IDCT12_PASS1_BITS;
+  idct12_pass(dequantized, columns, 1 << (PASS1_SHIFT - 1), PASS1_SHIFT);
+  transpose_8x8_16(columns, rows);
+
+  // The level shift back to unsigned goes in with the rounding.
+  static const int PASS2_SHIFT = IDCT12_CONST_BITS + IDCT12_PASS1_BITS;
+  int16_t samples[DCT_BLOCK_SIZE];
+  idct12_pass(rows, samples, (1 << (PASS2_SHIFT - 1)) + (2048 << PASS2_SHIFT), PASS2_SHIFT);
+
+  for (unsigned char y = 0; y != DCT_BLOCK_SIDE; ++y, out += out_stride)
+  {
+#if defined(__SSE2__)
+    const __m128i row = _mm_loadu_si128((const __m128i*)(samples + y * DCT_BLOCK_SIDE));
+    _mm_storeu_si128((__m128i*)out, _mm_min_epi16(_mm_max_epi16(row, _mm_setzero_si128()), _mm_set1_epi16(4095)));
+#else
+    for (unsigned char x = 0; x != DCT_BLOCK_SIDE; ++x)
+    {
+      const int16_t sample = samples[y * DCT_BLOCK_SIDE + x];
+      out[x] = (uint16_t)(sample < 0 ? 0 : (sample > 4095 ? 4095 : sample));
+    }
+#endif
+  }
+}
 
-  // This could be a while(1) but theoretically we should never be able to read any more than 63 discrete AC values.
-  for (unsigned char i = 0; i != 63; ++i)
+// out = a * b for 8x8 row major matrices. Each output row is a sum of b's rows weighted by a row of a,
+// which maps straight onto 4 wide vectors.
+static inline void multiply_8x8(const float* a, const float* b, float* out)
+{
+#if defined(__SSE2__)
+  for (unsigned char i = 0; i != DCT_BLOCK_SIDE; ++i)
+  {
+    __m128 lo = _mm_setzero_ps(), hi = _mm_setzero_ps();
+    for (unsigned char k = 0; k != DCT_BLOCK_SIDE; ++k)
+    {
+      const __m128 weight = _mm_set1_ps(a[i * DCT_BLOCK_SIDE + k]);
+      lo = _mm_add_ps(lo, _mm_mul_ps(weight, _mm_loadu_ps(b + k * DCT_BLOCK_SIDE)));
+      hi = _mm_add_ps(hi, _mm_mul_ps(weight, _mm_loadu_ps(b + k * DCT_BLOCK_SIDE + 4)));
+    }
+    _mm_storeu_ps(out + i * DCT_BLOCK_SIDE, lo);
+    _mm_storeu_ps(out + i * DCT_BLOCK_SIDE + 4, hi);
+  }
+#else
+  for (unsigned char i = 0; i != DCT_BLOCK_SIDE; ++i)
+  {
+    float sums[DCT_BLOCK_SIDE] = {0};
+    for (unsigned char k = 0; k != DCT_BLOCK_SIDE; ++k)
+    {
+      const float weight = a[i * DCT_BLOCK_SIDE + k];
+      for (unsigned char j = 0; j != DCT_BLOCK_SIDE; ++j)
+        sums[j] += weight * b[k * DCT_BLOCK_SIDE + j];
+    }
+    memcpy(out + i * DCT_BLOCK_SIDE, sums, sizeof(sums));
+  }
+#endif
+}
+
+void fdct_quantize_block(const unsigned char* in, size_t in_stride, const float* q_reciprocals, int16_t* out)
+{
+  float samples[DCT_BLOCK_SIZE];
+  for (unsigned char y = 0; y != DCT_BLOCK_SIDE; ++y, in += in_stride)
+  {
+    for (unsigned char x = 0; x != DCT_BLOCK_SIDE; ++x)
+      samples[y * DCT_BLOCK_SIDE + x] = (float)in[x] - 128.0f;
+  }
+
+  // F = T * X * T': rows against the transposed table, then the table against the columns.
+  float tmp[DCT_BLOCK_SIZE], coefficients[DCT_BLOCK_SIZE];
+  multiply_8x8(samples, s_forward_dct_table_t, tmp);
+  multiply_8x8(s_inverse_dct_table, tmp, coefficients);
+
+#if defined(__SSE2__)
+  // Converting rounds to nearest, the pack saturates to 16 bits.
+  for (unsigned char i = 0; i != DCT_BLOCK_SIZE; i += 8)
+  {
+    const __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(coefficients + i), _mm_loadu_ps(q_reciprocals + i)));
+    const __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(coefficients + i + 4), _mm_loadu_ps(q_reciprocals + i + 4)));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+  }
+#else
+  for (unsigned char i = 0; i != DCT_BLOCK_SIZE; ++i)
+    out[i] = (int16_t)lrintf(coefficients[i] * q_reciprocals[i]);
+#endif
+}
+
+// huff_tables is assumed to be a non-null array of 2 huffman table pointers.
+// scratch_block is assumed to be a zeroed buffer provided by the caller.
+bool bits_to_dct_block(bit_reader_t* reader, const huff_table_t** huff_tables, int16_t* scratch_block, int* prev_dc_val)
+{
+  PROFILE_COUNT(PC_BLOCKS, 1);
+
+  // The DC symbol is the bit length of the difference to the previous block's DC value, which comes decoded along with it.
+  unsigned char symbol;
+  int value;
+  if (!huff_table_decode(huff_tables[0], reader, &symbol, &value) || symbol > DC_MAX_BITS)
+    return false;
+
+  DCT_LOG("DC diff: %d. pos: %zu\n", value, bit_reader_position(reader));
+  *prev_dc_val = dc_predictor_add(*prev_dc_val, value);
+  scratch_block[0] = (int16_t)*prev_dc_val;
+
+  //We've read the DC value, now time for the 63 AC values.
+  // Each AC symbol packs the number of zeros to skip (high nibble) and the bit length of the value (low nibble).
+  for (unsigned char i = 1; i < 64; ++i)
   {
-    bits_to_read = huff_table_lookup(huff_table_ptr, block, &cur_pos);
+    if (!huff_table_decode(huff_tables[1], reader, &symbol, &value))
+      return false;
 
-    if (bits_to_read == 0x0) // 0 is the EOB indicator
+    if (symbol == AC_EOB)
     {
-      printf("AC EOB INDICATOR! cur_pos:%d i:%d\n", cur_pos, i);
+      DCT_LOG("AC EOB INDICATOR! pos:%zu i:%d\n", bit_reader_position(reader), i);
+      PROFILE_COUNT(PC_EOBS, 1);
+      PROFILE_COUNT(PC_DC_ONLY_BLOCKS, i == 1);
       break;
     }
 
-    int read_bits = read_stream(block, cur_pos, bits_to_read, 0);
-    int decoded_ac_val = dc_ac_value_decode(read_bits, bits_to_read);
-    printf("AC Read returned: %d.\n", decoded_ac_val);
-    cur_pos += bits_to_read;
+    // ZRL (0xF0) skips 16 zeros: 15 here and one more from the loop. It and any other value of 0 store nothing new.
+    i += symbol >> 4;
+    if (i > 63)
+      return false;
 
-    scratch_block[get_zig_zagged_index(i)] = decoded_ac_val;
+    DCT_LOG("AC value: %d.\n", value);
+    scratch_block[get_zig_zagged_index(i)] = (int16_t)value;
   }
 
-  print_block("Final DCT Block", "%+04d ", scratch_block, 8, PT_INT);
+  if (LOG_ENABLED(LL_TRACE))
+    print_block(LL_TRACE, "Final DCT Block", "%+04d ", scratch_block, 8, PT_SHORT);
 
-  return cur_pos;
+  return true;
 }
@@ -8,11 +8,40 @@ Author: kaiyen
 
 #include "huffman.h"
 
-void init_inverse_dct_table(unsigned char precision);
+#include <stddef.h>
+#include <stdint.h>
 
-// Converts a raw binary block into an organized dct block, stored in the provided scratch_block.
-// Note: It's up to the caller to provide the scratch_block buffer. Assumes non-NULL.
-unsigned bits_to_dct_block(unsigned char*const block, const huff_node_t** huff_tables, unsigned* scratch_block, unsigned* prev_dc_val);
+#define DCT_BLOCK_SIDE 8
+#define DCT_BLOCK_SIZE (DCT_BLOCK_SIDE * DCT_BLOCK_SIDE)
+
+void init_inverse_dct_table(void);
+
+// Dequantizes a natural order block with q_table, inverse transforms it and writes the 8x8 samples to out.
+void idct_block(const int16_t* dct_block, const unsigned short* q_table, unsigned char* out, size_t out_stride);
+
+// Same as idct_block, but only the lowest size x size frequencies are transformed, which gives
+// a size x size block of samples: the 8x8 one downscaled. size can be 1, 2, 4 or 8.
+void idct_block_scaled(const int16_t* dct_block, const unsigned short* q_table, unsigned char* out, size_t out_stride, unsigned char size);
+
+// 12 bit version of idct_block, with samples 0..4095 and out_stride counted in samples. Fixed point with
+// 32 bit accumulators throughout, SSE2 where available.
+void idct_block_12(const int16_t* dct_block, const unsigned short* q_table, uint16_t* out, size_t out_stride);
+
+// Forward DCT of the 8x8 samples at in, quantized by multiplying with q_reciprocals (1/q, natural order).
+// Uses the same table as the IDCT, so init_inverse_dct_table has to run first.
+void fdct_quantize_block(const unsigned char* in, size_t in_stride, const float* q_reciprocals, int16_t* out);
+
+// Adds a DC difference to a predictor. Predictors wrap at 16 bits like the coefficients they end up in, so corrupt
+// data adding up the largest differences over and over can't overflow them.
+static inline int dc_predictor_add(int predictor, int diff)
+{
+  return (int16_t)(uint16_t)((unsigned)predictor + (unsigned)diff);
+}
+
+// Decodes the next block from the reader into an organized dct block, stored in the provided scratch_block.
+// Returns false if the data doesn't decode with the given tables.
+// Note: It's up to the caller to provide the zeroed scratch_block buffer. Assumes non-NULL.
+bool bits_to_dct_block(bit_reader_t* reader, const huff_table_t** huff_tables, int16_t* scratch_block, int* prev_dc_val);
 
 #endif
 
@@ -5,9 +5,18 @@ Author: kaiyen
 ---------------------------------------------------------------------------*/
 #include "decoder.h"
 
+#include "arith_decoder.h"
+#include "bitstream.h"
+#include "color_convert.h"
 #include "dct_utils.h"
 #include "huffman.h"
+#include "log.h"
+#include "mem_budget.h"
+#include "parallel_scan.h"
 #include "print_utils.h"
+#include "probe.h"
+#include "profile.h"
+#include "segment_index.h"
 #include "utils.h"
 
 #include <stdlib.h>
@@ -17,6 +26,53 @@ Author: kaiyen
 // Decode Context. Holds working state and algorithm params.
 static decode_context_t ctx;
 
+// Set by any stage that runs into malformed data. Stops the segment walk.
+static bool s_decode_error = false;
+
+// Where the scan handler puts pixels, NULL when only the entropy coded data is decoded.
+static const jpeg_output_t* s_output = NULL;
+
+// Where the scan handler puts coefficients instead, NULL unless jpeg_decode_coefficients is running.
+static jpeg_coefficients_t* s_coefficients = NULL;
+
+// The frame header as the probe would report it. Planar output is laid out from this.
+static jpeg_info_t s_frame_info;
+static bool s_output_written = false;
+
+// Frames can be split over several scans. This tracks which components have had theirs, one bit per component.
+static unsigned char s_components_decoded = 0;
+
+// A split frame's blocks, held until the last scan is in and the frame can be output.
+static int16_t* s_frame_blocks[MAX_COMPONENTS];
+
+// Scans in the file, counted from the segment index before the frame header is parsed.
+static size_t s_scan_count = 0;
+
+// The quantization table each component's scan was decoded with, natural order.
+static unsigned short s_component_q_tables[MAX_COMPONENTS][QUANT_TABLE_SIZE];
+
+// How scans without restart markers get split for parallel entropy decoding, see jpeg_set_entropy_threads.
+static unsigned s_entropy_threads = 1;
+static size_t s_min_chunk_bytes = 64 * 1024;
+
+// Most bytes a decode may hold at once, 0 for no limit. See jpeg_set_memory_limit.
+static size_t s_memory_limit = 0;
+
+// With the cache on, Huffman tables outlive the decode that built them. Most files carry the same few tables,
+// so a DHT that matches what its destination held last time reuses that table instead of building it again.
+static bool s_cache_huff_tables = false;
+
+typedef struct _cached_huff_table
+{
+  huff_table_t* table;
+
+  // The code length counts and symbols the table was built from, as the DHT segment had them.
+  unsigned short spec_len;
+  unsigned char spec[16 + 256];
+} cached_huff_table_t;
+
+static cached_huff_table_t s_huff_cache[HUFF_TABLES_PER_CHANNEL_TYPE][MAX_HUFF_TABLES];
+
 // JFIF Version
 static struct
 {
@@ -29,50 +85,96 @@ static void init_decode_ctx()
 #if 1
   ctx.extension_data = NULL;
 
-  memset(&ctx.huffman_tables_luma, 0, sizeof(void*)*HUFF_TABLES_PER_CHANNEL_TYPE);
-  memset(&ctx.huffman_tables_chroma, 0, sizeof(void*)*HUFF_TABLES_PER_CHANNEL_TYPE);
+  memset(&ctx.huffman_tables, 0, sizeof(ctx.huffman_tables));
+
+  for (unsigned char table_class = 0; table_class != HUFF_TABLES_PER_CHANNEL_TYPE; ++table_class)
+  {
+    for (unsigned char id = 0; id != ARITH_TABLES; ++id)
+      arith_conditioning_default(&ctx.arith_conditioning[table_class][id]);
+  }
 
   ctx.components = NULL;
 
-  memset(&ctx.luma_q_table, 0, sizeof(unsigned short)*QUANT_TABLE_SIZE);
-  memset(&ctx.chrm_q_table, 0, sizeof(unsigned short)*QUANT_TABLE_SIZE);
+  memset(&ctx.quant_tables, 0, sizeof(ctx.quant_tables));
+  ctx.quant_tables_defined = 0;
 
   ctx.x_length = ctx.y_length = 0;
 
   ctx.x_density = ctx.y_density = 0;
 
+  ctx.restart_interval = 0;
+  ctx.adobe_transform = ADOBE_TRANSFORM_UNKNOWN;
+
   ctx.density_units = ctx.bits_per_sample = ctx.num_components = 0;
 #else
   memset(&ctx, 0, sizeof(decode_context_t));
 #endif
 }
 
-// Returns the segment length from the buffer's next two bytes and prints it out.
-unsigned short get_segment_len(unsigned char* img_buf)
+// Frees everything the segment handlers put on the heap. Safe to call more than once.
+static void cleanup_decode_ctx()
 {
-  if (img_buf == NULL)
-    return 0;
+  // Cached tables belong to the cache and stay around for the next decode.
+  for (unsigned char table_class = 0; table_class != HUFF_TABLES_PER_CHANNEL_TYPE && !s_cache_huff_tables; ++table_class)
+  {
+    for (unsigned char id = 0; id != MAX_HUFF_TABLES; ++id)
+      huff_table_free(ctx.huffman_tables[table_class][id]);
+  }
+  memset(&ctx.huffman_tables, 0, sizeof(ctx.huffman_tables));
 
-  const unsigned short segment_len = get_short(img_buf);
-  printf("(Segment Length: %d)...\n", segment_len);
+  mem_free(ctx.components);
+  ctx.components = NULL;
 
-  return segment_len;
+  for (unsigned char c = 0; c != MAX_COMPONENTS; ++c)
+  {
+    mem_free(s_frame_blocks[c]);
+    s_frame_blocks[c] = NULL;
+  }
 }
 
-static unsigned short process_func_start_of_image(unsigned char* img_buf)
+// Flags the decode as failed. Always returns 0 so handlers can 'return decode_error(...)'.
+static size_t decode_error(const char* reason)
 {
-  // The start of image marker doesn't have a length after it and is 0 length anyway. No-op.
-  printf("(Segment Length: 0)...\n");
+  LOG_ERROR("%s", reason);
+  s_decode_error = true;
   return 0;
 }
 
-static unsigned short process_func_app_segment_0(unsigned char* img_buf)
+// Returns the segment length from the buffer's next two bytes and logs it.
+// Returns 0 and flags an error if the segment doesn't fit in what's left of the buffer.
+static unsigned short get_segment_len(const unsigned char* img_buf, size_t buf_len)
 {
-  unsigned short segment_len = get_segment_len(img_buf);
+  if (img_buf == NULL || buf_len < sizeof(unsigned short))
+    return (unsigned short)decode_error("Segment length is past the end of the file.");
+
+  const unsigned short segment_len = get_short(img_buf);
+  LOG_DEBUG("Segment Length: %d", segment_len);
 
-  // Initialize the decode context.
+  if (segment_len < sizeof(unsigned short) || segment_len > buf_len)
+    return (unsigned short)decode_error("Segment length is out of bounds.");
+
+  return segment_len;
+}
+
+static size_t process_func_start_of_image(const unsigned char* img_buf, size_t buf_len)
+{
+  // The start of image marker doesn't have a length after it and is 0 length anyway.
+  // A second image can't start before the first one has ended, its frame wouldn't fit the caller's output.
+  if (ctx.components != NULL)
+    return decode_error("Start of image inside an image.");
+
+  // Not every file has an APP0 segment, so this is the earliest point to reset the context.
+  cleanup_decode_ctx();
   init_decode_ctx();
 
+  LOG_DEBUG("Segment Length: 0");
+  return 0;
+}
+
+static size_t process_func_app_segment_0(const unsigned char* img_buf, size_t buf_len)
+{
+  unsigned short segment_len = get_segment_len(img_buf, buf_len);
+
   // App0 offsets
   static const unsigned char VERSION_MAJOR = sizeof(unsigned short) + (sizeof(unsigned char) * 5);
   static const unsigned char VERSION_MINOR = VERSION_MAJOR + sizeof(unsigned char);
@@ -80,6 +182,10 @@ static unsigned short process_func_app_segment_0(unsigned char* img_buf)
   static const unsigned char DENSITY_DIM_X = DENSITY_UNITS + sizeof(unsigned char);
   static const unsigned char DENSITY_DIM_Y = DENSITY_DIM_X + sizeof(unsigned short);
 
+  // Too short to be JFIF. Nothing in here is needed for decoding, so just move on.
+  if (segment_len < DENSITY_DIM_Y + sizeof(unsigned short))
+    return segment_len;
+
   jfif_ver.major = img_buf[VERSION_MAJOR];
   jfif_ver.minor = img_buf[VERSION_MINOR];
 
@@ -94,280 +200,1066 @@ static unsigned short process_func_app_segment_0(unsigned char* img_buf)
   return segment_len;
 }
 
-static unsigned short process_func_quant_table(unsigned char* img_buf)
+static size_t process_func_app_segment_14(const unsigned char* img_buf, size_t buf_len)
+{
+  unsigned short segment_len = get_segment_len(img_buf, buf_len);
+
+  // Length, "Adobe", version, two flag words and the transform.
+  static const unsigned char ADOBE_TAG = sizeof(unsigned short);
+  static const unsigned char ADOBE_TRANSFORM = ADOBE_TAG + 5 + sizeof(unsigned short) * 3;
+
+  if (segment_len <= ADOBE_TRANSFORM || memcmp(&img_buf[ADOBE_TAG], "Adobe", 5) != 0)
+    return segment_len;
+
+  ctx.adobe_transform = img_buf[ADOBE_TRANSFORM];
+  LOG_DEBUG("Adobe Transform: %d", ctx.adobe_transform);
+
+  return segment_len;
+}
+
+// Three component images are YCbCr unless an Adobe segment says otherwise, or the component ids spell out RGB.
+static bool is_ycbcr(void)
 {
-  unsigned short segment_len = get_segment_len(img_buf);
+  if (ctx.num_components != 3)
+    return false;
+
+  if (ctx.adobe_transform != ADOBE_TRANSFORM_UNKNOWN)
+    return ctx.adobe_transform != 0;
 
-  // Advance past the length.
-  img_buf += sizeof(unsigned short);
+  return !(ctx.components[0].id == 'R' && ctx.components[1].id == 'G' && ctx.components[2].id == 'B');
+}
 
-  // Read destination and advance past it.
-  unsigned char qt_info = *img_buf++;
-  unsigned short* dest_table = NULL;
+static size_t process_func_quant_table(const unsigned char* img_buf, size_t buf_len)
+{
+  unsigned short segment_len = get_segment_len(img_buf, buf_len);
+  if (segment_len < sizeof(unsigned short) + 1)
+    return decode_error("Quantization table segment is too short.");
 
   static const unsigned char QT_ID_MASK = 0x0F;
   static const unsigned char QT_PRECISION_MASK = 0xF0;
 
-  unsigned char dest = qt_info & QT_ID_MASK;
-  unsigned char precision = (qt_info & QT_PRECISION_MASK) >> 4;
+  // A single segment can hold any number of tables back to back, each with its own destination.
+  const unsigned char* it = img_buf + sizeof(unsigned short);
+  const unsigned char* end = img_buf + segment_len;
+  while (it != end)
+  {
+    // Read destination and advance past it.
+    const unsigned char qt_info = *it++;
+    const unsigned char dest = qt_info & QT_ID_MASK;
+    const unsigned char precision = (qt_info & QT_PRECISION_MASK) >> 4;
+
+    const size_t table_bytes = QUANT_TABLE_SIZE * (precision == 0 ? 1 : 2);
+    if (precision > 1 || dest >= MAX_QUANT_TABLES || table_bytes > (size_t)(end - it))
+      return decode_error("Quantization table doesn't fit in its segment.");
+
+    // Quantized tables are encoded according to a zig zag pattern.
+    unsigned short* dest_table = ctx.quant_tables[dest];
+    if (precision == 0)
+    {
+      for (unsigned char i = 0; i != 64; ++i)
+      {
+        dest_table[get_zig_zagged_index(i)] = it[i];
+      }
+    }
+    else
+    {
+      for (unsigned char i = 0; i != 64; ++i)
+      {
+        dest_table[get_zig_zagged_index(i)] = get_short(&it[i * sizeof(unsigned short)]);
+      }
+    }
+
+    it += table_bytes;
+    ctx.quant_tables_defined |= 1 << dest;
+
+    print_quant_tables(&ctx, qt_info, precision);
+  }
 
-  if (dest == 0x0)
+  return segment_len;
+}
+
+// The least decoding the frame will hold at once: a single MCU row of coefficients and samples when the frame is
+// streamed in one scan, every coefficient when they are the output or the frame is split over several scans.
+// Parallel scans only happen when they fit on top of this, see parallel_scan_fits. Saturates instead of overflowing.
+static size_t frame_memory_estimate(const jpeg_info_t* info)
+{
+  unsigned char h_max = 1, v_max = 1;
+  for (unsigned char c = 0; c != info->num_components; ++c)
   {
-    dest_table = ctx.luma_q_table;
+    if (info->components[c].sample_factor_horiz > h_max)
+      h_max = info->components[c].sample_factor_horiz;
+    if (info->components[c].sample_factor_vert > v_max)
+      v_max = info->components[c].sample_factor_vert;
   }
-  else
+
+  const size_t x_mcus = (info->width + 8u * h_max - 1) / (8u * h_max);
+  const size_t y_mcus = (info->height + 8u * v_max - 1) / (8u * v_max);
+
+  size_t row_blocks = 0;
+  for (unsigned char c = 0; c != info->num_components; ++c)
+    row_blocks += info->num_components == 1 ? x_mcus : x_mcus * info->components[c].sample_factor_horiz * info->components[c].sample_factor_vert;
+
+  // At most 65535 x 65535 pixels in 4 components, so none of this gets near overflowing 64 bits.
+  const unsigned long long block_bytes = sizeof(int16_t) * DCT_BLOCK_SIZE;
+  unsigned long long bytes = row_blocks * block_bytes;
+  if (s_coefficients != NULL || s_scan_count > 1)
+    bytes *= y_mcus;
+  if (s_coefficients == NULL && s_output != NULL)
+    bytes += row_blocks * DCT_BLOCK_SIZE * jpeg_pixel_format_sample_size(s_output->format) + (unsigned long long)info->width * jpeg_pixel_format_size(s_output->format);
+
+  return bytes > SIZE_MAX ? SIZE_MAX : (size_t)bytes;
+}
+
+// Baseline (SOF0) and extended sequential (SOF1, SOF9) frames share everything but the sample precisions they
+// allow and how the scans are entropy coded.
+static size_t parse_start_of_frame(const unsigned char* img_buf, size_t buf_len, unsigned char frame_marker)
+{
+  unsigned short segment_len = get_segment_len(img_buf, buf_len);
+  if (s_decode_error)
+    return 0;
+
+  // Callers size their output from the first frame header (see jpeg_probe), so a second one can't be trusted.
+  if (ctx.components != NULL)
+    return decode_error("More than one frame header.");
+
+  // The header itself is parsed by the probe code, so both always agree on what the frame looks like.
+  jpeg_info_t info;
+  const char* frame_error = probe_parse_frame_header(img_buf, segment_len, frame_marker, &info);
+  if (frame_error != NULL)
+    return decode_error(frame_error);
+
+  LOG_DEBUG("Image Bits/Sample: %d", info.bits_per_sample);
+  if (info.bits_per_sample != 8 && (info.bits_per_sample != 12 || frame_marker == JFIF_SOF))
+    return decode_error("Unsupported sample precision.");
+
+  // The coefficient writer only knows baseline.
+  if (info.bits_per_sample != 8 && s_coefficients != NULL)
+    return decode_error("Coefficient output only supports 8 bit frames.");
+
+  ctx.bits_per_sample = info.bits_per_sample;
+
+  LOG_DEBUG("Image Dimensions: %dx%d", info.width, info.height);
+  if (info.width == 0 || info.height == 0)
+    return decode_error("Image has no pixels.");
+
+  ctx.x_length = info.width;
+  ctx.y_length = info.height;
+
+  // Catches a header claiming a huge frame before any of it is allocated.
+  if (!mem_budget_fits(frame_memory_estimate(&info)))
+    return decode_error("Frame needs more memory than the decode is allowed.");
+
+  if (!(info.num_components == 1 || info.num_components == 3))
+  {
+    LOG_WARN("Weird number of components: %d", info.num_components);
+  }
+
+  // A second frame header would otherwise leak the first component list.
+  mem_free(ctx.components);
+
+  ctx.num_components = info.num_components;
+  ctx.components = (jfif_component_t*)mem_malloc(sizeof(jfif_component_t) * info.num_components);
+  if (ctx.components == NULL)
+    return decode_error("Failed to allocate components.");
+
+  memcpy(ctx.components, info.components, sizeof(jfif_component_t) * info.num_components);
+  s_frame_info = info;
+  for (unsigned char i = 0; i != info.num_components; ++i)
+    print_component_info(&ctx.components[i], i, info.components[i].id);
+
+  init_inverse_dct_table();
+
+  return segment_len;
+}
+
+static size_t process_func_start_of_frame(const unsigned char* img_buf, size_t buf_len)
+{
+  return parse_start_of_frame(img_buf, buf_len, JFIF_SOF);
+}
+
+static size_t process_func_start_of_frame_extended(const unsigned char* img_buf, size_t buf_len)
+{
+  return parse_start_of_frame(img_buf, buf_len, JFIF_SOF1);
+}
+
+static size_t process_func_start_of_frame_arithmetic(const unsigned char* img_buf, size_t buf_len)
+{
+  return parse_start_of_frame(img_buf, buf_len, JFIF_SOF9);
+}
+
+// Builds one table from its code length counts and symbols, see C.2 in the spec.
+static huff_table_t* build_huffman_table(const unsigned char* ht_lengths, const unsigned char* ht_items, bool ac)
+{
+  huff_table_t* table = (huff_table_t*)mem_malloc(sizeof(huff_table_t));
+  huff_node_t* true_root = (huff_node_t*)mem_malloc(sizeof(huff_node_t));
+  if (table == NULL || true_root == NULL)
   {
-    dest_table = ctx.chrm_q_table;
+    mem_free(table);
+    mem_free(true_root);
+    return NULL;
   }
 
-  // Quantized tables are encoded according to a zig zag pattern.
-  if (precision == 0)
+  huff_node_init(true_root, INTERMEDIATE_NODE_VAL);
+
+  unsigned item_counter = 0;
+  for (unsigned i = 0; i != 16; ++i)
   {
-    for (unsigned char i = 0; i != 64; ++i)
+    const unsigned char code_len = i + 1;
+    for (unsigned k = 0; k != ht_lengths[i]; ++k)
     {
-      dest_table[get_zig_zagged_index(i)] = img_buf[i];
+      if (!huff_table_insert(&true_root, code_len, 0, ht_items[item_counter++]))
+      {
+        LOG_ERROR("Failed to build huffman table. val:%d", ht_items[item_counter-1]);
+      }
     }
   }
-  else
+
+  table->tree = true_root;
+  huff_table_build_fast(table, ht_lengths, ht_items, ac);
+  return table;
+}
+
+static size_t process_func_huffman_table(const unsigned char* img_buf, size_t buf_len)
+{
+  // HT Header Masks
+  static const unsigned char HT_COUNT_MASK = 0x0F;
+  static const unsigned char HT_TYPE_MASK  = 0x10; // Bits 5-7 Unused
+
+  // Header byte and the 16 code length counts.
+  static const unsigned char HT_HEADER_LEN = 1 + 16;
+
+  unsigned segment_len = (unsigned)get_segment_len(img_buf, buf_len);
+  if (segment_len < sizeof(unsigned short) + HT_HEADER_LEN)
+    return decode_error("Huffman table segment is too short.");
+
+  // Like DQT, one segment can define several tables.
+  const unsigned char* it = img_buf + sizeof(unsigned short);
+  const unsigned char* end = img_buf + segment_len;
+  while (it != end)
   {
-    for (unsigned char i = 0; i != 64; ++i, img_buf += sizeof(unsigned short))
+    if ((size_t)(end - it) < HT_HEADER_LEN)
+      return decode_error("Huffman table doesn't fit in its segment.");
+
+    // Header information
+    const unsigned char ht_header = *it++;
+    const unsigned char ht_count = ((ht_header & HT_COUNT_MASK));
+    const unsigned char ht_type  = ((ht_header & HT_TYPE_MASK) >> 4);
+
+    const unsigned char* ht_lengths = it;
+    it += 16;
+
+    unsigned ht_lengths_sum = 0;
+    for (unsigned i = 0; i != 16; ++i)
+      ht_lengths_sum += ht_lengths[i];
+
+    if (ht_count >= MAX_HUFF_TABLES || ht_lengths_sum > 256 || ht_lengths_sum > (size_t)(end - it))
+      return decode_error("Huffman table doesn't fit in its segment.");
+
+    // The symbols follow the counts directly, in code order.
+    const unsigned char* ht_items = it;
+    it += ht_lengths_sum;
+
+    print_huffman_info(ht_header, ht_count, ht_type, (unsigned char*)ht_lengths, (unsigned char*)ht_items, ht_lengths_sum);
+
+    LOG_DEBUG("Storing %s Huff Table %d into the Decoder Context.", ht_type == 0 ? "DC" : "AC", ht_count);
+    huff_table_t** dest_table = &ctx.huffman_tables[ht_type][ht_count];
+    if (!s_cache_huff_tables)
+    {
+      huff_table_t* table = build_huffman_table(ht_lengths, ht_items, ht_type == 1);
+      if (table == NULL)
+        return decode_error("Failed to allocate a huffman table.");
+
+      // Tables can be redefined between scans, so drop whatever was there before.
+      huff_table_free(*dest_table);
+      *dest_table = table;
+      continue;
+    }
+
+    cached_huff_table_t* cached = &s_huff_cache[ht_type][ht_count];
+    const unsigned short spec_len = (unsigned short)(16 + ht_lengths_sum);
+    if (cached->table == NULL || cached->spec_len != spec_len || memcmp(cached->spec, ht_lengths, spec_len) != 0)
     {
-      dest_table[get_zig_zagged_index(i)] = get_short(img_buf);
+      huff_table_t* table = build_huffman_table(ht_lengths, ht_items, ht_type == 1);
+      if (table == NULL)
+        return decode_error("Failed to allocate a huffman table.");
+
+      huff_table_free(cached->table);
+      cached->table = table;
+      cached->spec_len = spec_len;
+      memcpy(cached->spec, ht_lengths, spec_len);
     }
+
+    *dest_table = cached->table;
   }
 
-  print_quant_tables(&ctx, qt_info, precision);
+  return segment_len;
+}
+
+static size_t process_func_arith_conditioning(const unsigned char* img_buf, size_t buf_len)
+{
+  unsigned short segment_len = get_segment_len(img_buf, buf_len);
+  if (s_decode_error)
+    return 0;
+
+  // Pairs of class and destination (high and low nibble), then the conditioning value.
+  const unsigned char* it = img_buf + sizeof(unsigned short);
+  const unsigned char* end = img_buf + segment_len;
+  if ((end - it) % 2 != 0)
+    return decode_error("Arithmetic conditioning segment is malformed.");
+
+  for (; it != end; it += 2)
+  {
+    const unsigned char table_class = it[0] >> 4, id = it[0] & 0x0F, value = it[1];
+    if (table_class >= HUFF_TABLES_PER_CHANNEL_TYPE || id >= ARITH_TABLES)
+      return decode_error("Arithmetic conditioning table doesn't exist.");
+
+    arith_conditioning_t* conditioning = &ctx.arith_conditioning[table_class][id];
+    if (table_class == 0)
+    {
+      // DC tables get L in the low nibble and U in the high one.
+      conditioning->dc_lower = value & 0x0F;
+      conditioning->dc_upper = value >> 4;
+      if (conditioning->dc_lower > conditioning->dc_upper)
+        return decode_error("Arithmetic DC conditioning has its bounds the wrong way round.");
+    }
+    else
+    {
+      if (value < 1 || value > 63)
+        return decode_error("Arithmetic AC conditioning is out of range.");
+
+      conditioning->ac_kx = value;
+    }
+
+    LOG_DEBUG("%s conditioning %d: %d", table_class == 0 ? "DC" : "AC", id, value);
+  }
 
   return segment_len;
 }
 
-static unsigned short process_func_start_of_frame(unsigned char* img_buf)
+// Block layout of the frame. Every scan and the output are laid out from it, whichever components they cover.
+typedef struct _frame_layout
 {
-  unsigned short segment_len = get_segment_len(img_buf);
+  // A single component frame has one block per MCU whatever its sampling factors say.
+  unsigned char h_factors[MAX_COMPONENTS];
+  unsigned char v_factors[MAX_COMPONENTS];
+  unsigned char h_max;
+  unsigned char v_max;
+
+  unsigned x_mcus;
+  unsigned y_mcus;
+} frame_layout_t;
 
-  img_buf += sizeof(unsigned short);
+static void get_frame_layout(frame_layout_t* layout)
+{
+  layout->h_max = layout->v_max = 1;
+  for (unsigned char c = 0; c != ctx.num_components; ++c)
+  {
+    layout->h_factors[c] = ctx.num_components == 1 ? 1 : ctx.components[c].sample_factor_horiz;
+    layout->v_factors[c] = ctx.num_components == 1 ? 1 : ctx.components[c].sample_factor_vert;
 
-  unsigned char precision = *img_buf;
-  ++img_buf;
+    if (layout->h_factors[c] > layout->h_max)
+      layout->h_max = layout->h_factors[c];
+    if (layout->v_factors[c] > layout->v_max)
+      layout->v_max = layout->v_factors[c];
+  }
 
-  printf("Image Bits/Sample: %d\n", precision);
-  ctx.bits_per_sample = precision;
+  const unsigned mcu_width = 8 * layout->h_max, mcu_height = 8 * layout->v_max;
+  layout->x_mcus = (ctx.x_length + mcu_width - 1) / mcu_width;
+  layout->y_mcus = (ctx.y_length + mcu_height - 1) / mcu_height;
+}
 
-  unsigned short img_width = get_short(img_buf);
-  img_buf += sizeof(unsigned short);
-  unsigned short img_height = get_short(img_buf);
-  img_buf += sizeof(unsigned short);
+// Blocks of each component, row major, x_mcus * H blocks to a row. Either the whole frame or a single MCU row of it.
+typedef struct _block_grid
+{
+  int16_t* blocks[MAX_COMPONENTS];
+  unsigned blocks_wide[MAX_COMPONENTS];
+} block_grid_t;
 
-  printf("Image Dimensions: %dx%d\n", img_width, img_height);
-  ctx.x_length = img_width;
-  ctx.y_length = img_height;
+static inline int16_t* grid_block(const block_grid_t* grid, unsigned char c, unsigned block_row, unsigned block_col)
+{
+  return grid->blocks[c] + ((size_t)block_row * grid->blocks_wide[c] + block_col) * DCT_BLOCK_SIZE;
+}
 
-  unsigned char num_components = *img_buf++;
+// Sizes and zeroes every component's block grid for coefficient output. The grid is in blocks, padded to whole MCUs.
+static bool init_coefficients(const frame_layout_t* layout)
+{
+  s_coefficients->width = ctx.x_length;
+  s_coefficients->height = ctx.y_length;
+  s_coefficients->num_components = ctx.num_components;
+  s_coefficients->adobe_transform = ctx.adobe_transform;
 
-  if (!(num_components == 1 || num_components == 3))
+  for (unsigned char c = 0; c != ctx.num_components; ++c)
   {
-    printf("WARNING: Weird number of components: %d\n", num_components);
+    jpeg_component_coefficients_t* coefficients = &s_coefficients->components[c];
+    coefficients->component = ctx.components[c];
+    coefficients->blocks_wide = layout->x_mcus * layout->h_factors[c];
+    coefficients->blocks_high = layout->y_mcus * layout->v_factors[c];
+
+
+    coefficients->blocks = (int16_t*)mem_calloc((size_t)coefficients->blocks_wide * coefficients->blocks_high, sizeof(int16_t) * DCT_BLOCK_SIZE);
+    if (coefficients->blocks == NULL)
+      return false;
   }
 
-  ctx.components = (jfif_component_t*)malloc(sizeof(jfif_component_t) * num_components);
-  jfif_component_t* component_it;
-  for (unsigned char component_id, sample_factors, q_table_id, i = 0; i != num_components; ++i)
+  return true;
+}
+
+// The whole frame's blocks, for scans that can't go straight to the output: coefficient output, and frames
+// split over several scans, which can only be output once the last component is in. Allocated by the first such scan.
+static bool get_frame_grid(const frame_layout_t* layout, block_grid_t* grid)
+{
+  if (s_coefficients != NULL)
   {
-    // Sample factor masks
-    static const unsigned char SF_VERT_MASK  = 0x0F; // 0b00001111
-    static const unsigned char SF_HORIZ_MASK = 0xF0; // 0b11110000
+    if (s_coefficients->components[0].blocks == NULL && !init_coefficients(layout))
+      return false;
 
-    component_id   = *img_buf++;
-    sample_factors = *img_buf++;
-    q_table_id     = *img_buf++;
+    for (unsigned char c = 0; c != ctx.num_components; ++c)
+    {
+      grid->blocks[c] = s_coefficients->components[c].blocks;
+      grid->blocks_wide[c] = s_coefficients->components[c].blocks_wide;
+    }
+    return true;
+  }
 
-    component_it = &ctx.components[i];
-    component_it->quant_table_id = q_table_id;
-    component_it->sample_factor_vert  = (sample_factors & SF_VERT_MASK );
-    component_it->sample_factor_horiz = (sample_factors & SF_HORIZ_MASK) >> 4;
+  for (unsigned char c = 0; c != ctx.num_components; ++c)
+  {
+    grid->blocks_wide[c] = layout->x_mcus * layout->h_factors[c];
+    if (s_frame_blocks[c] == NULL)
+      s_frame_blocks[c] = (int16_t*)mem_calloc((size_t)grid->blocks_wide[c] * layout->y_mcus * layout->v_factors[c], sizeof(int16_t) * DCT_BLOCK_SIZE);
+    if (s_frame_blocks[c] == NULL)
+      return false;
 
-    print_component_info(component_it, i, component_id);
+    grid->blocks[c] = s_frame_blocks[c];
   }
 
-  init_inverse_dct_table(ctx.bits_per_sample);
+  return true;
+}
 
-  return segment_len;
+// Planar formats skip conversion entirely, so they only work if the image is already sampled that way.
+// output is either the caller's or the single MCU row a row sink gets handed.
+static bool init_output_converter(color_converter_t* converter, const jpeg_output_t* output, unsigned width, unsigned char h_max, unsigned char v_max)
+{
+  if (!jpeg_pixel_format_is_planar(output->format))
+    return color_converter_init(converter, output, width, ctx.num_components, is_ycbcr(), h_max, v_max);
+
+  // Anything but the native layout promises YUV.
+  if (output->format != JPF_NATIVE && !is_ycbcr())
+    return false;
+
+  size_t row_bytes[MAX_COMPONENTS];
+  unsigned rows[MAX_COMPONENTS];
+  const unsigned char output_planes = s_output->format == JPF_NV12 ? 2 : ctx.num_components;
+  for (unsigned char p = 0; p != output_planes; ++p)
+  {
+    if (!jpeg_plane_size(&s_frame_info, s_output->format, p, &row_bytes[p], &rows[p]))
+      return false;
+  }
+
+  return color_converter_init_planar(converter, s_output, ctx.num_components, v_max, row_bytes, rows);
 }
 
-static unsigned short process_func_huffman_table(unsigned char* img_buf)
+/*
+Everything needed to turn one MCU row of blocks into output rows. Each component gets one MCU row
+of samples. That's all the pixel data the decoder ever holds, the rest goes straight to the caller's buffer.
+*/
+typedef struct _output_rows
 {
-  // HT Header Masks
-  static const unsigned char HT_COUNT_MASK = 0x0F;
-  static const unsigned char HT_TYPE_MASK  = 0x10; // Bits 5-7 Unused
+  color_plane_t planes[MAX_COMPONENTS];
+  color_converter_t converter;
+  unsigned char* sample_rows;
+
+  // A row sink gets one MCU row of converted output at a time, from a buffer of our own.
+  jpeg_output_t sink_output;
+  unsigned char* sink_rows;
 
-  unsigned segment_len = (unsigned)get_segment_len(img_buf);
+  // 2 for 12 bit frames, which go through their own IDCT into 16 bit samples.
+  unsigned char sample_size;
 
-  img_buf += sizeof(unsigned short);
+  // Scaled output shrinks every block, and with it the MCU rows and the image, by the same factor.
+  unsigned char block_side;
+  unsigned out_height;
+  unsigned out_mcu_height;
+} output_rows_t;
 
-  // Header information
-  unsigned char ht_header = *img_buf++;
+static bool output_rows_init(output_rows_t* out, const frame_layout_t* layout)
+{
+  memset(out, 0, sizeof(output_rows_t));
 
-  unsigned char ht_count = ((ht_header & HT_COUNT_MASK));
-  unsigned char ht_type  = ((ht_header & HT_TYPE_MASK) >> 4);
+  const unsigned char scale = s_output->scale_denom > 1 ? s_output->scale_denom : 1;
+  const unsigned out_width = jpeg_scaled_size(ctx.x_length, scale);
 
-  unsigned char ht_lengths[16];
-  memcpy(&ht_lengths, img_buf, 16);
+  // 12 bit frames only go to the 16 bit formats, unscaled, and 8 bit frames never do.
+  out->sample_size = ctx.bits_per_sample == 12 ? 2 : 1;
+  if (jpeg_pixel_format_sample_size(s_output->format) != out->sample_size || (out->sample_size != 1 && scale != 1))
+    return false;
 
-  // Extract all the huff table items
-  img_buf += 16;
+  out->block_side = DCT_BLOCK_SIDE / scale;
+  out->out_height = jpeg_scaled_size(ctx.y_length, scale);
+  out->out_mcu_height = 8 * layout->v_max / scale;
 
-  unsigned ht_lengths_sum = 0;
-  for (unsigned i = 0; i != 16; ++i)
-    ht_lengths_sum += ht_lengths[i];
+  size_t sample_bytes = 0;
+  for (unsigned char c = 0; c != ctx.num_components; ++c)
+    sample_bytes += (size_t)layout->x_mcus * layout->h_factors[c] * out->block_side * layout->v_factors[c] * out->block_side * out->sample_size;
 
-  unsigned char* ht_items = (unsigned char*)malloc(ht_lengths_sum);
-  for (unsigned ht_length_temp, j = 0, i = 0; i != 16; ++i)
+  const jpeg_output_t* converter_output = s_output;
+  if (s_output->row_sink != NULL)
   {
-    ht_length_temp = ht_lengths[i];
-    if (ht_length_temp == 0)
-      continue;
+    out->sink_output.format = s_output->format;
+    out->sink_output.strides[0] = (ptrdiff_t)(out_width * jpeg_pixel_format_size(s_output->format));
+    out->sink_output.planes[0] = out->sink_rows = (unsigned char*)mem_malloc((size_t)out->sink_output.strides[0] * out->out_mcu_height);
+    if (out->sink_rows == NULL)
+      return false;
 
-    // Length isn't zero. Read that many items from the image and put it into the items array.
-    memcpy(&ht_items[j], &img_buf[j], ht_length_temp);
-    j += ht_length_temp;
+    converter_output = &out->sink_output;
   }
 
-  print_huffman_info(ht_header, ht_count, ht_type, ht_lengths, ht_items, ht_lengths_sum);
+  out->sample_rows = (unsigned char*)mem_malloc(sample_bytes);
+  if (out->sample_rows == NULL || !init_output_converter(&out->converter, converter_output, out_width, layout->h_max, layout->v_max))
+    return false;
 
-  huff_node_t* true_root = (huff_node_t*)malloc(sizeof(huff_node_t));
-  huff_node_init(true_root, INTERMEDIATE_NODE_VAL);
+  unsigned char* plane_it = out->sample_rows;
+  for (unsigned char c = 0; c != ctx.num_components; ++c)
+  {
+    out->planes[c].data = plane_it;
+    out->planes[c].stride = (size_t)layout->x_mcus * layout->h_factors[c] * out->block_side * out->sample_size;
+    out->planes[c].sample_factor_horiz = layout->h_factors[c];
+    out->planes[c].sample_factor_vert = layout->v_factors[c];
+    plane_it += out->planes[c].stride * layout->v_factors[c] * out->block_side;
+  }
 
-  unsigned item_counter = 0;
-  for (unsigned i = 0; i != 16; ++i)
+  return true;
+}
+
+static void output_rows_cleanup(output_rows_t* out)
+{
+  color_converter_cleanup(&out->converter);
+  mem_free(out->sink_rows);
+  mem_free(out->sample_rows);
+}
+
+// IDCTs MCU row grid_row of grid and outputs it as MCU row y of the image.
+static void output_mcu_row(output_rows_t* out, const frame_layout_t* layout, const block_grid_t* grid, unsigned grid_row, unsigned y)
+{
+  PROFILE_BEGIN(PS_IDCT);
+  for (unsigned char c = 0; c != ctx.num_components; ++c)
   {
-    const unsigned char code_len = i + 1;
-    for (unsigned k = 0; k != ht_lengths[i]; ++k)
+    const unsigned short* q_table = s_component_q_tables[c];
+    const size_t stride = out->planes[c].stride;
+    for (unsigned by = 0; by != layout->v_factors[c]; ++by)
     {
-      if (!huff_table_insert(&true_root, code_len, 0, ht_items[item_counter++]))
+      const int16_t* block = grid_block(grid, c, grid_row * layout->v_factors[c] + by, 0);
+      unsigned char* row_out = (unsigned char*)out->planes[c].data + by * out->block_side * stride;
+      for (unsigned bx = 0; bx != grid->blocks_wide[c]; ++bx, block += DCT_BLOCK_SIZE)
       {
-        printf("ERROR: Failed to build huffman table. val:%d\n", ht_items[item_counter++]);
+        if (out->sample_size == 2)
+          idct_block_12(block, q_table, (uint16_t*)row_out + bx * DCT_BLOCK_SIDE, stride / 2);
+        else
+          idct_block_scaled(block, q_table, row_out + bx * out->block_side, stride, out->block_side);
       }
     }
   }
+  PROFILE_END(PS_IDCT);
+
+  // The last MCU row usually hangs over the bottom of the image.
+  const unsigned first_row = y * out->out_mcu_height;
+  const unsigned row_count = out->out_height - first_row < out->out_mcu_height ? out->out_height - first_row : out->out_mcu_height;
+
+  PROFILE_BEGIN(PS_COLOR_CONVERT);
+  color_convert_rows(&out->converter, out->planes, out->sink_rows ? 0 : first_row, row_count);
+  PROFILE_END(PS_COLOR_CONVERT);
+
+  if (out->sink_rows != NULL && !s_output->row_sink(s_output->row_sink_user, out->sink_rows, out->sink_output.strides[0], first_row, row_count))
+    decode_error("Output was cancelled by the row sink.");
+}
+
+// What an SOS header asked for: which frame components, in scan order, and the tables each one uses.
+typedef struct _scan
+{
+  unsigned char num_components;
+  unsigned char components[MAX_COMPONENTS];
+  const huff_table_t* huff_tables[MAX_COMPONENTS][HUFF_TABLES_PER_CHANNEL_TYPE];
+
+  // The DC (high nibble) and AC table each component picked, for arithmetic conditioning.
+  unsigned char table_ids[MAX_COMPONENTS];
+
+  // Huffman coded scans read the unstuffed data through reader, arithmetic coded ones go through arith instead.
+  bool arithmetic;
+  bit_reader_t reader;
+  arith_decoder_t arith;
+
+  int dc_vals[MAX_COMPONENTS];
+  unsigned units_left_in_interval;
+} scan_t;
+
+// Entropy decodes the next block of scan component s, whichever way the scan is coded.
+static inline bool scan_decode_block(scan_t* scan, unsigned char s, int16_t* block)
+{
+  if (scan->arithmetic)
+    return arith_decode_dct_block(&scan->arith, s, block, &scan->dc_vals[s]);
+
+  return bits_to_dct_block(&scan->reader, scan->huff_tables[s], block, &scan->dc_vals[s]);
+}
+
+// Arithmetic coded data gets zeros past its end by design, so only huffman coded scans can tell when they ran out.
+static inline bool scan_overrun(const scan_t* scan)
+{
+  return !scan->arithmetic && bit_reader_overrun(&scan->reader);
+}
 
-  if (ht_count == 0x0) // Luma
+// Restart intervals count MCUs in an interleaved scan and single blocks in a non-interleaved one.
+static inline void scan_next_restart_unit(scan_t* scan)
+{
+  if (ctx.restart_interval == 0)
+    return;
+
+  // The restart markers themselves were dropped by the unstuff, all that's left of them
+  // is the padding to the byte boundary and the predictor reset. The arithmetic decoder
+  // still sees them and starts over past the next one.
+  if (scan->units_left_in_interval == 0)
   {
-    printf("Storing Luma Huff Table %d into the Decoder Context.\n", ht_type);
-    ctx.huffman_tables_luma[ht_type] = true_root;
+    if (scan->arithmetic)
+      arith_decoder_restart(&scan->arith);
+    else
+      bit_reader_align(&scan->reader);
+
+    memset(scan->dc_vals, 0, sizeof(scan->dc_vals));
+    scan->units_left_in_interval = ctx.restart_interval;
   }
-  else // Chroma
+  --scan->units_left_in_interval;
+}
+
+// Entropy decodes the next MCU row of an interleaved scan into MCU row grid_row of grid.
+static void decode_interleaved_row(scan_t* scan, const frame_layout_t* layout, const block_grid_t* grid, unsigned grid_row)
+{
+  for (unsigned x = 0; x != layout->x_mcus && !s_decode_error; ++x)
   {
-    printf("Storing Chroma Huff Table %d into the Decoder Context.\n", ht_type);
-    ctx.huffman_tables_chroma[ht_type] = true_root;
+    scan_next_restart_unit(scan);
+
+    for (unsigned char s = 0; s != scan->num_components && !s_decode_error; ++s)
+    {
+      const unsigned char c = scan->components[s];
+      for (unsigned by = 0; by != layout->v_factors[c]; ++by)
+      {
+        int16_t* block = grid_block(grid, c, grid_row * layout->v_factors[c] + by, x * layout->h_factors[c]);
+        for (unsigned bx = 0; bx != layout->h_factors[c]; ++bx, block += DCT_BLOCK_SIZE)
+        {
+          if (!scan_decode_block(scan, s, block))
+            decode_error("Corrupt entropy coded data.");
+        }
+      }
+    }
   }
+}
 
-  free(ht_items);
+// Entropy decodes a non-interleaved scan. It only covers the blocks the component's own samples need, not
+// the MCU padding, so it's walked in the component's block grid, one block at a time.
+static void decode_non_interleaved(scan_t* scan, const frame_layout_t* layout, const block_grid_t* grid)
+{
+  const unsigned char c = scan->components[0];
+  const unsigned width = (ctx.x_length * layout->h_factors[c] + layout->h_max - 1) / layout->h_max;
+  const unsigned height = (ctx.y_length * layout->v_factors[c] + layout->v_max - 1) / layout->v_max;
+  const unsigned blocks_wide = (width + DCT_BLOCK_SIDE - 1) / DCT_BLOCK_SIDE;
+  const unsigned blocks_high = (height + DCT_BLOCK_SIDE - 1) / DCT_BLOCK_SIDE;
 
-  return segment_len;
+  for (unsigned y = 0; y != blocks_high && !s_decode_error; ++y)
+  {
+    PROFILE_BEGIN(PS_ENTROPY_DECODE);
+    int16_t* block = grid_block(grid, c, y, 0);
+    for (unsigned x = 0; x != blocks_wide && !s_decode_error; ++x, block += DCT_BLOCK_SIZE)
+    {
+      scan_next_restart_unit(scan);
+
+      if (!scan_decode_block(scan, 0, block))
+        decode_error("Corrupt entropy coded data.");
+    }
+    PROFILE_END(PS_ENTROPY_DECODE);
+
+    // Reads past the end only ever see the zeroed guard, so checking once per row is enough.
+    if (scan_overrun(scan))
+      decode_error("Scan data ended early.");
+  }
 }
 
-static unsigned short process_func_start_of_scan(unsigned char* img_buf)
+// Where a parallel scan's units go: MCUs of an interleaved scan, single blocks of a non-interleaved one.
+typedef struct _parallel_store
+{
+  const scan_t* scan;
+  const frame_layout_t* layout;
+  const block_grid_t* grid;
+  bool single_blocks;
+  unsigned units_wide;
+} parallel_store_t;
+
+static void store_parallel_unit(void* user, size_t unit, const int16_t* blocks)
 {
-  unsigned short sos_header_len = get_short(img_buf);
-  printf("(Header Size: %d, ", sos_header_len);
+  const parallel_store_t* store = (const parallel_store_t*)user;
+  const unsigned x = (unsigned)(unit % store->units_wide), y = (unsigned)(unit / store->units_wide);
 
-  // Process SOS header: Selectors and Tables
-  if (sos_header_len != 12)
+  if (store->single_blocks)
   {
-    printf("\nWARNING: Something weird is going on. %d\n", sos_header_len);
-    return sos_header_len;
-  };
+    memcpy(grid_block(store->grid, store->scan->components[0], y, x), blocks, sizeof(int16_t) * DCT_BLOCK_SIZE);
+    return;
+  }
 
-  img_buf += sos_header_len;
+  // Same order decode_interleaved_row reads them in.
+  for (unsigned char s = 0; s != store->scan->num_components; ++s)
+  {
+    const unsigned char c = store->scan->components[s];
+    const unsigned char h = store->layout->h_factors[c];
+    for (unsigned by = 0; by != store->layout->v_factors[c]; ++by, blocks += h * DCT_BLOCK_SIZE)
+      memcpy(grid_block(store->grid, c, y * store->layout->v_factors[c] + by, x * h), blocks, sizeof(int16_t) * DCT_BLOCK_SIZE * h);
+  }
+}
 
-  // offsets holds the position of the 0xFF.
-    size_t temp_buffer_size = ctx.x_length * ctx.y_length; // TODO(kaiyen): Maybe store the buffer length in the context and use it for this?
-  unsigned* offsets = (unsigned*)malloc(sizeof(unsigned)*temp_buffer_size);
-  unsigned segment_len, offsets_counter = 0;
-  unsigned i = 0;
-  while (offsets_counter < temp_buffer_size) // We shouldn't really ever reach this point.
+// Describes scan to the parallel decoder, with its units stored into store->grid.
+static void init_parallel_scan(const scan_t* scan, const frame_layout_t* layout, const unsigned char* scan_buf, size_t scan_buf_len,
+                               parallel_store_t* store, parallel_scan_t* parallel)
+{
+  memset(parallel, 0, sizeof(*parallel));
+  parallel->data = scan_buf;
+  parallel->len = scan_buf_len;
+  parallel->num_components = scan->num_components;
+
+  store->scan = scan;
+  store->layout = layout;
+  store->grid = NULL;
+  store->single_blocks = scan->num_components == 1 && ctx.num_components != 1;
+  store->units_wide = layout->x_mcus;
+  parallel->store_mcu = store_parallel_unit;
+  parallel->user = store;
+
+  if (store->single_blocks)
   {
-    if (img_buf[i] == 0xFF)
+    // Same walk as decode_non_interleaved, just the component's own blocks.
+    const unsigned char c = scan->components[0];
+    const unsigned width = (ctx.x_length * layout->h_factors[c] + layout->h_max - 1) / layout->h_max;
+    const unsigned height = (ctx.y_length * layout->v_factors[c] + layout->v_max - 1) / layout->v_max;
+    store->units_wide = (width + DCT_BLOCK_SIDE - 1) / DCT_BLOCK_SIDE;
+    parallel->mcu_count = (size_t)store->units_wide * ((height + DCT_BLOCK_SIDE - 1) / DCT_BLOCK_SIDE);
+  }
+  else
+  {
+    parallel->mcu_count = (size_t)layout->x_mcus * layout->y_mcus;
+  }
+
+  for (unsigned char s = 0; s != scan->num_components; ++s)
+  {
+    const unsigned char c = scan->components[s];
+    const unsigned blocks = store->single_blocks ? 1 : layout->h_factors[c] * layout->v_factors[c];
+    for (unsigned b = 0; b != blocks; ++b, ++parallel->blocks_per_mcu)
     {
-      if(img_buf[i+1] != 0x00)
-      {
-        // Reached the end of the section. This means we're at the marker for EOI.
-        segment_len = i;
+      parallel->block_tables[parallel->blocks_per_mcu][0] = scan->huff_tables[s][0];
+      parallel->block_tables[parallel->blocks_per_mcu][1] = scan->huff_tables[s][1];
+      parallel->block_components[parallel->blocks_per_mcu] = s;
+    }
+  }
+}
 
-        // add it to the end of the array, but without incrementing the counter.
-        // by doing this we can copy the final span of the image too. from the last real offset to the EOI marker.
-        offsets[offsets_counter] = i;
-        break;
-      }
-      offsets[offsets_counter++] = i;
+// Whether decoding scan in parallel fits the memory budget: the chunks, and the frame's grid if it isn't held yet.
+// Serially a streamed scan only holds one MCU row, and the grid is counted in case it was going to.
+static bool parallel_scan_fits(const scan_t* scan, const frame_layout_t* layout, const unsigned char* scan_buf, size_t scan_buf_len, unsigned chunk_count)
+{
+  parallel_store_t store;
+  parallel_scan_t parallel;
+  init_parallel_scan(scan, layout, scan_buf, scan_buf_len, &store, &parallel);
+
+  unsigned long long bytes = parallel_scan_memory(&parallel, chunk_count);
+  const bool grid_held = s_coefficients != NULL ? s_coefficients->components[0].blocks != NULL : s_frame_blocks[0] != NULL;
+  for (unsigned char c = 0; c != ctx.num_components && !grid_held; ++c)
+    bytes += (unsigned long long)layout->x_mcus * layout->h_factors[c] * layout->y_mcus * layout->v_factors[c] * sizeof(int16_t) * DCT_BLOCK_SIZE;
+
+  return bytes <= SIZE_MAX && mem_budget_fits((size_t)bytes);
+}
+
+// Entropy decodes a whole scan without restart markers into grid, split into chunk_count pieces decoded at once.
+static void decode_parallel(const scan_t* scan, const frame_layout_t* layout, const block_grid_t* grid,
+                            const unsigned char* scan_buf, size_t scan_buf_len, unsigned chunk_count)
+{
+  parallel_store_t store;
+  parallel_scan_t parallel;
+  init_parallel_scan(scan, layout, scan_buf, scan_buf_len, &store, &parallel);
+  store.grid = grid;
+
+  PROFILE_BEGIN(PS_ENTROPY_DECODE);
+  if (!parallel_scan_decode(&parallel, chunk_count))
+    decode_error("Corrupt entropy coded data.");
+  PROFILE_END(PS_ENTROPY_DECODE);
+}
+
+// Fills in scan from the SOS header. Returns false if the scan should be skipped, with s_decode_error set if it's broken.
+static bool parse_scan_header(const unsigned char* img_buf, unsigned short sos_header_len, scan_t* scan)
+{
+  // Length, component count, 2 bytes per component, then spectral selection and approximation.
+  static const unsigned char SOS_COMPONENT_COUNT = sizeof(unsigned short);
+  static const unsigned char SOS_COMPONENTS = SOS_COMPONENT_COUNT + 1;
+
+  memset(scan, 0, sizeof(scan_t));
+  scan->arithmetic = s_frame_info.frame_marker == JFIF_SOF9;
+  scan->units_left_in_interval = ctx.restart_interval;
+  scan->num_components = sos_header_len > SOS_COMPONENT_COUNT ? img_buf[SOS_COMPONENT_COUNT] : 0;
+
+  if (scan->num_components == 0 || scan->num_components > ctx.num_components ||
+      sos_header_len != SOS_COMPONENTS + scan->num_components * 2 + 3)
+    return decode_error("Malformed scan header.");
+
+  // Each component in the scan picks its DC (high nibble) and AC (low nibble) table.
+  unsigned char components_seen = 0;
+  for (unsigned char s = 0; s != scan->num_components; ++s)
+  {
+    const unsigned char selector = img_buf[SOS_COMPONENTS + s * 2];
+    unsigned char c = 0;
+    while (c != ctx.num_components && ctx.components[c].id != selector)
+      ++c;
+
+    if (c == ctx.num_components || (components_seen & (1 << c)))
+      return decode_error("Scan doesn't match the frame header.");
+
+    components_seen |= 1 << c;
+    scan->components[s] = c;
+
+    const unsigned char table_ids = img_buf[SOS_COMPONENTS + s * 2 + 1];
+    const unsigned char dc_id = table_ids >> 4, ac_id = table_ids & 0x0F;
+    scan->table_ids[s] = table_ids;
+
+    if (scan->arithmetic)
+    {
+      // Arithmetic conditioning tables always exist, they just start out with the defaults.
+      if (dc_id >= ARITH_TABLES || ac_id >= ARITH_TABLES)
+        return decode_error("Scan uses an arithmetic conditioning table that doesn't exist.");
     }
-    ++i;
+    else
+    {
+      scan->huff_tables[s][0] = dc_id < MAX_HUFF_TABLES ? ctx.huffman_tables[0][dc_id] : NULL;
+      scan->huff_tables[s][1] = ac_id < MAX_HUFF_TABLES ? ctx.huffman_tables[1][ac_id] : NULL;
+
+      if (scan->huff_tables[s][0] == NULL || scan->huff_tables[s][1] == NULL)
+        return decode_error("Scan uses a huffman table that was never defined.");
+    }
+
+    if (!(ctx.quant_tables_defined & (1 << ctx.components[c].quant_table_id)))
+      return decode_error("Scan uses a quantization table that was never defined.");
   }
 
-  printf("Image Size: %d)...", segment_len);
+  // Baseline only ever has one scan per component.
+  if (s_components_decoded & components_seen)
+  {
+    LOG_WARN("Skipping a scan over components that were already decoded.");
+    return false;
+  }
+
+  // Tables can be redefined once a scan is done with them, so each component keeps the one it was decoded with.
+  for (unsigned char s = 0; s != scan->num_components; ++s)
+  {
+    const unsigned char c = scan->components[s];
+    memcpy(s_component_q_tables[c], ctx.quant_tables[ctx.components[c].quant_table_id], sizeof(s_component_q_tables[c]));
+  }
+
+  return true;
+}
+
+static size_t process_func_start_of_scan(const unsigned char* img_buf, size_t buf_len)
+{
+  unsigned short sos_header_len = get_segment_len(img_buf, buf_len);
+  LOG_DEBUG("Header Size: %d", sos_header_len);
+
+  if (s_decode_error)
+    return 0;
+
+  if (ctx.components == NULL)
+    return decode_error("Scan doesn't match the frame header.");
+
+  scan_t scan;
+  if (!parse_scan_header(img_buf, sos_header_len, &scan))
+  {
+    // The segment index already sized the scan, so this just steps over its entropy coded data.
+    return s_decode_error ? 0 : buf_len;
+  }
+
+  img_buf += sos_header_len;
 
-  // Now that we know the true size of the section. We can cleanse the image data of all 0x00's.
-  for(i = 0; i != offsets_counter; ++i)
+  unsigned char* scan_buf = NULL;
+  size_t scan_buf_len = 0;
+  size_t segment_len;
+  if (scan.arithmetic)
+  {
+    // The arithmetic decoder reads the stuffed bytes as they are.
+    segment_len = bitstream_scan_length(img_buf, buf_len - sos_header_len);
+    arith_decoder_init(&scan.arith, img_buf, segment_len);
+
+    for (unsigned char s = 0; s != scan.num_components; ++s)
+    {
+      const unsigned char dc_id = scan.table_ids[s] >> 4, ac_id = scan.table_ids[s] & 0x0F;
+      arith_decoder_add_component(&scan.arith, dc_id, ac_id, &ctx.arith_conditioning[0][dc_id], &ctx.arith_conditioning[1][ac_id]);
+    }
+  }
+  else
   {
-    // TODO(kaiyen): Maybe better to just alloc a temporary buffer and then memcpy?
-    unsigned offset = offsets[i];
-    memmove(&img_buf[offset+1], &img_buf[offset+2], offsets[i+1] - offset-1);
+    // Copy the entropy coded data out without the stuffed bytes. The copy comes with a zeroed guard
+    // region, so the bit reader never has to bounds check individual reads.
+    PROFILE_BEGIN(PS_UNSTUFF);
+    segment_len = bitstream_unstuff(img_buf, buf_len - sos_header_len, &scan_buf, &scan_buf_len);
+    PROFILE_END(PS_UNSTUFF);
+
+    if (scan_buf == NULL)
+      return decode_error("Failed to allocate the scan buffer.");
+
+    bit_reader_init(&scan.reader, scan_buf, scan_buf_len);
   }
 
-  // Scratch block for DCT block building
-  const size_t block_size = sizeof(unsigned) * QUANT_TABLE_SIZE;
-  unsigned* scratch_block = (unsigned*)malloc(block_size);
-  memset(scratch_block, 0, block_size);
+  LOG_DEBUG("Image Size: %zu", segment_len);
+
+  frame_layout_t layout;
+  get_frame_layout(&layout);
+  LOG_DEBUG("%d x %d pixels being divided into %d x %d MCUs.", ctx.x_length, ctx.y_length, layout.x_mcus, layout.y_mcus);
+
+  const unsigned char all_components = (unsigned char)((1 << ctx.num_components) - 1);
+  unsigned char scan_components = 0;
+  for (unsigned char s = 0; s != scan.num_components; ++s)
+    scan_components |= 1 << scan.components[s];
 
-  unsigned luma_dc_val = 0, chroma_dc_val = 0;
-  unsigned x, y, x_blocks = ctx.x_length/8, y_blocks = ctx.y_length/8;
-  unsigned offset;
-  printf("\n%d x %d pixels being divided into %d x %d blocks.\n", ctx.x_length, ctx.y_length, x_blocks, y_blocks);
-  for (y = 0; y != y_blocks; ++y)
+  output_rows_t out;
+  memset(&out, 0, sizeof(out));
+
+  // Restart markers would split the scan for free, but they're dropped by the unstuff, and the intervals reset the
+  // DC predictors the chunks rely on carrying over. Those scans stay serial, and so do arithmetic coded ones,
+  // which can't be picked up mid-stream without the statistics that led there.
+  unsigned chunk_count = ctx.restart_interval == 0 && !scan.arithmetic ?
+                         parallel_scan_chunk_count(scan_buf_len, s_entropy_threads, s_min_chunk_bytes) : 1;
+
+  // Serial decoding never needs more than the frame header was checked against. A parallel scan also holds the
+  // whole grid and the chunks, so it falls back to serial when those won't fit rather than failing the decode.
+  const bool can_stream = scan_components == all_components && s_coefficients == NULL;
+  if (chunk_count > 1 && !parallel_scan_fits(&scan, &layout, scan_buf, scan_buf_len, chunk_count))
+    chunk_count = 1;
+
+  if (can_stream && chunk_count == 1)
   {
-    offset = y*ctx.y_length*8;
-    for (x = 0; x != x_blocks; ++x)
+    // The whole frame in one scan. Each MCU row goes from entropy decoding through IDCT and color conversion
+    // before the next one starts, so only one MCU row of coefficients is ever held.
+    block_grid_t row_grid;
+    size_t row_blocks = 0;
+    for (unsigned char c = 0; c != ctx.num_components; ++c)
+    {
+      row_grid.blocks_wide[c] = layout.x_mcus * layout.h_factors[c];
+      row_blocks += (size_t)row_grid.blocks_wide[c] * layout.v_factors[c];
+    }
+
+    int16_t* coeff_row = (int16_t*)mem_malloc(sizeof(int16_t) * DCT_BLOCK_SIZE * row_blocks);
+    if (coeff_row == NULL)
+      decode_error("Failed to allocate the coefficient buffer.");
+
+    int16_t* blocks_it = coeff_row;
+    for (unsigned char c = 0; c != ctx.num_components && coeff_row != NULL; ++c)
     {
-      // Luminance
-      unsigned char*const block = &img_buf[offset + x*8];
-      unsigned chm_offset = bits_to_dct_block(block, (const huff_node_t**)ctx.huffman_tables_luma, scratch_block, &luma_dc_val);
+      row_grid.blocks[c] = blocks_it;
+      blocks_it += (size_t)row_grid.blocks_wide[c] * layout.v_factors[c] * DCT_BLOCK_SIZE;
+    }
+
+    if (s_output != NULL && coeff_row != NULL && !output_rows_init(&out, &layout))
+      decode_error("Can't output this image in the requested format.");
 
-      // TODO: IDCT (DCT #3)
+    for (unsigned y = 0; y != layout.y_mcus && !s_decode_error; ++y)
+    {
+      memset(coeff_row, 0, sizeof(int16_t) * DCT_BLOCK_SIZE * row_blocks);
 
-      memset(scratch_block, 0, block_size);
+      PROFILE_BEGIN(PS_ENTROPY_DECODE);
+      decode_interleaved_row(&scan, &layout, &row_grid, 0);
+      PROFILE_END(PS_ENTROPY_DECODE);
 
-      // Chrominance
-      unsigned char*const block2 = block + chm_offset;
-      unsigned unused = bits_to_dct_block(block2, (const huff_node_t**)ctx.huffman_tables_chroma, scratch_block, &chroma_dc_val);
-      unused++;
+      // Reads past the end only ever see the zeroed guard, so checking once per MCU row is enough.
+      if (scan_overrun(&scan))
+        decode_error("Scan data ended early.");
 
-      memset(scratch_block, 0, block_size);
+      if (s_output != NULL && !s_decode_error)
+        output_mcu_row(&out, &layout, &row_grid, 0, y);
     }
+
+    mem_free(coeff_row);
   }
+  else
+  {
+    // Part of the frame, coefficient output, or a scan decoded in parallel: decode into the frame's grid and
+    // only output once it's complete.
+    block_grid_t frame_grid;
+    if (!get_frame_grid(&layout, &frame_grid))
+      decode_error("Can't decode the coefficients of this scan.");
+
+    for (unsigned char s = 0; s != scan.num_components && s_coefficients != NULL && !s_decode_error; ++s)
+    {
+      const unsigned char c = scan.components[s];
+      memcpy(s_coefficients->components[c].quant_table, s_component_q_tables[c], sizeof(s_component_q_tables[c]));
+    }
+
+    if (chunk_count > 1)
+    {
+      if (!s_decode_error)
+        decode_parallel(&scan, &layout, &frame_grid, scan_buf, scan_buf_len, chunk_count);
+    }
+    else if (scan.num_components == 1)
+    {
+      decode_non_interleaved(&scan, &layout, &frame_grid);
+    }
+    else
+    {
+      for (unsigned y = 0; y != layout.y_mcus && !s_decode_error; ++y)
+      {
+        PROFILE_BEGIN(PS_ENTROPY_DECODE);
+        decode_interleaved_row(&scan, &layout, &frame_grid, y);
+        PROFILE_END(PS_ENTROPY_DECODE);
+
+        if (scan_overrun(&scan))
+          decode_error("Scan data ended early.");
+      }
+    }
+
+    if (s_output != NULL && !s_decode_error && (s_components_decoded | scan_components) == all_components)
+    {
+      if (!output_rows_init(&out, &layout))
+        decode_error("Can't output this image in the requested format.");
 
-  free(scratch_block);
-  free(offsets);
-  return segment_len+sos_header_len;
+      for (unsigned y = 0; y != layout.y_mcus && !s_decode_error; ++y)
+        output_mcu_row(&out, &layout, &frame_grid, y, y);
+    }
+  }
+
+  if (!s_decode_error)
+  {
+    s_components_decoded |= scan_components;
+    if (s_components_decoded == all_components && (s_output != NULL || s_coefficients != NULL))
+      s_output_written = true;
+  }
+
+  output_rows_cleanup(&out);
+  mem_free(scan_buf);
+  return sos_header_len + segment_len;
 }
 
-static unsigned short process_func_end_of_image(unsigned char* img_buf)
+static size_t process_func_restart_interval(const unsigned char* img_buf, size_t buf_len)
 {
-  unsigned short segment_len = get_segment_len(img_buf);
+  unsigned short segment_len = get_segment_len(img_buf, buf_len);
+  if (s_decode_error)
+    return 0;
 
-  // Cleanup the decode context
-  for (unsigned char i = 0; i != 2; ++i)
-  {
-    // Right now only the huffman tables are on the heap.
-    if (ctx.huffman_tables_luma[i])
-      huff_table_cleanup(ctx.huffman_tables_luma[i]);
+  if (segment_len < 4)
+    return decode_error("Restart interval segment is too short.");
 
-    if (ctx.huffman_tables_chroma[i])
-      huff_table_cleanup(ctx.huffman_tables_chroma[i]);
-  }
+  ctx.restart_interval = get_short(img_buf + sizeof(unsigned short));
+  LOG_DEBUG("Restart Interval: %d", ctx.restart_interval);
 
   return segment_len;
 }
 
+static size_t process_func_end_of_image(const unsigned char* img_buf, size_t buf_len)
+{
+  // Like SOI, there is no length after the marker.
+  LOG_DEBUG("Segment Length: 0");
+
+  // Cleanup the decode context
+  cleanup_decode_ctx();
+
+  return 0;
+}
+
 bool get_segment_process_func(unsigned char marker, process_func_t* out_process_func, char* out_segment_name)
 {
   switch (marker)
@@ -380,6 +1272,10 @@ bool get_segment_process_func(unsigned char marker, process_func_t* out_process_
       *out_process_func = process_func_app_segment_0;
       strcpy(out_segment_name, "App Segment 0");
       break;
+    case JFIF_A14:
+      *out_process_func = process_func_app_segment_14;
+      strcpy(out_segment_name, "App Segment 14");
+      break;
     case JFIF_DQT:
       *out_process_func = process_func_quant_table;
       strcpy(out_segment_name, "Quantization Table");
@@ -388,14 +1284,30 @@ bool get_segment_process_func(unsigned char marker, process_func_t* out_process_
       *out_process_func = process_func_start_of_frame;
       strcpy(out_segment_name, "Start of Frame");
       break;
+    case JFIF_SOF1:
+      *out_process_func = process_func_start_of_frame_extended;
+      strcpy(out_segment_name, "Start of Frame (Extended)");
+      break;
+    case JFIF_SOF9:
+      *out_process_func = process_func_start_of_frame_arithmetic;
+      strcpy(out_segment_name, "Start of Frame (Arithmetic)");
+      break;
     case JFIF_DHT:
       *out_process_func = process_func_huffman_table;
       strcpy(out_segment_name, "Huffman Table");
       break;
+    case JFIF_DAC:
+      *out_process_func = process_func_arith_conditioning;
+      strcpy(out_segment_name, "Arithmetic Conditioning");
+      break;
     case JFIF_SOS:
       *out_process_func = process_func_start_of_scan;
       strcpy(out_segment_name, "Start of Scan");
       break;
+    case JFIF_DRI:
+      *out_process_func = process_func_restart_interval;
+      strcpy(out_segment_name, "Restart Interval");
+      break;
     case JFIF_EOI:
       *out_process_func = process_func_end_of_image;
       strcpy(out_segment_name, "End of Image");
@@ -406,15 +1318,207 @@ bool get_segment_process_func(unsigned char marker, process_func_t* out_process_
   return true;
 }
 
-static unsigned short process_func_default(unsigned char* img_buf)
+static size_t process_func_default(const unsigned char* img_buf, size_t buf_len)
 {
-  unsigned short segment_len = get_segment_len(img_buf);
+  // Standalone markers (RSTn, TEM) don't have a length at all.
+  if (buf_len == 0)
+    return 0;
+
+  unsigned short segment_len = get_segment_len(img_buf, buf_len);
 
   return segment_len;
 }
 
+static size_t process_func_unsupported_frame(const unsigned char* img_buf, size_t buf_len)
+{
+  return decode_error("Only baseline and extended sequential frames are supported.");
+}
+
 void get_default_stage(unsigned char marker, process_func_t* out_process_func, char* out_segment_name)
 {
+  if (segment_is_frame_marker(marker))
+  {
+    *out_process_func = process_func_unsupported_frame;
+    sprintf(out_segment_name, "Unsupported Frame: 0xFF%X", marker);
+    return;
+  }
+
   *out_process_func = process_func_default;
   sprintf(out_segment_name, "Unsupported Stage: 0xFF%X", marker);
 }
+
+size_t jpeg_pixel_format_size(jpeg_pixel_format_t format)
+{
+  static const size_t PIXEL_FORMAT_SIZE[JPF_COUNT] = {1, 3, 3, 4, 4, 1, 1, 1, 1, 2, 6};
+  return format < JPF_COUNT ? PIXEL_FORMAT_SIZE[format] : 0;
+}
+
+size_t jpeg_pixel_format_sample_size(jpeg_pixel_format_t format)
+{
+  return format == JPF_GRAY16 || format == JPF_RGB48 ? 2 : 1;
+}
+
+bool jpeg_pixel_format_is_planar(jpeg_pixel_format_t format)
+{
+  return format >= JPF_YUV444 && format <= JPF_NATIVE;
+}
+
+unsigned jpeg_scaled_size(unsigned size, unsigned char scale_denom)
+{
+  return scale_denom > 1 ? (size + scale_denom - 1) / scale_denom : size;
+}
+
+bool jpeg_decode_buffer(const unsigned char* img_buf, size_t byte_size)
+{
+  return jpeg_decode_to(img_buf, byte_size, NULL);
+}
+
+bool jpeg_decode_coefficients(const unsigned char* img_buf, size_t byte_size, jpeg_coefficients_t* out)
+{
+  if (out == NULL)
+    return false;
+
+  memset(out, 0, sizeof(jpeg_coefficients_t));
+
+  s_coefficients = out;
+  const bool success = jpeg_decode_to(img_buf, byte_size, NULL);
+  s_coefficients = NULL;
+
+  if (!success)
+    jpeg_coefficients_free(out);
+
+  return success;
+}
+
+void jpeg_coefficients_free(jpeg_coefficients_t* coefficients)
+{
+  for (unsigned char c = 0; c != MAX_COMPONENTS; ++c)
+  {
+    mem_free(coefficients->components[c].blocks);
+    coefficients->components[c].blocks = NULL;
+  }
+}
+
+bool jpeg_decode_to(const unsigned char* img_buf, size_t byte_size, const jpeg_output_t* output)
+{
+  if (img_buf == NULL || (output != NULL && jpeg_pixel_format_size(output->format) == 0))
+    return false;
+
+  // Scaling and row sinks work on the converted rows, which planar formats never have.
+  if (output != NULL)
+  {
+    const unsigned char scale = output->scale_denom;
+    if ((scale > 1 || output->row_sink != NULL) && jpeg_pixel_format_is_planar(output->format))
+      return false;
+    if (scale != 0 && scale != 1 && scale != 2 && scale != 4 && scale != 8)
+      return false;
+  }
+
+  s_decode_error = false;
+  s_output = output;
+  s_output_written = false;
+  s_components_decoded = 0;
+  mem_budget_begin(s_memory_limit);
+
+  process_func_t process_func = NULL;
+  char segment_name_buf[64];
+  if (!get_segment_process_func(JFIF_SOI, &process_func, segment_name_buf))
+  {
+    LOG_ERROR("Failed to get initial stage.");
+    mem_budget_end();
+    return false;
+  }
+
+  // Find every segment up front. Handlers only ever see their own segment's bytes.
+  PROFILE_BEGIN(PS_MARKER_PARSE);
+  segment_index_t index = {0};
+  const bool index_complete = segment_index_build(img_buf, byte_size, 0, &index);
+  PROFILE_END(PS_MARKER_PARSE);
+
+  s_scan_count = 0;
+  for (size_t i = 0; i != index.count; ++i)
+    s_scan_count += index.entries[i].marker == JFIF_SOS;
+
+  for (size_t i = 0; i != index.count && !s_decode_error; ++i)
+  {
+    const segment_entry_t* entry = &index.entries[i];
+
+    if (get_segment_process_func(entry->marker, &process_func, segment_name_buf))
+    {
+      LOG_INFO("> Processing %s", segment_name_buf);
+    }
+    else
+    {
+      get_default_stage(entry->marker, &process_func, segment_name_buf);
+      LOG_INFO("> Skipping %s", segment_name_buf);
+    }
+
+    // The scan handler times its own unstuff and entropy decode stages.
+    const bool is_scan = (process_func == process_func_start_of_scan);
+
+    if (!is_scan)
+      PROFILE_BEGIN(PS_MARKER_PARSE);
+
+    process_func(&img_buf[entry->offset], entry->length);
+
+    if (!is_scan)
+      PROFILE_END(PS_MARKER_PARSE);
+  }
+
+  if (!index_complete && !s_decode_error)
+    decode_error("Segment length is out of bounds.");
+
+  segment_index_free(&index);
+
+  if ((output != NULL || s_coefficients != NULL) && !s_output_written && !s_decode_error)
+    decode_error("Image has no scan that could be decoded.");
+
+  s_output = NULL;
+
+  // Files that end early never reach EOI, so make sure nothing is left behind.
+  cleanup_decode_ctx();
+  mem_budget_end();
+
+  return !s_decode_error;
+}
+
+const decode_context_t* get_decode_context(void)
+{
+  return &ctx;
+}
+
+void jpeg_set_huff_table_cache(bool enabled)
+{
+  if (!enabled)
+    jpeg_release_caches();
+
+  s_cache_huff_tables = enabled;
+}
+
+void jpeg_release_caches(void)
+{
+  for (unsigned char table_class = 0; table_class != HUFF_TABLES_PER_CHANNEL_TYPE; ++table_class)
+  {
+    for (unsigned char id = 0; id != MAX_HUFF_TABLES; ++id)
+    {
+      huff_table_free(s_huff_cache[table_class][id].table);
+      memset(&s_huff_cache[table_class][id], 0, sizeof(cached_huff_table_t));
+    }
+  }
+}
+
+void jpeg_set_entropy_threads(unsigned threads, size_t min_chunk_bytes)
+{
+  s_entropy_threads = threads;
+  s_min_chunk_bytes = min_chunk_bytes;
+}
+
+void jpeg_set_memory_limit(size_t max_bytes)
+{
+  s_memory_limit = max_bytes;
+}
+
+size_t jpeg_peak_memory(void)
+{
+  return mem_budget_peak();
+}
@@ -6,9 +6,12 @@ Author: kaiyen
 #ifndef DECODER_H
 #define DECODER_H
 
+#include "arith_decoder.h"
 #include "huffman.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // JFIF Markers
 enum
@@ -16,14 +19,24 @@ enum
   JFIF_MFF = 0xFF, // Marker Byte
   JFIF_SOI = 0xD8, // Start of Image
   JFIF_AP0 = 0xE0, // Application Segment 0
+  JFIF_A14 = 0xEE, // Application Segment 14 (Adobe)
   JFIF_DQT = 0xDB, // Define Quantization Table
   JFIF_SOF = 0xC0, // Start of Frame
+  JFIF_SOF1 = 0xC1, // Start of Frame, extended sequential (8 or 12 bits per sample)
   JFIF_DHT = 0xC4, // Define Huffman Table
+  JFIF_SOF9 = 0xC9, // Start of Frame, extended sequential with arithmetic coding
+  JFIF_DAC = 0xCC, // Define Arithmetic Coding conditioning
   JFIF_SOS = 0xDA, // Start of Scan
+  JFIF_DRI = 0xDD, // Define Restart Interval
+  JFIF_RST0 = 0xD0, // Restart Marker 0
+  JFIF_RST7 = 0xD7, // Restart Marker 7
+  JFIF_TEM = 0x01, // Temporary, no length
   JFIF_EOI = 0xD9  // End of Image
 };
 
-typedef unsigned short (*process_func_t)(unsigned char*);
+// Segment handlers get a pointer just past the marker and the length of the segment from the segment index.
+// They return how many bytes they consumed.
+typedef size_t (*process_func_t)(const unsigned char* img_buf, size_t buf_len);
 
 // Fills the name and process function maps at init time.
 void populate_stage_map(void);
@@ -36,6 +49,7 @@ void get_default_stage(unsigned char marker, process_func_t* out_process_func, c
 
 typedef struct _jfif_component
 {
+  unsigned char id;
   unsigned char quant_table_id;
   unsigned char sample_factor_vert;
   unsigned char sample_factor_horiz;
@@ -59,19 +73,25 @@ This is mostly responsible for holding the state.
 Each stage's information will be organized and stuffed into this thing.
 */
 #define HUFF_TABLES_PER_CHANNEL_TYPE 2
+#define MAX_HUFF_TABLES 4
+#define MAX_QUANT_TABLES 4
+#define MAX_COMPONENTS 4
 #define QUANT_TABLE_SIZE 64
+#define ADOBE_TRANSFORM_UNKNOWN 0xFF
 typedef struct _decode_context
 {
   extension_data_t* extension_data;
 
-  // By convention: Index 0 is DC, Index 1 is AC
-  // chroma tables are NULL for greyscale images.
-  huff_node_t* huffman_tables_luma[HUFF_TABLES_PER_CHANNEL_TYPE];
-  huff_node_t* huffman_tables_chroma[HUFF_TABLES_PER_CHANNEL_TYPE];
+  // Indexed by class (0 is DC, 1 is AC), then by the destination id the DHT segment gave. NULL until defined.
+  huff_table_t* huffman_tables[HUFF_TABLES_PER_CHANNEL_TYPE][MAX_HUFF_TABLES];
+
+  // Same indexing for arithmetic coded frames, the spec defaults until a DAC segment changes them.
+  arith_conditioning_t arith_conditioning[HUFF_TABLES_PER_CHANNEL_TYPE][ARITH_TABLES];
   jfif_component_t* components;
 
-  unsigned short luma_q_table[QUANT_TABLE_SIZE];
-  unsigned short chrm_q_table[QUANT_TABLE_SIZE];
+  // Natural order, indexed by destination id. quant_tables_defined has a bit set for each one a DQT segment filled in.
+  unsigned short quant_tables[MAX_QUANT_TABLES][QUANT_TABLE_SIZE];
+  unsigned char quant_tables_defined;
 
   unsigned short x_length;
   unsigned short y_length;
@@ -79,10 +99,149 @@ typedef struct _decode_context
   unsigned short x_density;
   unsigned short y_density;
 
+  // Color transform from the Adobe segment: 0 none (RGB/CMYK), 1 YCbCr, 2 YCCK. ADOBE_TRANSFORM_UNKNOWN without one.
+  unsigned char adobe_transform;
+
+  // MCUs between restart markers, 0 if the file doesn't use them.
+  unsigned short restart_interval;
+
   unsigned char density_units;
   unsigned char bits_per_sample;
   unsigned char num_components;
 
 } decode_context_t;
 
+typedef enum _jpeg_pixel_format
+{
+  JPF_GRAY8,
+  JPF_RGB24,
+  JPF_BGR24,
+  JPF_RGBA32, // Alpha is always 0xFF
+  JPF_BGRA32,
+
+  // Planar formats hand over the IDCT output as is: no upsampling and no color conversion.
+  // They only apply when the image's own sampling matches, see jpeg_plane_size.
+  JPF_YUV444, // Y, Cb, Cr planes, all at full resolution
+  JPF_I420,   // Y plane, then Cb and Cr at half width and height
+  JPF_NV12,   // Y plane, then one plane of interleaved Cb Cr at half width and height
+  JPF_NATIVE, // One plane per component at whatever resolution its sampling factors give it
+
+  // 16 bits per sample in native byte order, holding 0..4095. The only formats 12 bit frames decode to.
+  JPF_GRAY16,
+  JPF_RGB48,
+  JPF_COUNT
+} jpeg_pixel_format_t;
+
+// Bytes per pixel of a packed format, or per sample of a planar one.
+size_t jpeg_pixel_format_size(jpeg_pixel_format_t format);
+
+// Bytes per sample: 2 for the 16 bit formats, 1 for the rest.
+size_t jpeg_pixel_format_sample_size(jpeg_pixel_format_t format);
+
+bool jpeg_pixel_format_is_planar(jpeg_pixel_format_t format);
+
+/*
+----------------
+Decode Output:
+----------------
+Caller owned destination for the decoded pixels. Each MCU row is written straight into
+the planes as soon as it is decoded, so the decoder never holds a full frame of its own.
+Packed formats only use plane 0. Strides are in bytes and may be larger than a row, or
+negative for bottom up images. The buffer must hold width x height pixels, see jpeg_probe
+and jpeg_plane_size for getting those up front.
+*/
+
+// Receives output rows as soon as they are converted, one MCU row at a time. rows is only valid
+// during the call. Returning false stops the decode, which then fails.
+typedef bool (*jpeg_row_sink_t)(void* user, const unsigned char* rows, ptrdiff_t stride, unsigned first_row, unsigned row_count);
+
+typedef struct _jpeg_output
+{
+  jpeg_pixel_format_t format;
+  unsigned char* planes[MAX_COMPONENTS];
+  ptrdiff_t strides[MAX_COMPONENTS];
+
+  // 1, 2, 4 or 8, 0 counts as 1. Decodes at 1/scale_denom of the size by inverse transforming
+  // only the lowest frequencies of each block, see jpeg_scaled_size. Packed formats only.
+  unsigned char scale_denom;
+
+  // Packed formats only. When set, rows go to the sink instead of planes, which are ignored.
+  // The decoder then holds a single MCU row of output and the caller no buffer at all.
+  jpeg_row_sink_t row_sink;
+  void* row_sink_user;
+} jpeg_output_t;
+
+// Width or height of the output after scaling by 1/scale_denom. Partial pixels round up.
+unsigned jpeg_scaled_size(unsigned size, unsigned char scale_denom);
+
+// Decodes a complete JFIF image held in img_buf. Every read is bounded by byte_size, so
+// truncated or corrupt input fails cleanly. Returns false on malformed data.
+// Only the entropy coded data is decoded, nothing is output. Use jpeg_decode_to for pixels.
+bool jpeg_decode_buffer(const unsigned char* img_buf, size_t byte_size);
+
+// Same as jpeg_decode_buffer, and also writes the image to output.
+bool jpeg_decode_to(const unsigned char* img_buf, size_t byte_size, const jpeg_output_t* output);
+
+/*
+----------------
+Coefficients:
+----------------
+The quantized DCT coefficients of every block, exactly as they come out of the entropy decoder.
+Blocks are stored block major: one row of blocks after the other, 64 coefficients per block in
+natural (not zig zag) order. The block grid is padded out to whole MCUs, so it can be wider and
+taller than the component itself.
+*/
+typedef struct _jpeg_component_coefficients
+{
+  jfif_component_t component;
+
+  unsigned blocks_wide;
+  unsigned blocks_high;
+  int16_t* blocks;
+
+  // The table that dequantizes these blocks, natural order.
+  unsigned short quant_table[QUANT_TABLE_SIZE];
+} jpeg_component_coefficients_t;
+
+typedef struct _jpeg_coefficients
+{
+  unsigned short width;
+  unsigned short height;
+  unsigned char num_components;
+  jpeg_component_coefficients_t components[MAX_COMPONENTS];
+
+  // Carried over from the Adobe segment so a re-encode keeps the color space. ADOBE_TRANSFORM_UNKNOWN without one.
+  unsigned char adobe_transform;
+} jpeg_coefficients_t;
+
+// Decodes the entropy coded data into out without running the IDCT. Free the result with jpeg_coefficients_free.
+bool jpeg_decode_coefficients(const unsigned char* img_buf, size_t byte_size, jpeg_coefficients_t* out);
+
+void jpeg_coefficients_free(jpeg_coefficients_t* coefficients);
+
+// Returns the context filled in by the most recent decode.
+const decode_context_t* get_decode_context(void);
+
+// Scans without restart markers are entropy decoded in parallel once they're at least two chunks of
+// min_chunk_bytes, over up to threads threads (0 is one per core, 1 keeps every scan serial).
+// Parallel scans hold the whole frame's coefficients, and a copy in chunks, instead of one MCU row, so output that
+// would stream only goes parallel when all that fits the memory limit. Defaults to 1 and 64 KiB.
+void jpeg_set_entropy_threads(unsigned threads, size_t min_chunk_bytes);
+
+// Keeps Huffman tables between decodes, so files defining the same tables as the last one skip building them.
+// For callers decoding many similar files in one process. Off by default. Tables held count towards the decode
+// that built them. Turning it off releases them.
+void jpeg_set_huff_table_cache(bool enabled);
+
+// Frees whatever jpeg_set_huff_table_cache kept. The cache stays on if it was.
+void jpeg_release_caches(void);
+
+// Caps the bytes a single decode may hold at once, 0 (the default) for no limit. The frame header is checked
+// against it before anything is allocated, and every allocation after that, so oversized or crafted images fail
+// cleanly instead of exhausting memory. The caller's output buffer isn't part of it.
+void jpeg_set_memory_limit(size_t max_bytes);
+
+// Most bytes the most recent decode held at once. Coefficient output counts, handed over or not.
+size_t jpeg_peak_memory(void);
+
 #endif
@@ -0,0 +1,354 @@
+/*--------------------------------------------------------------------------
+File:   encoder.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "encoder.h"
+
+#include "color_convert.h"
+#include "dct_utils.h"
+#include "mem_budget.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Example tables from K.1 in the spec, natural order.
+static const unsigned char STANDARD_LUMA_Q_TABLE[QUANT_TABLE_SIZE] =
+{
+  16,  11,  10,  16,  24,  40,  51,  61,
+  12,  12,  14,  19,  26,  58,  60,  55,
+  14,  13,  16,  24,  40,  57,  69,  56,
+  14,  17,  22,  29,  51,  87,  80,  62,
+  18,  22,  37,  56,  68, 109, 103,  77,
+  24,  35,  55,  64,  81, 104, 113,  92,
+  49,  64,  78,  87, 103, 121, 120, 101,
+  72,  92,  95,  98, 112, 100, 103,  99,
+};
+
+static const unsigned char STANDARD_CHROMA_Q_TABLE[QUANT_TABLE_SIZE] =
+{
+  17,  18,  24,  47,  99,  99,  99,  99,
+  18,  21,  26,  66,  99,  99,  99,  99,
+  24,  26,  56,  99,  99,  99,  99,  99,
+  47,  66,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+};
+
+void jpeg_encode_params_default(jpeg_encode_params_t* params)
+{
+  params->quality = 75;
+  params->subsampling = JSS_420;
+  params->optimize_huffman = false;
+}
+
+void jpeg_quant_table_for_quality(bool chroma, unsigned char quality, unsigned short* out_table)
+{
+  if (quality < 1)
+    quality = 1;
+  if (quality > 100)
+    quality = 100;
+
+  // Percentage to scale the example tables by: 5000/q below 50, then down linearly to 0 at 100.
+  const unsigned scale = quality < 50 ? 5000u / quality : 200u - quality * 2u;
+  const unsigned char* base = chroma ? STANDARD_CHROMA_Q_TABLE : STANDARD_LUMA_Q_TABLE;
+
+  // Baseline tables have to fit in 8 bits.
+  for (unsigned char i = 0; i != QUANT_TABLE_SIZE; ++i)
+  {
+    const unsigned value = (base[i] * scale + 50) / 100;
+    out_table[i] = (unsigned short)(value < 1 ? 1 : (value > 255 ? 255 : value));
+  }
+}
+
+void jpeg_encoder_cleanup(jpeg_encoder_t* encoder)
+{
+  jpeg_writer_cleanup(&encoder->writer);
+  jpeg_coefficients_free(&encoder->coefficients);
+
+  for (unsigned char c = 0; c != MAX_COMPONENTS; ++c)
+  {
+    free(encoder->sample_rows[c]);
+    free(encoder->downsampled_rows[c]);
+    encoder->sample_rows[c] = encoder->downsampled_rows[c] = NULL;
+  }
+}
+
+bool jpeg_encoder_init(jpeg_encoder_t* encoder, unsigned short width, unsigned short height,
+                       jpeg_pixel_format_t format, const jpeg_encode_params_t* params)
+{
+  memset(encoder, 0, sizeof(jpeg_encoder_t));
+
+  if (width == 0 || height == 0 || jpeg_pixel_format_is_planar(format) || jpeg_pixel_format_size(format) == 0 ||
+      jpeg_pixel_format_sample_size(format) != 1)
+    return false;
+
+  if (params != NULL)
+    encoder->params = *params;
+  else
+    jpeg_encode_params_default(&encoder->params);
+
+  if (encoder->params.subsampling >= JSS_COUNT)
+    return false;
+
+  encoder->format = format;
+  encoder->width = width;
+  encoder->height = height;
+  encoder->num_components = format == JPF_GRAY8 ? 1 : 3;
+
+  // Luma carries the subsampling, both chroma components are 1x1.
+  jfif_component_t components[3] = { { 1, 0, 1, 1 }, { 2, 1, 1, 1 }, { 3, 1, 1, 1 } };
+  if (encoder->num_components == 3 && encoder->params.subsampling != JSS_444)
+  {
+    components[0].sample_factor_horiz = 2;
+    components[0].sample_factor_vert = encoder->params.subsampling == JSS_420 ? 2 : 1;
+  }
+
+  encoder->h_max = components[0].sample_factor_horiz;
+  encoder->v_max = components[0].sample_factor_vert;
+
+  const unsigned mcu_w = encoder->h_max * 8u, mcu_h = encoder->v_max * 8u;
+  encoder->x_mcus = (width + mcu_w - 1) / mcu_w;
+  encoder->sample_stride = (size_t)encoder->x_mcus * mcu_w;
+
+  init_inverse_dct_table();
+
+  unsigned short quant_tables[HUFF_TABLES_PER_CHANNEL_TYPE][QUANT_TABLE_SIZE];
+  for (unsigned char t = 0; t != HUFF_TABLES_PER_CHANNEL_TYPE; ++t)
+  {
+    jpeg_quant_table_for_quality(t != 0, encoder->params.quality, quant_tables[t]);
+    for (unsigned char i = 0; i != QUANT_TABLE_SIZE; ++i)
+      encoder->q_reciprocals[t][i] = 1.0f / quant_tables[t][i];
+  }
+
+  for (unsigned char c = 0; c != encoder->num_components; ++c)
+  {
+    const jfif_component_t* component = &components[c];
+    encoder->sample_rows[c] = (unsigned char*)malloc(encoder->sample_stride * mcu_h);
+
+    const bool subsampled = component->sample_factor_horiz != encoder->h_max || component->sample_factor_vert != encoder->v_max;
+    if (subsampled)
+      encoder->downsampled_rows[c] = (unsigned char*)malloc((size_t)encoder->x_mcus * component->sample_factor_horiz * 8 * component->sample_factor_vert * 8);
+
+    if (encoder->sample_rows[c] == NULL || (subsampled && encoder->downsampled_rows[c] == NULL))
+    {
+      jpeg_encoder_cleanup(encoder);
+      return false;
+    }
+  }
+
+  if (encoder->params.optimize_huffman)
+  {
+    // The tables can't be written before every block has been counted, so hold them all.
+    const unsigned y_mcus = (height + mcu_h - 1) / mcu_h;
+    jpeg_coefficients_t* coefficients = &encoder->coefficients;
+    coefficients->width = width;
+    coefficients->height = height;
+    coefficients->num_components = encoder->num_components;
+    coefficients->adobe_transform = ADOBE_TRANSFORM_UNKNOWN;
+
+    for (unsigned char c = 0; c != encoder->num_components; ++c)
+    {
+      jpeg_component_coefficients_t* component = &coefficients->components[c];
+      component->component = components[c];
+      component->blocks_wide = encoder->x_mcus * components[c].sample_factor_horiz;
+      component->blocks_high = y_mcus * components[c].sample_factor_vert;
+      memcpy(component->quant_table, quant_tables[components[c].quant_table_id], sizeof(component->quant_table));
+
+      component->blocks = (int16_t*)mem_malloc((size_t)component->blocks_wide * component->blocks_high * sizeof(int16_t) * DCT_BLOCK_SIZE);
+      if (component->blocks == NULL)
+      {
+        jpeg_encoder_cleanup(encoder);
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  if (!jpeg_writer_init(&encoder->writer, width, height, encoder->num_components, components))
+  {
+    jpeg_encoder_cleanup(encoder);
+    return false;
+  }
+
+  for (unsigned char t = 0; t != HUFF_TABLES_PER_CHANNEL_TYPE; ++t)
+    memcpy(encoder->writer.quant_tables[t], quant_tables[t], sizeof(quant_tables[t]));
+
+  jpeg_writer_write_headers(&encoder->writer);
+  return true;
+}
+
+// Box filters a component's full resolution MCU row down to its own sampling.
+static void downsample_rows(const jpeg_encoder_t* encoder, unsigned char c, unsigned char h, unsigned char v)
+{
+  const unsigned char step_x = encoder->h_max / h, step_y = encoder->v_max / v;
+  const unsigned area = step_x * step_y;
+  const size_t out_stride = (size_t)encoder->x_mcus * h * 8;
+
+  for (unsigned y = 0; y != v * 8u; ++y)
+  {
+    unsigned char* out = encoder->downsampled_rows[c] + y * out_stride;
+    const unsigned char* in = encoder->sample_rows[c] + (size_t)y * step_y * encoder->sample_stride;
+
+    for (size_t x = 0; x != out_stride; ++x)
+    {
+      unsigned sum = 0;
+      for (unsigned char dy = 0; dy != step_y; ++dy)
+      {
+        for (unsigned char dx = 0; dx != step_x; ++dx)
+          sum += in[dy * encoder->sample_stride + x * step_x + dx];
+      }
+
+      out[x] = (unsigned char)((sum + area / 2) / area);
+    }
+  }
+}
+
+static void encode_mcu_row(jpeg_encoder_t* encoder)
+{
+  const unsigned char* planes[MAX_COMPONENTS];
+  size_t strides[MAX_COMPONENTS];
+  unsigned char h_factors[MAX_COMPONENTS], v_factors[MAX_COMPONENTS];
+
+  for (unsigned char c = 0; c != encoder->num_components; ++c)
+  {
+    // Only luma ever carries the larger factors.
+    h_factors[c] = c == 0 ? encoder->h_max : 1;
+    v_factors[c] = c == 0 ? encoder->v_max : 1;
+
+    if (encoder->downsampled_rows[c] != NULL)
+    {
+      downsample_rows(encoder, c, h_factors[c], v_factors[c]);
+      planes[c] = encoder->downsampled_rows[c];
+      strides[c] = (size_t)encoder->x_mcus * h_factors[c] * 8;
+    }
+    else
+    {
+      planes[c] = encoder->sample_rows[c];
+      strides[c] = encoder->sample_stride;
+    }
+  }
+
+  int16_t block[DCT_BLOCK_SIZE];
+  for (unsigned mx = 0; mx != encoder->x_mcus; ++mx)
+  {
+    for (unsigned char c = 0; c != encoder->num_components; ++c)
+    {
+      const float* q_reciprocals = encoder->q_reciprocals[c == 0 ? 0 : 1];
+
+      for (unsigned char by = 0; by != v_factors[c]; ++by)
+      {
+        for (unsigned char bx = 0; bx != h_factors[c]; ++bx)
+        {
+          const unsigned char* samples = planes[c] + by * 8 * strides[c] + (size_t)(mx * h_factors[c] + bx) * 8;
+
+          if (encoder->params.optimize_huffman)
+          {
+            jpeg_component_coefficients_t* component = &encoder->coefficients.components[c];
+            const size_t block_idx = (size_t)(encoder->mcu_rows_encoded * v_factors[c] + by) * component->blocks_wide + mx * h_factors[c] + bx;
+            fdct_quantize_block(samples, strides[c], q_reciprocals, component->blocks + block_idx * DCT_BLOCK_SIZE);
+          }
+          else
+          {
+            fdct_quantize_block(samples, strides[c], q_reciprocals, block);
+            jpeg_writer_encode_block(&encoder->writer, c, block);
+          }
+        }
+      }
+    }
+  }
+
+  ++encoder->mcu_rows_encoded;
+}
+
+bool jpeg_encoder_write_rows(jpeg_encoder_t* encoder, const unsigned char* pixels, ptrdiff_t stride, unsigned row_count)
+{
+  if (encoder->rows_written + row_count > encoder->height)
+    return false;
+
+  const unsigned mcu_h = encoder->v_max * 8u;
+  for (unsigned r = 0; r != row_count; ++r, pixels += stride)
+  {
+    const size_t offset = encoder->rows_buffered * encoder->sample_stride;
+    if (encoder->num_components == 1)
+      color_packed_to_ycbcr_row(pixels, encoder->format, encoder->width, encoder->sample_rows[0] + offset, NULL, NULL);
+    else
+      color_packed_to_ycbcr_row(pixels, encoder->format, encoder->width, encoder->sample_rows[0] + offset,
+                                encoder->sample_rows[1] + offset, encoder->sample_rows[2] + offset);
+
+    // Repeat the last column into the padding, a hard edge to black costs bits and rings into the image.
+    for (unsigned char c = 0; c != encoder->num_components; ++c)
+    {
+      unsigned char* row = encoder->sample_rows[c] + offset;
+      memset(row + encoder->width, row[encoder->width - 1], encoder->sample_stride - encoder->width);
+    }
+
+    ++encoder->rows_written;
+    if (++encoder->rows_buffered == mcu_h)
+    {
+      encode_mcu_row(encoder);
+      encoder->rows_buffered = 0;
+    }
+  }
+
+  return true;
+}
+
+unsigned char* jpeg_encoder_finish(jpeg_encoder_t* encoder, size_t* out_len)
+{
+  if (encoder->rows_written != encoder->height)
+  {
+    jpeg_encoder_cleanup(encoder);
+    return NULL;
+  }
+
+  // Same for the rows past the bottom edge.
+  if (encoder->rows_buffered != 0)
+  {
+    for (unsigned char c = 0; c != encoder->num_components; ++c)
+    {
+      const unsigned char* last = encoder->sample_rows[c] + (encoder->rows_buffered - 1) * encoder->sample_stride;
+      for (unsigned r = encoder->rows_buffered; r != encoder->v_max * 8u; ++r)
+        memcpy(encoder->sample_rows[c] + r * encoder->sample_stride, last, encoder->sample_stride);
+    }
+
+    encode_mcu_row(encoder);
+    encoder->rows_buffered = 0;
+  }
+
+  unsigned char* buf = NULL;
+  if (encoder->params.optimize_huffman)
+  {
+    if (!jpeg_write_coefficients(&encoder->coefficients, true, &buf, out_len))
+      buf = NULL;
+  }
+  else
+  {
+    buf = jpeg_writer_finish(&encoder->writer, out_len);
+  }
+
+  jpeg_encoder_cleanup(encoder);
+  return buf;
+}
+
+bool jpeg_encode(const unsigned char* pixels, ptrdiff_t stride, unsigned short width, unsigned short height,
+                 jpeg_pixel_format_t format, const jpeg_encode_params_t* params, unsigned char** out_buf, size_t* out_len)
+{
+  if (pixels == NULL || out_buf == NULL || out_len == NULL)
+    return false;
+
+  jpeg_encoder_t encoder;
+  if (!jpeg_encoder_init(&encoder, width, height, format, params))
+    return false;
+
+  if (!jpeg_encoder_write_rows(&encoder, pixels, stride, height))
+  {
+    jpeg_encoder_cleanup(&encoder);
+    return false;
+  }
+
+  *out_buf = jpeg_encoder_finish(&encoder, out_len);
+  return *out_buf != NULL;
+}
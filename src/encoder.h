@@ -0,0 +1,95 @@
+/*--------------------------------------------------------------------------/
+File:   encoder.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include "decoder.h"
+#include "jpeg_writer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum _jpeg_subsampling
+{
+  JSS_444, // Chroma at full resolution
+  JSS_422, // Chroma at half width
+  JSS_420, // Chroma at half width and height
+  JSS_COUNT
+} jpeg_subsampling_t;
+
+typedef struct _jpeg_encode_params
+{
+  // 1-100, scales the example tables from K.1 the same way libjpeg does.
+  unsigned char quality;
+
+  // Ignored for greyscale input.
+  jpeg_subsampling_t subsampling;
+
+  // Build Huffman tables for this image instead of using the standard ones. Costs a second pass,
+  // and every quantized block is held until jpeg_encoder_finish.
+  bool optimize_huffman;
+} jpeg_encode_params_t;
+
+// Quality 75, 4:2:0, standard tables.
+void jpeg_encode_params_default(jpeg_encode_params_t* params);
+
+// The K.1 example table for luma or chroma, scaled for quality. Natural order, like decode_context_t.
+void jpeg_quant_table_for_quality(bool chroma, unsigned char quality, unsigned short* out_table);
+
+/*
+----------------
+Encoder:
+----------------
+Baseline encoder fed from the top down, any number of rows at a time. Only one MCU row of
+samples is buffered: once it fills it's color converted, downsampled, transformed and coded.
+*/
+typedef struct _jpeg_encoder
+{
+  jpeg_writer_t writer;
+  jpeg_encode_params_t params;
+  jpeg_pixel_format_t format;
+
+  unsigned short width;
+  unsigned short height;
+  unsigned char num_components;
+  unsigned char h_max;
+  unsigned char v_max;
+  unsigned x_mcus;
+
+  // Reciprocals of the luma and chroma tables, for the FDCT to multiply by.
+  float q_reciprocals[HUFF_TABLES_PER_CHANNEL_TYPE][QUANT_TABLE_SIZE];
+
+  // One MCU row per component at full resolution, padded out to whole MCUs, then its downsampled copy.
+  unsigned char* sample_rows[MAX_COMPONENTS];
+  unsigned char* downsampled_rows[MAX_COMPONENTS];
+  size_t sample_stride;
+
+  unsigned rows_buffered;
+  unsigned rows_written;
+  unsigned mcu_rows_encoded;
+
+  // optimize_huffman only: every block, coded once the whole image is in.
+  jpeg_coefficients_t coefficients;
+} jpeg_encoder_t;
+
+// Input can be greyscale or any of the packed RGB formats. Returns false on anything else, or if allocating fails.
+bool jpeg_encoder_init(jpeg_encoder_t* encoder, unsigned short width, unsigned short height,
+                       jpeg_pixel_format_t format, const jpeg_encode_params_t* params);
+
+// Adds the next row_count rows of the image. Returns false once more rows come in than the image has.
+bool jpeg_encoder_write_rows(jpeg_encoder_t* encoder, const unsigned char* pixels, ptrdiff_t stride, unsigned row_count);
+
+// Needs every row to have been written. Returns the encoded image, to be freed by the caller, or NULL on failure.
+// The encoder is cleaned up either way.
+unsigned char* jpeg_encoder_finish(jpeg_encoder_t* encoder, size_t* out_len);
+
+// Only needed when an encoder is abandoned before jpeg_encoder_finish.
+void jpeg_encoder_cleanup(jpeg_encoder_t* encoder);
+
+// Encodes a whole image in one call. params can be NULL for the defaults.
+bool jpeg_encode(const unsigned char* pixels, ptrdiff_t stride, unsigned short width, unsigned short height,
+                 jpeg_pixel_format_t format, const jpeg_encode_params_t* params, unsigned char** out_buf, size_t* out_len);
+
+#endif
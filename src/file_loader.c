@@ -0,0 +1,655 @@
+/*--------------------------------------------------------------------------
+File:   file_loader.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+// syscall, pread and MAP_POPULATE are all outside strict C99.
+#define _DEFAULT_SOURCE
+
+#include "file_loader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define FILE_LOADER_IO_URING 1
+#else
+#define FILE_LOADER_IO_URING 0
+#endif
+
+#define DEFAULT_DEPTH 8
+#define MAX_DEPTH 256
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Opens path and allocates a buffer for all of it. Returns 0 or the errno, with *out_fd open on success.
+static int open_for_load(const char* path, int* out_fd, loaded_file_t* file)
+{
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return errno;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    const int error = errno;
+    close(fd);
+    return error;
+  }
+
+  if (!S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return EINVAL;
+  }
+
+  file->size = (size_t)st.st_size;
+  file->data = (unsigned char*)malloc(file->size ? file->size : 1);
+  if (file->data == NULL)
+  {
+    close(fd);
+    return ENOMEM;
+  }
+
+  *out_fd = fd;
+  return 0;
+}
+
+static void fail_load(loaded_file_t* file, int error)
+{
+  free(file->data);
+  file->data = NULL;
+  file->size = 0;
+  file->error = error;
+}
+
+// The whole blocking load, for the thread pool.
+static void read_whole_file(const char* path, loaded_file_t* file)
+{
+  int fd;
+  file->data = NULL;
+  file->error = open_for_load(path, &fd, file);
+  if (file->error != 0)
+  {
+    file->size = 0;
+    return;
+  }
+
+  size_t done = 0;
+  while (done < file->size)
+  {
+    const ssize_t got = pread(fd, file->data + done, file->size - done, (off_t)done);
+    if (got < 0 && errno == EINTR)
+      continue;
+
+    if (got < 0)
+    {
+      fail_load(file, errno);
+      break;
+    }
+
+    // The file shrank since the stat. Whatever was there is the file.
+    if (got == 0)
+      file->size = done;
+
+    done += (size_t)got;
+  }
+
+  close(fd);
+}
+
+#if FILE_LOADER_IO_URING
+// The rings as mapped from the kernel, see io_uring_setup(2).
+typedef struct _uring
+{
+  int fd;
+
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned* sq_array;
+
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+} uring_t;
+
+// One file being read.
+typedef struct _load_slot
+{
+  bool busy;
+  bool reading;
+  bool done;
+
+  int fd;
+  loaded_file_t file;
+  size_t read;
+
+  // Has to stay put until the read using it completes.
+  struct iovec iov;
+} load_slot_t;
+#endif
+
+struct _file_loader
+{
+  const char* const* paths;
+  size_t count;
+  unsigned depth;
+  file_loader_backend_t backend;
+
+  // Next file to start reading, and how many were handed out so far.
+  size_t next_path;
+  size_t handed_out;
+  double wait_seconds;
+
+#if FILE_LOADER_IO_URING
+  uring_t ring;
+  load_slot_t* slots;
+  unsigned unsubmitted;
+
+  // Set once entering the ring failed. Whatever it still had in flight is abandoned, see uring_abandon.
+  bool ring_broken;
+#endif
+
+  // Thread pool. Loaded files queue up in a ring of depth entries, in_flight counts the ones still being read.
+  pthread_t* threads;
+  unsigned thread_count;
+  pthread_mutex_t lock;
+  pthread_cond_t file_ready;
+  pthread_cond_t slot_free;
+  loaded_file_t* queue;
+  size_t queue_head;
+  size_t queue_len;
+  unsigned in_flight;
+  bool stopping;
+};
+
+#if FILE_LOADER_IO_URING
+static void uring_cleanup(uring_t* ring)
+{
+  if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  if (ring->fd >= 0)
+    close(ring->fd);
+
+  memset(ring, 0, sizeof(uring_t));
+  ring->fd = -1;
+}
+
+static bool uring_init(uring_t* ring, unsigned entries)
+{
+  memset(ring, 0, sizeof(uring_t));
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0)
+    return false;
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  // Newer kernels map both rings in one go.
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap && ring->cq_ring_size > ring->sq_ring_size)
+    ring->sq_ring_size = ring->cq_ring_size;
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ring = single_mmap ? ring->sq_ring :
+                  mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+  {
+    uring_cleanup(ring);
+    return false;
+  }
+
+  unsigned char* sq = (unsigned char*)ring->sq_ring;
+  ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+  unsigned char* cq = (unsigned char*)ring->cq_ring;
+  ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+  return true;
+}
+
+// Queues a read of whatever's left of the slot's file. Goes to the kernel with the next uring_enter.
+static void slot_queue_read(file_loader_t* loader, unsigned slot_index)
+{
+  uring_t* ring = &loader->ring;
+  load_slot_t* slot = &loader->slots[slot_index];
+
+  slot->iov.iov_base = slot->file.data + slot->read;
+  slot->iov.iov_len = slot->file.size - slot->read;
+
+  // The kernel only reads the tail once it's entered, and there are never more reads than entries.
+  const unsigned tail = *ring->sq_tail;
+  const unsigned index = tail & ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = slot->fd;
+  sqe->addr = (uint64_t)(uintptr_t)&slot->iov;
+  sqe->len = 1;
+  sqe->off = slot->read;
+  sqe->user_data = slot_index;
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  slot->reading = true;
+  ++loader->unsubmitted;
+}
+
+static void slot_finish(load_slot_t* slot, int error)
+{
+  if (error != 0)
+    fail_load(&slot->file, error);
+
+  close(slot->fd);
+  slot->fd = -1;
+  slot->reading = false;
+  slot->done = true;
+}
+
+// Submits what's queued and, with wait set, blocks until at least one read completes. Returns false if the ring broke.
+static bool uring_enter(file_loader_t* loader, bool wait)
+{
+  for (;;)
+  {
+    const long submitted = syscall(__NR_io_uring_enter, loader->ring.fd, loader->unsubmitted, wait ? 1 : 0,
+                                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted >= 0)
+    {
+      loader->unsubmitted -= (unsigned)submitted;
+      return true;
+    }
+
+    if (errno != EINTR && errno != EAGAIN)
+      return false;
+  }
+}
+
+// Moves every completed read on: finished files are marked done, short reads go back in for the rest.
+static void uring_reap(file_loader_t* loader)
+{
+  uring_t* ring = &loader->ring;
+  unsigned head = *ring->cq_head;
+  const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; ++head)
+  {
+    const struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+    const unsigned slot_index = (unsigned)cqe->user_data;
+    load_slot_t* slot = &loader->slots[slot_index];
+    slot->reading = false;
+
+    if (cqe->res == -EINTR || cqe->res == -EAGAIN)
+    {
+      slot_queue_read(loader, slot_index);
+    }
+    else if (cqe->res < 0)
+    {
+      slot_finish(slot, -cqe->res);
+    }
+    else if (cqe->res == 0)
+    {
+      // The file shrank since the stat.
+      slot->file.size = slot->read;
+      slot_finish(slot, 0);
+    }
+    else
+    {
+      slot->read += (size_t)cqe->res;
+      if (slot->read == slot->file.size)
+        slot_finish(slot, 0);
+      else
+        slot_queue_read(loader, slot_index);
+    }
+  }
+
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Starts reading the next files into every free slot. The open itself is synchronous.
+static void uring_fill_slots(file_loader_t* loader)
+{
+  for (unsigned s = 0; s != loader->depth && loader->next_path != loader->count; ++s)
+  {
+    load_slot_t* slot = &loader->slots[s];
+    if (slot->busy)
+      continue;
+
+    memset(slot, 0, sizeof(load_slot_t));
+    slot->busy = true;
+    slot->fd = -1;
+    slot->file.index = loader->next_path;
+
+    const int error = open_for_load(loader->paths[loader->next_path++], &slot->fd, &slot->file);
+    if (error != 0)
+    {
+      slot->file.error = error;
+      slot->done = true;
+    }
+    else if (slot->file.size == 0)
+    {
+      slot_finish(slot, 0);
+    }
+    else
+    {
+      slot_queue_read(loader, s);
+    }
+  }
+}
+
+// The ring can't be entered any more, so fails whatever hasn't completed. Reads already handed to the kernel may
+// still land, so their buffers, and the iovecs in the slots, are leaked rather than freed under them.
+static void uring_abandon(file_loader_t* loader)
+{
+  uring_reap(loader);
+  loader->ring_broken = true;
+
+  for (unsigned s = 0; s != loader->depth; ++s)
+  {
+    load_slot_t* slot = &loader->slots[s];
+    if (!slot->busy || slot->done)
+      continue;
+
+    if (slot->reading)
+      slot->file.data = NULL;
+    slot_finish(slot, EIO);
+  }
+  loader->unsubmitted = 0;
+}
+
+static bool uring_next(file_loader_t* loader, loaded_file_t* out_file)
+{
+  for (;;)
+  {
+    if (!loader->ring_broken)
+      uring_fill_slots(loader);
+
+    for (unsigned s = 0; s != loader->depth; ++s)
+    {
+      load_slot_t* slot = &loader->slots[s];
+      if (slot->busy && slot->done)
+      {
+        *out_file = slot->file;
+        slot->busy = false;
+        return true;
+      }
+    }
+
+    // Without a ring the rest are read the blocking way, one at a time.
+    if (loader->ring_broken)
+    {
+      if (loader->next_path == loader->count)
+        return false;
+
+      memset(out_file, 0, sizeof(loaded_file_t));
+      out_file->index = loader->next_path;
+      read_whole_file(loader->paths[loader->next_path++], out_file);
+      return true;
+    }
+
+    const double start = now_seconds();
+    const bool entered = uring_enter(loader, true);
+    loader->wait_seconds += now_seconds() - start;
+
+    if (!entered)
+    {
+      uring_abandon(loader);
+      continue;
+    }
+
+    uring_reap(loader);
+  }
+}
+
+static void uring_destroy(file_loader_t* loader)
+{
+  // The kernel may still be writing into the buffers, so every read has to complete before they go.
+  bool reading = true;
+  while (reading && loader->ring.fd >= 0 && !loader->ring_broken)
+  {
+    reading = false;
+    for (unsigned s = 0; s != loader->depth; ++s)
+      reading |= loader->slots[s].busy && loader->slots[s].reading;
+
+    if (reading && !uring_enter(loader, true))
+      uring_abandon(loader);
+
+    uring_reap(loader);
+  }
+
+  uring_cleanup(&loader->ring);
+
+  for (unsigned s = 0; s != loader->depth; ++s)
+  {
+    load_slot_t* slot = &loader->slots[s];
+    if (!slot->busy)
+      continue;
+
+    if (slot->fd >= 0)
+      close(slot->fd);
+    free(slot->file.data);
+  }
+
+  // Reads abandoned on a broken ring may still use their slot's iovec.
+  if (!loader->ring_broken)
+    free(loader->slots);
+}
+#endif
+
+static void* loader_thread(void* arg)
+{
+  file_loader_t* loader = (file_loader_t*)arg;
+
+  pthread_mutex_lock(&loader->lock);
+  for (;;)
+  {
+    // Only start another file once there's room for it, so at most depth files are ever held.
+    while (!loader->stopping && loader->next_path != loader->count && loader->in_flight + loader->queue_len >= loader->depth)
+      pthread_cond_wait(&loader->slot_free, &loader->lock);
+
+    if (loader->stopping || loader->next_path == loader->count)
+      break;
+
+    loaded_file_t file;
+    file.index = loader->next_path++;
+    ++loader->in_flight;
+    pthread_mutex_unlock(&loader->lock);
+
+    read_whole_file(loader->paths[file.index], &file);
+
+    pthread_mutex_lock(&loader->lock);
+    loader->queue[(loader->queue_head + loader->queue_len) % loader->depth] = file;
+    ++loader->queue_len;
+    --loader->in_flight;
+    pthread_cond_signal(&loader->file_ready);
+  }
+  pthread_mutex_unlock(&loader->lock);
+
+  return NULL;
+}
+
+static bool threads_start(file_loader_t* loader)
+{
+  loader->queue = (loaded_file_t*)malloc(sizeof(loaded_file_t) * loader->depth);
+  loader->thread_count = loader->count < loader->depth ? (unsigned)loader->count : loader->depth;
+  loader->threads = (pthread_t*)malloc(sizeof(pthread_t) * (loader->thread_count ? loader->thread_count : 1));
+  if (loader->queue == NULL || loader->threads == NULL)
+    return false;
+
+  pthread_mutex_init(&loader->lock, NULL);
+  pthread_cond_init(&loader->file_ready, NULL);
+  pthread_cond_init(&loader->slot_free, NULL);
+
+  for (unsigned t = 0; t != loader->thread_count; ++t)
+  {
+    if (pthread_create(&loader->threads[t], NULL, loader_thread, loader) != 0)
+    {
+      // The ones that did start can do all the work between them.
+      loader->thread_count = t;
+      break;
+    }
+  }
+
+  return loader->thread_count != 0 || loader->count == 0;
+}
+
+static bool threads_next(file_loader_t* loader, loaded_file_t* out_file)
+{
+  pthread_mutex_lock(&loader->lock);
+
+  const double start = now_seconds();
+  while (loader->queue_len == 0)
+    pthread_cond_wait(&loader->file_ready, &loader->lock);
+  loader->wait_seconds += now_seconds() - start;
+
+  *out_file = loader->queue[loader->queue_head];
+  loader->queue_head = (loader->queue_head + 1) % loader->depth;
+  --loader->queue_len;
+
+  pthread_cond_signal(&loader->slot_free);
+  pthread_mutex_unlock(&loader->lock);
+  return true;
+}
+
+static void threads_destroy(file_loader_t* loader)
+{
+  if (loader->threads != NULL && loader->queue != NULL)
+  {
+    pthread_mutex_lock(&loader->lock);
+    loader->stopping = true;
+    pthread_cond_broadcast(&loader->slot_free);
+    pthread_mutex_unlock(&loader->lock);
+
+    for (unsigned t = 0; t != loader->thread_count; ++t)
+      pthread_join(loader->threads[t], NULL);
+
+    for (size_t i = 0; i != loader->queue_len; ++i)
+      free(loader->queue[(loader->queue_head + i) % loader->depth].data);
+
+    pthread_cond_destroy(&loader->slot_free);
+    pthread_cond_destroy(&loader->file_ready);
+    pthread_mutex_destroy(&loader->lock);
+  }
+
+  free(loader->threads);
+  free(loader->queue);
+}
+
+file_loader_t* file_loader_create(const char* const* paths, size_t count, unsigned depth, file_loader_backend_t backend)
+{
+  file_loader_t* loader = (file_loader_t*)calloc(1, sizeof(file_loader_t));
+  if (loader == NULL)
+    return NULL;
+
+  loader->paths = paths;
+  loader->count = count;
+  loader->depth = depth == 0 ? DEFAULT_DEPTH : (depth > MAX_DEPTH ? MAX_DEPTH : depth);
+
+#if FILE_LOADER_IO_URING
+  loader->ring.fd = -1;
+  if (backend != FLB_THREADS)
+  {
+    loader->slots = (load_slot_t*)calloc(loader->depth, sizeof(load_slot_t));
+    if (loader->slots != NULL && uring_init(&loader->ring, loader->depth))
+    {
+      loader->backend = FLB_IO_URING;
+      return loader;
+    }
+
+    free(loader->slots);
+    loader->slots = NULL;
+  }
+#endif
+
+  if (backend == FLB_IO_URING)
+  {
+    free(loader);
+    return NULL;
+  }
+
+  loader->backend = FLB_THREADS;
+  if (!threads_start(loader))
+  {
+    file_loader_destroy(loader);
+    return NULL;
+  }
+
+  return loader;
+}
+
+const char* file_loader_backend_name(const file_loader_t* loader)
+{
+  return loader->backend == FLB_IO_URING ? "io_uring" : "threads";
+}
+
+bool file_loader_next(file_loader_t* loader, loaded_file_t* out_file)
+{
+  if (loader->handed_out == loader->count)
+    return false;
+
+  ++loader->handed_out;
+
+#if FILE_LOADER_IO_URING
+  if (loader->backend == FLB_IO_URING)
+    return uring_next(loader, out_file);
+#endif
+
+  return threads_next(loader, out_file);
+}
+
+double file_loader_wait_seconds(const file_loader_t* loader)
+{
+  return loader->wait_seconds;
+}
+
+void file_loader_destroy(file_loader_t* loader)
+{
+  if (loader == NULL)
+    return;
+
+#if FILE_LOADER_IO_URING
+  if (loader->backend == FLB_IO_URING)
+    uring_destroy(loader);
+  else
+#endif
+    threads_destroy(loader);
+
+  free(loader);
+}
@@ -0,0 +1,59 @@
+/*--------------------------------------------------------------------------/
+File:   file_loader.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef FILE_LOADER_H
+#define FILE_LOADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+----------------
+Batched File Loading:
+----------------
+Reads a list of files ahead of whoever is decoding them. Up to depth files are kept in flight or
+loaded and waiting, so while one image decodes the next ones are already being read and a
+cold cache never stalls the decoder once the pipeline is full.
+
+On Linux the reads go through io_uring, with the ring set up directly over the syscalls. Where
+that's unavailable (old kernels, seccomp filters, other platforms) a pool of threads does the same
+with blocking preads. Files come back in the order their reads finish, not the order they were given.
+*/
+typedef struct _file_loader file_loader_t;
+
+typedef enum _file_loader_backend
+{
+  FLB_AUTO,     // io_uring if the kernel allows it, threads otherwise
+  FLB_IO_URING,
+  FLB_THREADS
+} file_loader_backend_t;
+
+typedef struct _loaded_file
+{
+  // Position of the file in the list the loader was given.
+  size_t index;
+
+  // The whole file, freed by the caller. NULL if it couldn't be read, with error holding the errno.
+  unsigned char* data;
+  size_t size;
+  int error;
+} loaded_file_t;
+
+// Starts loading the count files in paths, which have to outlive the loader. depth of 0 picks a default.
+// Asking for io_uring where it's unavailable fails. Returns NULL on failure.
+file_loader_t* file_loader_create(const char* const* paths, size_t count, unsigned depth, file_loader_backend_t backend);
+
+// Which backend the loader ended up with, for reports.
+const char* file_loader_backend_name(const file_loader_t* loader);
+
+// Waits for the next file to finish loading. Returns false once every file has been handed out.
+bool file_loader_next(file_loader_t* loader, loaded_file_t* out_file);
+
+// Seconds file_loader_next spent waiting on reads, the part of I/O decoding didn't hide.
+double file_loader_wait_seconds(const file_loader_t* loader);
+
+// Stops any reads still running and frees everything that wasn't handed out.
+void file_loader_destroy(file_loader_t* loader);
+
+#endif
@@ -5,22 +5,24 @@ Author: kaiyen
 ---------------------------------------------------------------------------*/
 #include "huffman.h"
 
-#include "utils.h"
+#include "log.h"
+#include "mem_budget.h"
+#include "profile.h"
 
-#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define ENABLE_HT_LOG 0
 
 #if ENABLE_HT_LOG
-#define HT_LOG(...) printf(__VA_ARGS__)
+#define HT_LOG(...) LOG_TRACE(__VA_ARGS__)
 #else
 #define HT_LOG(...)
 #endif
 
 static void alloc_and_init_huff_node(huff_node_t** root, unsigned char val)
 {
-  *root = (huff_node_t*)malloc(sizeof(huff_node_t));
+  *root = (huff_node_t*)mem_malloc(sizeof(huff_node_t));
   huff_node_init(*root, val);
 }
 
@@ -105,34 +107,40 @@ unsigned char huff_table_lookup(huff_node_t* root, const unsigned code, const un
 }
 #endif
 
-unsigned char huff_table_lookup(const huff_node_t* root, const unsigned char* const block, unsigned* offset)
+bool huff_table_lookup(const huff_node_t* root, bit_reader_t* reader, unsigned char* out_val)
 {
   if (root == NULL)
+    return false;
+
+  // Codes are at most 16 bits, so a single refill covers the whole walk.
+  if (reader->bit_count < 16)
+    bit_reader_refill(reader);
+
+  const huff_node_t* node = root;
+  unsigned code_len = 0;
+  while (node != NULL && (node->left != NULL || node->right != NULL))
   {
-    printf("FOUND NULL. offset: %d\n", *offset);
-    return 0x0;
+    const unsigned bit = bit_reader_peek(reader, 1);
+    bit_reader_consume(reader, 1);
+    ++code_len;
+
+    HT_LOG("Going %s. code_len:%d\n", bit ? "Right" : "Left", code_len);
+    node = bit ? node->right : node->left;
   }
 
-  // Success case
-  if (root && root->left == NULL && root->right == NULL)
+  // Either the code isn't in the table, or the table is empty.
+  if (node == NULL || node == root)
   {
-    printf("SUCCESS: val:0x%X, offset: %d\n", root->val, *offset);
-    return root->val;
+    LOG_TRACE("FOUND NULL. code_len: %d", code_len);
+    return false;
   }
 
-  int bit = read_stream(block, *offset, 1, 0);
-  (*offset)++;
+  HT_LOG("SUCCESS: val:0x%X, code_len: %d\n", node->val, code_len);
+  PROFILE_COUNT(PC_SYMBOLS, 1);
+  PROFILE_COUNT(PC_CODE_BITS, code_len);
 
-  if (bit == 0)
-  {
-    printf("Going Left. offset:%d\n", *offset);
-    return huff_table_lookup(root->left, block, offset);
-  }
-  else
-  {
-    printf("Going Right. offset:%d\n", *offset);
-    return huff_table_lookup(root->right, block, offset);
-  }
+  *out_val = node->val;
+  return true;
 }
 
 void huff_table_cleanup(huff_node_t* root)
@@ -147,5 +155,232 @@ void huff_table_cleanup(huff_node_t* root)
 
   root->left = root->right = NULL;
 
-  free(root);
+  mem_free(root);
+}
+
+void huff_table_build_fast(huff_table_t* table, const unsigned char* counts, const unsigned char* symbols, bool ac)
+{
+  memset(table->fast, 0, sizeof(table->fast));
+
+  // Canonical codes, the same ones the tree was built with. See C.2 in the spec.
+  unsigned code = 0, symbol_idx = 0;
+  for (unsigned code_len = 1; code_len <= HUFF_FAST_BITS; ++code_len, code <<= 1)
+  {
+    for (unsigned k = 0; k != counts[code_len - 1]; ++k, ++code)
+    {
+      const unsigned char symbol = symbols[symbol_idx++];
+
+      // Over-subscribed tables run out of codes. The tree turned those down too.
+      if (code >= (1u << code_len))
+        continue;
+
+      // DC symbols past 15 aren't valid, leave them for the decoder to turn down.
+      const unsigned value_bits = symbol & 0x0F;
+      const bool fused = (ac || symbol < 16) && code_len + value_bits <= HUFF_FAST_BITS;
+      const unsigned entry_bits = fused ? code_len + value_bits : code_len;
+      const unsigned fill = 1u << (HUFF_FAST_BITS - entry_bits);
+
+      // One run of entries per possible value. Without a value that's just the one run for the code.
+      for (unsigned value = 0; value != (fused ? 1u << value_bits : 1u); ++value)
+      {
+        huff_fast_entry_t entry;
+        entry.symbol = symbol;
+        entry.length = (unsigned char)(fused ? entry_bits | HUFF_FAST_VALUE : entry_bits);
+        entry.value = (int16_t)(fused ? dc_ac_value_decode((int)value, value_bits) : 0);
+
+        huff_fast_entry_t* it = table->fast + (((code << value_bits * fused) | value) << (HUFF_FAST_BITS - entry_bits));
+        for (unsigned f = 0; f != fill; ++f)
+          it[f] = entry;
+      }
+    }
+  }
+}
+
+void huff_table_free(huff_table_t* table)
+{
+  if (table == NULL)
+    return;
+
+  huff_table_cleanup(table->tree);
+  mem_free(table);
+}
+
+static const huff_spec_t STANDARD_DC_LUMA =
+{
+  { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 }
+};
+
+static const huff_spec_t STANDARD_DC_CHROMA =
+{
+  { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 }
+};
+
+static const huff_spec_t STANDARD_AC_LUMA =
+{
+  { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+  {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+  }
+};
+
+static const huff_spec_t STANDARD_AC_CHROMA =
+{
+  { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+  {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+  }
+};
+
+const huff_spec_t* huff_spec_standard_dc(bool chroma)
+{
+  return chroma ? &STANDARD_DC_CHROMA : &STANDARD_DC_LUMA;
+}
+
+const huff_spec_t* huff_spec_standard_ac(bool chroma)
+{
+  return chroma ? &STANDARD_AC_CHROMA : &STANDARD_AC_LUMA;
+}
+
+unsigned huff_spec_symbol_count(const huff_spec_t* spec)
+{
+  unsigned count = 0;
+  for (unsigned len = 0; len != HUFF_MAX_CODE_LEN; ++len)
+    count += spec->counts[len];
+
+  return count;
+}
+
+void huff_code_table_build(const huff_spec_t* spec, huff_code_table_t* out_table)
+{
+  memset(out_table->lengths, 0, sizeof(out_table->lengths));
+
+  // Codes of the same length count up, moving to the next length appends a zero.
+  unsigned code = 0, symbol_idx = 0;
+  for (unsigned len = 1; len <= HUFF_MAX_CODE_LEN; ++len, code <<= 1)
+  {
+    for (unsigned i = 0; i != spec->counts[len - 1] && symbol_idx != HUFF_MAX_SYMBOLS; ++i, ++code, ++symbol_idx)
+    {
+      const unsigned char symbol = spec->symbols[symbol_idx];
+      out_table->codes[symbol] = (unsigned short)code;
+      out_table->lengths[symbol] = (unsigned char)len;
+    }
+  }
+}
+
+void huff_spec_build_optimal(const unsigned long* frequencies, huff_spec_t* out_spec)
+{
+  // One extra symbol with a count of 1 reserves the all ones code, which a JPEG table can't use.
+  unsigned long freq[HUFF_MAX_SYMBOLS + 1];
+  unsigned char code_size[HUFF_MAX_SYMBOLS + 1] = {0};
+  int others[HUFF_MAX_SYMBOLS + 1];
+
+  memcpy(freq, frequencies, sizeof(unsigned long) * HUFF_MAX_SYMBOLS);
+  freq[HUFF_MAX_SYMBOLS] = 1;
+  for (int i = 0; i != HUFF_MAX_SYMBOLS + 1; ++i)
+    others[i] = -1;
+
+  // Merge the two least frequent trees until one is left. Ties go to the higher symbol, same as K.2.
+  for (;;)
+  {
+    int c1 = -1, c2 = -1;
+    for (int i = 0; i != HUFF_MAX_SYMBOLS + 1; ++i)
+    {
+      if (freq[i] != 0 && (c1 < 0 || freq[i] <= freq[c1]))
+        c1 = i;
+    }
+    for (int i = 0; i != HUFF_MAX_SYMBOLS + 1; ++i)
+    {
+      if (freq[i] != 0 && i != c1 && (c2 < 0 || freq[i] <= freq[c2]))
+        c2 = i;
+    }
+
+    if (c2 < 0)
+      break;
+
+    freq[c1] += freq[c2];
+    freq[c2] = 0;
+
+    // Everything in both trees moves down a level, then c2's chain hangs off the end of c1's.
+    ++code_size[c1];
+    while (others[c1] >= 0)
+    {
+      c1 = others[c1];
+      ++code_size[c1];
+    }
+    others[c1] = c2;
+
+    ++code_size[c2];
+    while (others[c2] >= 0)
+    {
+      c2 = others[c2];
+      ++code_size[c2];
+    }
+  }
+
+  // Trees this unbalanced can't happen with 257 symbols past 32 levels.
+  unsigned char bits[33] = {0};
+  for (int i = 0; i != HUFF_MAX_SYMBOLS + 1; ++i)
+  {
+    if (code_size[i] != 0)
+      ++bits[code_size[i] > 32 ? 32 : code_size[i]];
+  }
+
+  // Pull codes longer than 16 bits up, see K.3 in the spec.
+  for (int i = 32; i > HUFF_MAX_CODE_LEN; --i)
+  {
+    while (bits[i] > 0)
+    {
+      int j = i - 2;
+      while (bits[j] == 0)
+        --j;
+
+      bits[i] -= 2;
+      ++bits[i - 1];
+      bits[j + 1] += 2;
+      --bits[j];
+    }
+  }
+
+  // Drop the reserved code, it's always one of the longest.
+  int longest = HUFF_MAX_CODE_LEN;
+  while (longest > 0 && bits[longest] == 0)
+    --longest;
+  if (longest > 0)
+    --bits[longest];
+
+  memset(out_spec, 0, sizeof(huff_spec_t));
+  memcpy(out_spec->counts, bits + 1, HUFF_MAX_CODE_LEN);
+
+  // Symbols in order of code length, then value. The reserved symbol never gets listed.
+  unsigned symbol_idx = 0;
+  for (unsigned char len = 1; len <= 32; ++len)
+  {
+    for (int i = 0; i != HUFF_MAX_SYMBOLS; ++i)
+    {
+      if (code_size[i] == len)
+        out_spec->symbols[symbol_idx++] = (unsigned char)i;
+    }
+  }
 }
@@ -6,7 +6,12 @@ Author: kaiyen
 #ifndef HUFFMAN_H
 #define HUFFMAN_H
 
+#include "bitstream.h"
+#include "profile.h"
+#include "utils.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct _huff_node huff_node_t;
 
@@ -26,10 +31,124 @@ bool huff_table_insert(huff_node_t** root, const unsigned char code_len, unsigne
 unsigned char huff_table_lookup(huff_node_t* root, const unsigned code, const unsigned code_len, const unsigned cur_shift);
 #endif
 
-unsigned char huff_table_lookup(const huff_node_t* root, const unsigned char* const block, unsigned* offset);
+// Walks the tree one bit at a time to decode the next symbol. Returns false on a code that isn't in the table.
+bool huff_table_lookup(const huff_node_t* root, bit_reader_t* reader, unsigned char* out_val);
 
 void huff_table_cleanup(huff_node_t* root);
 
 static const unsigned char INTERMEDIATE_NODE_VAL = 0xcd;
 
+/*
+----------------
+Fast Decoding:
+----------------
+Every code of up to HUFF_FAST_BITS bits gets looked up directly from the next HUFF_FAST_BITS of the
+stream. Where the value bits that follow a code fit in the same peek, the entry holds the decoded
+value too, so a whole coefficient comes out of one probe and one consume. Longer codes fall back to
+the tree.
+*/
+#define HUFF_FAST_BITS 9
+
+// Set in a fast entry's length when it covers the value bits as well as the code.
+#define HUFF_FAST_VALUE 0x80
+
+typedef struct _huff_fast_entry
+{
+  // Only set with HUFF_FAST_VALUE.
+  int16_t value;
+
+  unsigned char symbol;
+
+  // Bits to consume, with HUFF_FAST_VALUE or'd in. 0 means the code is longer than the peek, or not in the table.
+  unsigned char length;
+} huff_fast_entry_t;
+
+typedef struct _huff_table
+{
+  huff_fast_entry_t fast[1 << HUFF_FAST_BITS];
+  huff_node_t* tree;
+} huff_table_t;
+
+// Fills in table->fast from the DHT layout the tree was built from. DC symbols are the value's bit
+// length, AC symbols carry it in their low nibble, ac says which.
+void huff_table_build_fast(huff_table_t* table, const unsigned char* counts, const unsigned char* symbols, bool ac);
+
+// Frees the table and its tree.
+void huff_table_free(huff_table_t* table);
+
+// Decodes the next symbol and the value bits that follow it, as many as the symbol's low nibble says.
+// Returns false on a code that isn't in the table.
+static inline bool huff_table_decode(const huff_table_t* table, bit_reader_t* reader, unsigned char* out_symbol, int* out_value)
+{
+  if (reader->bit_count < HUFF_FAST_BITS)
+    bit_reader_refill(reader);
+
+  const huff_fast_entry_t entry = table->fast[bit_reader_peek(reader, HUFF_FAST_BITS)];
+  *out_symbol = entry.symbol;
+
+  if (entry.length & HUFF_FAST_VALUE)
+  {
+    const unsigned length = entry.length & ~HUFF_FAST_VALUE;
+    bit_reader_consume(reader, length);
+    *out_value = entry.value;
+
+    PROFILE_COUNT(PC_SYMBOLS, 1);
+    PROFILE_COUNT(PC_FAST_SYMBOLS, 1);
+    PROFILE_COUNT(PC_CODE_BITS, length - (entry.symbol & 0x0F));
+    return true;
+  }
+
+  if (entry.length != 0)
+  {
+    bit_reader_consume(reader, entry.length);
+    PROFILE_COUNT(PC_SYMBOLS, 1);
+    PROFILE_COUNT(PC_CODE_BITS, entry.length);
+  }
+  else if (!huff_table_lookup(table->tree, reader, out_symbol))
+  {
+    return false;
+  }
+
+  const unsigned bit_count = *out_symbol & 0x0F;
+  *out_value = dc_ac_value_decode((int)bit_reader_read(reader, bit_count), bit_count);
+  return true;
+}
+
+/*
+----------------
+Encoding:
+----------------
+The writer side works from the DHT layout directly: how many codes of each length,
+then the symbols in code order. huff_code_table_build turns that into a code per symbol.
+*/
+#define HUFF_MAX_CODE_LEN 16
+#define HUFF_MAX_SYMBOLS 256
+
+typedef struct _huff_spec
+{
+  unsigned char counts[HUFF_MAX_CODE_LEN];
+  unsigned char symbols[HUFF_MAX_SYMBOLS];
+} huff_spec_t;
+
+// Code per symbol, a length of 0 means the symbol isn't in the table.
+typedef struct _huff_code_table
+{
+  unsigned short codes[HUFF_MAX_SYMBOLS];
+  unsigned char lengths[HUFF_MAX_SYMBOLS];
+} huff_code_table_t;
+
+// Total number of symbols in spec.
+unsigned huff_spec_symbol_count(const huff_spec_t* spec);
+
+// Canonical code assignment, see C.2 in the spec.
+void huff_code_table_build(const huff_spec_t* spec, huff_code_table_t* out_table);
+
+// Builds the code lengths that suit these symbol frequencies best, limited to 16 bits, see K.2 in the spec.
+// frequencies holds one count per symbol. Symbols that never occur get no code.
+void huff_spec_build_optimal(const unsigned long* frequencies, huff_spec_t* out_spec);
+
+// The example tables from K.3 in the spec. Good enough for any 8 bit baseline image.
+const huff_spec_t* huff_spec_standard_dc(bool chroma);
+const huff_spec_t* huff_spec_standard_ac(bool chroma);
+
 #endif
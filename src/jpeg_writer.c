@@ -0,0 +1,418 @@
+/*--------------------------------------------------------------------------
+File:   jpeg_writer.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "jpeg_writer.h"
+
+#include "dct_utils.h"
+#include "log.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Symbols with special meaning in the AC tables.
+#define AC_EOB 0x00
+#define AC_ZRL 0xF0
+
+static void put_marker(jpeg_writer_t* writer, unsigned char marker)
+{
+  const unsigned char bytes[2] = { JFIF_MFF, marker };
+  bit_writer_put_bytes(&writer->bits, bytes, sizeof(bytes));
+}
+
+static void put_short(jpeg_writer_t* writer, unsigned short value)
+{
+  const unsigned char bytes[2] = { (unsigned char)(value >> 8), (unsigned char)value };
+  bit_writer_put_bytes(&writer->bits, bytes, sizeof(bytes));
+}
+
+static void put_byte(jpeg_writer_t* writer, unsigned char value)
+{
+  bit_writer_put_bytes(&writer->bits, &value, 1);
+}
+
+static unsigned char huffman_index(unsigned char component)
+{
+  return component == 0 ? 0 : 1;
+}
+
+bool jpeg_writer_init(jpeg_writer_t* writer, unsigned short width, unsigned short height,
+                      unsigned char num_components, const jfif_component_t* components)
+{
+  memset(writer, 0, sizeof(jpeg_writer_t));
+
+  if (width == 0 || height == 0 || num_components == 0 || num_components > MAX_COMPONENTS)
+    return false;
+
+  writer->width = width;
+  writer->height = height;
+  writer->num_components = num_components;
+  writer->adobe_transform = ADOBE_TRANSFORM_UNKNOWN;
+
+  for (unsigned char c = 0; c != num_components; ++c)
+  {
+    writer->components[c] = components[c];
+    if (components[c].quant_table_id >= MAX_QUANT_TABLES)
+      return false;
+
+    if (num_components == 1)
+      writer->components[c].sample_factor_horiz = writer->components[c].sample_factor_vert = 1;
+  }
+
+  for (unsigned char i = 0; i != HUFF_TABLES_PER_CHANNEL_TYPE; ++i)
+    jpeg_writer_set_huffman_tables(writer, i, huff_spec_standard_dc(i != 0), huff_spec_standard_ac(i != 0));
+
+  // Compressed images rarely come out larger than a byte per pixel.
+  bit_writer_init(&writer->bits, (size_t)width * height / 2 + 1024);
+  return !writer->bits.failed;
+}
+
+void jpeg_writer_set_huffman_tables(jpeg_writer_t* writer, unsigned char index, const huff_spec_t* dc_spec, const huff_spec_t* ac_spec)
+{
+  writer->dc_specs[index] = *dc_spec;
+  writer->ac_specs[index] = *ac_spec;
+  huff_code_table_build(dc_spec, &writer->dc_codes[index]);
+  huff_code_table_build(ac_spec, &writer->ac_codes[index]);
+}
+
+static void write_app_segment(jpeg_writer_t* writer)
+{
+  if (writer->adobe_transform != ADOBE_TRANSFORM_UNKNOWN)
+  {
+    // "Adobe", version 100, two flag words and the transform.
+    static const unsigned char ADOBE[11] = { 'A', 'd', 'o', 'b', 'e', 0, 100, 0, 0, 0, 0 };
+    put_marker(writer, JFIF_A14);
+    put_short(writer, 2 + sizeof(ADOBE) + 1);
+    bit_writer_put_bytes(&writer->bits, ADOBE, sizeof(ADOBE));
+    put_byte(writer, writer->adobe_transform);
+    return;
+  }
+
+  // JFIF 1.01, no density and no thumbnail.
+  static const unsigned char JFIF[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+  put_marker(writer, JFIF_AP0);
+  put_short(writer, 2 + sizeof(JFIF));
+  bit_writer_put_bytes(&writer->bits, JFIF, sizeof(JFIF));
+}
+
+static void write_quant_tables(jpeg_writer_t* writer)
+{
+  bool used[MAX_QUANT_TABLES] = {false};
+  for (unsigned char c = 0; c != writer->num_components; ++c)
+    used[writer->components[c].quant_table_id] = true;
+
+  for (unsigned char id = 0; id != MAX_QUANT_TABLES; ++id)
+  {
+    if (!used[id])
+      continue;
+
+    // 16 bit entries only when 8 bits don't fit.
+    const unsigned short* table = writer->quant_tables[id];
+    bool wide = false;
+    for (unsigned i = 0; i != QUANT_TABLE_SIZE; ++i)
+      wide |= table[i] > 0xFF;
+
+    put_marker(writer, JFIF_DQT);
+    put_short(writer, (unsigned short)(2 + 1 + QUANT_TABLE_SIZE * (wide ? 2 : 1)));
+    put_byte(writer, (unsigned char)((wide ? 0x10 : 0x00) | id));
+
+    for (unsigned char i = 0; i != QUANT_TABLE_SIZE; ++i)
+    {
+      const unsigned short value = table[get_zig_zagged_index(i)];
+      if (wide)
+        put_short(writer, value);
+      else
+        put_byte(writer, (unsigned char)value);
+    }
+  }
+}
+
+static void write_frame_header(jpeg_writer_t* writer)
+{
+  put_marker(writer, JFIF_SOF);
+  put_short(writer, (unsigned short)(2 + 6 + writer->num_components * 3));
+  put_byte(writer, 8);
+  put_short(writer, writer->height);
+  put_short(writer, writer->width);
+  put_byte(writer, writer->num_components);
+
+  for (unsigned char c = 0; c != writer->num_components; ++c)
+  {
+    const jfif_component_t* component = &writer->components[c];
+    put_byte(writer, component->id);
+    put_byte(writer, (unsigned char)(component->sample_factor_horiz << 4 | component->sample_factor_vert));
+    put_byte(writer, component->quant_table_id);
+  }
+}
+
+static void write_huffman_table(jpeg_writer_t* writer, unsigned char table_class, unsigned char id, const huff_spec_t* spec)
+{
+  const unsigned symbol_count = huff_spec_symbol_count(spec);
+
+  put_marker(writer, JFIF_DHT);
+  put_short(writer, (unsigned short)(2 + 1 + HUFF_MAX_CODE_LEN + symbol_count));
+  put_byte(writer, (unsigned char)(table_class << 4 | id));
+  bit_writer_put_bytes(&writer->bits, spec->counts, HUFF_MAX_CODE_LEN);
+  bit_writer_put_bytes(&writer->bits, spec->symbols, symbol_count);
+}
+
+static void write_scan_header(jpeg_writer_t* writer)
+{
+  put_marker(writer, JFIF_SOS);
+  put_short(writer, (unsigned short)(2 + 1 + writer->num_components * 2 + 3));
+  put_byte(writer, writer->num_components);
+
+  for (unsigned char c = 0; c != writer->num_components; ++c)
+  {
+    const unsigned char table = huffman_index(c);
+    put_byte(writer, writer->components[c].id);
+    put_byte(writer, (unsigned char)(table << 4 | table));
+  }
+
+  // Full spectral range, no successive approximation.
+  put_byte(writer, 0);
+  put_byte(writer, DCT_BLOCK_SIZE - 1);
+  put_byte(writer, 0);
+}
+
+void jpeg_writer_write_headers(jpeg_writer_t* writer)
+{
+  put_marker(writer, JFIF_SOI);
+  write_app_segment(writer);
+  write_quant_tables(writer);
+  write_frame_header(writer);
+
+  const unsigned char tables = writer->num_components == 1 ? 1 : HUFF_TABLES_PER_CHANNEL_TYPE;
+  for (unsigned char i = 0; i != tables; ++i)
+  {
+    write_huffman_table(writer, 0, i, &writer->dc_specs[i]);
+    write_huffman_table(writer, 1, i, &writer->ac_specs[i]);
+  }
+
+  write_scan_header(writer);
+}
+
+// Writes the symbol's code, then the low bits of value. Negative values go in as value - 1, see F.1.2.1.
+static inline void put_coded_value(jpeg_writer_t* writer, const huff_code_table_t* table, unsigned char symbol, int value, unsigned bits)
+{
+  if (table->lengths[symbol] == 0)
+  {
+    // Only happens with coefficients an 8 bit image can't have.
+    LOG_ERROR("No Huffman code for symbol 0x%02X.", symbol);
+    writer->bits.failed = true;
+    return;
+  }
+
+  bit_writer_put_bits(&writer->bits, table->codes[symbol], table->lengths[symbol]);
+  if (bits != 0)
+    bit_writer_put_bits(&writer->bits, (unsigned)(value < 0 ? value - 1 : value), bits);
+}
+
+void jpeg_writer_encode_block(jpeg_writer_t* writer, unsigned char component, const int16_t* block)
+{
+  const unsigned char index = huffman_index(component);
+  const huff_code_table_t* dc_table = &writer->dc_codes[index];
+  const huff_code_table_t* ac_table = &writer->ac_codes[index];
+
+  const int diff = block[0] - writer->prev_dc[component];
+  writer->prev_dc[component] = block[0];
+
+  const unsigned dc_bits = jpeg_magnitude_bits(diff);
+  put_coded_value(writer, dc_table, (unsigned char)dc_bits, diff, dc_bits);
+
+  unsigned run = 0;
+  for (unsigned char i = 1; i != DCT_BLOCK_SIZE; ++i)
+  {
+    const int value = block[get_zig_zagged_index(i)];
+    if (value == 0)
+    {
+      ++run;
+      continue;
+    }
+
+    for (; run > 15; run -= 16)
+      put_coded_value(writer, ac_table, AC_ZRL, 0, 0);
+
+    const unsigned ac_bits = jpeg_magnitude_bits(value);
+    put_coded_value(writer, ac_table, (unsigned char)(run << 4 | ac_bits), value, ac_bits);
+    run = 0;
+  }
+
+  if (run != 0)
+    put_coded_value(writer, ac_table, AC_EOB, 0, 0);
+}
+
+void jpeg_writer_count_block(const int16_t* block, int* prev_dc, unsigned long* dc_frequencies, unsigned long* ac_frequencies)
+{
+  const int diff = block[0] - *prev_dc;
+  *prev_dc = block[0];
+  ++dc_frequencies[jpeg_magnitude_bits(diff) & 0xFF];
+
+  unsigned run = 0;
+  for (unsigned char i = 1; i != DCT_BLOCK_SIZE; ++i)
+  {
+    const int value = block[get_zig_zagged_index(i)];
+    if (value == 0)
+    {
+      ++run;
+      continue;
+    }
+
+    for (; run > 15; run -= 16)
+      ++ac_frequencies[AC_ZRL];
+
+    ++ac_frequencies[(run << 4 | jpeg_magnitude_bits(value)) & 0xFF];
+    run = 0;
+  }
+
+  if (run != 0)
+    ++ac_frequencies[AC_EOB];
+}
+
+unsigned char* jpeg_writer_finish(jpeg_writer_t* writer, size_t* out_len)
+{
+  bit_writer_flush(&writer->bits);
+  put_marker(writer, JFIF_EOI);
+  return bit_writer_release(&writer->bits, out_len);
+}
+
+void jpeg_writer_cleanup(jpeg_writer_t* writer)
+{
+  bit_writer_cleanup(&writer->bits);
+}
+
+// Goes over every block in MCU order. Encodes them, or only counts their symbols when frequencies is given.
+static void write_blocks(jpeg_writer_t* writer, const jpeg_coefficients_t* coefficients, unsigned x_mcus, unsigned y_mcus,
+                         unsigned long (*frequencies)[2][HUFF_MAX_SYMBOLS])
+{
+  int prev_dc[MAX_COMPONENTS] = {0};
+
+  for (unsigned my = 0; my != y_mcus && !writer->bits.failed; ++my)
+  {
+    for (unsigned mx = 0; mx != x_mcus; ++mx)
+    {
+      for (unsigned char c = 0; c != writer->num_components; ++c)
+      {
+        const jpeg_component_coefficients_t* component = &coefficients->components[c];
+        const unsigned char h = writer->components[c].sample_factor_horiz, v = writer->components[c].sample_factor_vert;
+
+        for (unsigned char by = 0; by != v; ++by)
+        {
+          for (unsigned char bx = 0; bx != h; ++bx)
+          {
+            const size_t block_idx = (size_t)(my * v + by) * component->blocks_wide + mx * h + bx;
+            const int16_t* block = component->blocks + block_idx * DCT_BLOCK_SIZE;
+
+            if (frequencies != NULL)
+            {
+              unsigned long (*table_frequencies)[HUFF_MAX_SYMBOLS] = frequencies[huffman_index(c)];
+              jpeg_writer_count_block(block, &prev_dc[c], table_frequencies[0], table_frequencies[1]);
+            }
+            else
+            {
+              jpeg_writer_encode_block(writer, c, block);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+bool jpeg_write_coefficients(const jpeg_coefficients_t* coefficients, bool optimize_huffman, unsigned char** out_buf, size_t* out_len)
+{
+  if (coefficients == NULL || out_buf == NULL || out_len == NULL)
+    return false;
+
+  const unsigned char num_components = coefficients->num_components;
+  if (num_components == 0 || num_components > MAX_COMPONENTS)
+    return false;
+
+  // Components with identical tables share one, whatever ids they came with.
+  jfif_component_t components[MAX_COMPONENTS];
+  unsigned char num_tables = 0;
+  for (unsigned char c = 0; c != num_components; ++c)
+  {
+    components[c] = coefficients->components[c].component;
+    components[c].quant_table_id = num_tables;
+
+    for (unsigned char prev = 0; prev != c; ++prev)
+    {
+      if (memcmp(coefficients->components[prev].quant_table, coefficients->components[c].quant_table, sizeof(coefficients->components[c].quant_table)) == 0)
+      {
+        components[c].quant_table_id = components[prev].quant_table_id;
+        break;
+      }
+    }
+
+    if (components[c].quant_table_id == num_tables)
+      ++num_tables;
+  }
+
+  jpeg_writer_t writer;
+  if (!jpeg_writer_init(&writer, coefficients->width, coefficients->height, num_components, components))
+  {
+    jpeg_writer_cleanup(&writer);
+    return false;
+  }
+
+  writer.adobe_transform = coefficients->adobe_transform;
+  for (unsigned char c = 0; c != num_components; ++c)
+    memcpy(writer.quant_tables[components[c].quant_table_id], coefficients->components[c].quant_table, sizeof(writer.quant_tables[0]));
+
+  unsigned char h_max = 1, v_max = 1;
+  for (unsigned char c = 0; c != num_components; ++c)
+  {
+    if (writer.components[c].sample_factor_horiz > h_max)
+      h_max = writer.components[c].sample_factor_horiz;
+    if (writer.components[c].sample_factor_vert > v_max)
+      v_max = writer.components[c].sample_factor_vert;
+  }
+
+  const unsigned x_mcus = (coefficients->width + h_max * 8u - 1) / (h_max * 8u);
+  const unsigned y_mcus = (coefficients->height + v_max * 8u - 1) / (v_max * 8u);
+
+  // Every component's grid has to cover the whole MCU grid.
+  for (unsigned char c = 0; c != num_components; ++c)
+  {
+    const jpeg_component_coefficients_t* component = &coefficients->components[c];
+    if (component->blocks == NULL ||
+        component->blocks_wide < x_mcus * writer.components[c].sample_factor_horiz ||
+        component->blocks_high < y_mcus * writer.components[c].sample_factor_vert)
+    {
+      jpeg_writer_cleanup(&writer);
+      return false;
+    }
+  }
+
+  if (optimize_huffman)
+  {
+    // [table][DC, AC][symbol]
+    unsigned long (*frequencies)[2][HUFF_MAX_SYMBOLS] = calloc(HUFF_TABLES_PER_CHANNEL_TYPE, sizeof(*frequencies));
+    if (frequencies == NULL)
+    {
+      jpeg_writer_cleanup(&writer);
+      return false;
+    }
+
+    write_blocks(&writer, coefficients, x_mcus, y_mcus, frequencies);
+
+    const unsigned char tables = num_components == 1 ? 1 : HUFF_TABLES_PER_CHANNEL_TYPE;
+    for (unsigned char i = 0; i != tables; ++i)
+    {
+      huff_spec_t dc_spec, ac_spec;
+      huff_spec_build_optimal(frequencies[i][0], &dc_spec);
+      huff_spec_build_optimal(frequencies[i][1], &ac_spec);
+      jpeg_writer_set_huffman_tables(&writer, i, &dc_spec, &ac_spec);
+    }
+
+    free(frequencies);
+  }
+
+  jpeg_writer_write_headers(&writer);
+  write_blocks(&writer, coefficients, x_mcus, y_mcus, NULL);
+
+  *out_buf = jpeg_writer_finish(&writer, out_len);
+  return *out_buf != NULL;
+}
@@ -0,0 +1,88 @@
+/*--------------------------------------------------------------------------/
+File:   jpeg_writer.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef JPEG_WRITER_H
+#define JPEG_WRITER_H
+
+#include "bitstream.h"
+#include "decoder.h"
+#include "huffman.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+----------------
+JPEG Writer:
+----------------
+Writes a baseline, sequential JPEG from quantized DCT blocks. Headers first, then one
+interleaved scan fed a block at a time in MCU order, same as the decoder reads it.
+The first component uses Huffman tables 0, the rest share tables 1.
+*/
+typedef struct _jpeg_writer
+{
+  bit_writer_t bits;
+
+  unsigned short width;
+  unsigned short height;
+  unsigned char num_components;
+  jfif_component_t components[MAX_COMPONENTS];
+
+  // Written as an Adobe segment when known, a JFIF one otherwise.
+  unsigned char adobe_transform;
+
+  // Natural order, indexed by quant_table_id. Only the tables a component uses get written.
+  unsigned short quant_tables[MAX_QUANT_TABLES][QUANT_TABLE_SIZE];
+
+  huff_spec_t dc_specs[HUFF_TABLES_PER_CHANNEL_TYPE];
+  huff_spec_t ac_specs[HUFF_TABLES_PER_CHANNEL_TYPE];
+  huff_code_table_t dc_codes[HUFF_TABLES_PER_CHANNEL_TYPE];
+  huff_code_table_t ac_codes[HUFF_TABLES_PER_CHANNEL_TYPE];
+
+  int prev_dc[MAX_COMPONENTS];
+} jpeg_writer_t;
+
+// Sets up a writer with the standard Huffman tables. The caller fills in quant_tables before writing the headers.
+// A single component is always written with 1x1 sampling, since its factors mean nothing without a second one.
+bool jpeg_writer_init(jpeg_writer_t* writer, unsigned short width, unsigned short height,
+                      unsigned char num_components, const jfif_component_t* components);
+
+// Replaces the Huffman tables used for luma (index 0) or chroma (index 1). Only valid before jpeg_writer_write_headers.
+void jpeg_writer_set_huffman_tables(jpeg_writer_t* writer, unsigned char index, const huff_spec_t* dc_spec, const huff_spec_t* ac_spec);
+
+// SOI through SOS.
+void jpeg_writer_write_headers(jpeg_writer_t* writer);
+
+// Entropy codes one block of quantized coefficients, natural order.
+void jpeg_writer_encode_block(jpeg_writer_t* writer, unsigned char component, const int16_t* block);
+
+// Counts the symbols jpeg_writer_encode_block would write for block, for building optimized tables.
+// Both frequency arrays have one entry per symbol. prev_dc tracks the DC prediction the same way.
+void jpeg_writer_count_block(const int16_t* block, int* prev_dc, unsigned long* dc_frequencies, unsigned long* ac_frequencies);
+
+// Ends the scan and the image. Returns the encoded image, to be freed by the caller, or NULL if writing failed.
+unsigned char* jpeg_writer_finish(jpeg_writer_t* writer, size_t* out_len);
+
+// Only needed when a writer is abandoned before jpeg_writer_finish.
+void jpeg_writer_cleanup(jpeg_writer_t* writer);
+
+// Number of bits needed for the magnitude of value, which is also its DC/AC category.
+static inline unsigned jpeg_magnitude_bits(int value)
+{
+  unsigned magnitude = (unsigned)(value < 0 ? -value : value), bits = 0;
+  while (magnitude)
+  {
+    magnitude >>= 1;
+    ++bits;
+  }
+
+  return bits;
+}
+
+// Re-encodes a whole set of coefficients. No IDCT, no requantization, so nothing is lost.
+// With optimize_huffman the blocks are gone over twice, once to count symbols and build tables for them.
+bool jpeg_write_coefficients(const jpeg_coefficients_t* coefficients, bool optimize_huffman, unsigned char** out_buf, size_t* out_len);
+
+#endif
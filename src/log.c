@@ -0,0 +1,58 @@
+/*--------------------------------------------------------------------------
+File:   log.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_LINE_MAX 512
+
+static log_sink_t s_sink = NULL;
+static void* s_sink_user_data = NULL;
+static log_level_t s_level = LL_TRACE;
+
+void log_set_sink(log_sink_t sink, void* user_data)
+{
+  s_sink = sink;
+  s_sink_user_data = user_data;
+}
+
+void log_set_level(log_level_t level)
+{
+  s_level = level;
+}
+
+bool log_is_enabled(log_level_t level)
+{
+  return s_sink != NULL && level <= s_level;
+}
+
+void log_write(log_level_t level, const char* fmt, ...)
+{
+  if (!log_is_enabled(level))
+    return;
+
+  char line[LOG_LINE_MAX];
+
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(line, LOG_LINE_MAX, fmt, args);
+  va_end(args);
+
+  // Sinks get bare lines, so drop the newline a lot of the older messages carry.
+  size_t len = strlen(line);
+  if (len != 0 && line[len - 1] == '\n')
+    line[len - 1] = '\0';
+
+  s_sink(level, line, s_sink_user_data);
+}
+
+void log_stdout_sink(log_level_t level, const char* msg, void* user_data)
+{
+  static const char* LEVEL_PREFIX[] = {"ERROR: ", "WARNING: ", "", "", ""};
+
+  printf("%s%s\n", LEVEL_PREFIX[level], msg);
+}
@@ -0,0 +1,79 @@
+/*--------------------------------------------------------------------------/
+File:   log.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+
+// Numeric levels so the preprocessor can compare them against LOG_COMPILE_LEVEL.
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2 // One line per segment
+#define LOG_LEVEL_DEBUG 3 // Table and header dumps
+#define LOG_LEVEL_TRACE 4 // Per block and per symbol output
+
+// Anything above this level is removed by the preprocessor. The Makefile sets it via LOG_LEVEL.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+typedef enum _log_level
+{
+  LL_ERROR = LOG_LEVEL_ERROR,
+  LL_WARN  = LOG_LEVEL_WARN,
+  LL_INFO  = LOG_LEVEL_INFO,
+  LL_DEBUG = LOG_LEVEL_DEBUG,
+  LL_TRACE = LOG_LEVEL_TRACE
+} log_level_t;
+
+// Receives one formatted line at a time, without the trailing newline.
+typedef void (*log_sink_t)(log_level_t level, const char* msg, void* user_data);
+
+// Installs the sink that receives every message at or below the runtime level.
+// There is no sink by default, so the decoder is silent unless the caller asks otherwise.
+void log_set_sink(log_sink_t sink, void* user_data);
+
+// Sets the runtime level. Messages above it are dropped before they are formatted.
+void log_set_level(log_level_t level);
+
+// True if a message at this level would reach a sink.
+bool log_is_enabled(log_level_t level);
+
+// Formats and forwards a message to the sink. Prefer the LOG_* macros, which compile out.
+void log_write(log_level_t level, const char* fmt, ...);
+
+// Ready made sink that writes every line to stdout.
+void log_stdout_sink(log_level_t level, const char* msg, void* user_data);
+
+// Constant false for levels that were compiled out, so guarded dump code is removed too.
+#define LOG_ENABLED(level) ((level) <= LOG_COMPILE_LEVEL && log_is_enabled(level))
+
+#define LOG_ERROR(...) log_write(LL_ERROR, __VA_ARGS__)
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) log_write(LL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) log_write(LL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) log_write(LL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) log_write(LL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+
+#endif
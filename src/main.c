@@ -3,20 +3,344 @@ File:   main.cpp
 Date:   2021/12/23
 Author: kaiyen
 ---------------------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
 
+#include <dirent.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "decoder.h"
+#include "file_loader.h"
+#include "log.h"
+#include "probe.h"
+#include "profile.h"
+
+// Decodes img_buf straight into a PPM (PGM for greyscale) sized buffer and writes it to path, if there is one.
+// 12 bit frames get written with 16 bit big endian samples and a maxval of 4095.
+static bool decode_to_ppm(const unsigned char* img_buf, size_t byte_size, const char* path)
+{
+  jpeg_info_t info;
+  if (!jpeg_probe(img_buf, byte_size, &info))
+  {
+    printf("No frame header in the image.\n");
+    return false;
+  }
+
+  const bool grey = info.num_components == 1;
+  const bool wide = info.bits_per_sample == 12;
+
+  jpeg_output_t output = {0};
+  if (wide)
+    output.format = grey ? JPF_GRAY16 : JPF_RGB48;
+  else
+    output.format = grey ? JPF_GRAY8 : JPF_RGB24;
+  output.strides[0] = (ptrdiff_t)info.width * jpeg_pixel_format_size(output.format);
+  output.planes[0] = (unsigned char*)malloc((size_t)output.strides[0] * info.height);
+  if (output.planes[0] == NULL)
+  {
+    printf("Failed to allocate the output image.\n");
+    return false;
+  }
+
+  bool success = jpeg_decode_to(img_buf, byte_size, &output);
+  if (path == NULL)
+  {
+    free(output.planes[0]);
+    return success;
+  }
+
+  FILE* ppm = success ? fopen(path, "wb") : NULL;
+  if (ppm != NULL)
+  {
+    const size_t byte_count = (size_t)output.strides[0] * info.height;
+    if (wide)
+    {
+      for (size_t i = 0; i != byte_count; i += 2)
+      {
+        uint16_t sample;
+        memcpy(&sample, output.planes[0] + i, sizeof(sample));
+        output.planes[0][i] = (unsigned char)(sample >> 8);
+        output.planes[0][i + 1] = (unsigned char)sample;
+      }
+    }
+
+    fprintf(ppm, "P%c\n%d %d\n%d\n", grey ? '5' : '6', info.width, info.height, wide ? 4095 : 255);
+    fwrite(output.planes[0], 1, byte_count, ppm);
+    fclose(ppm);
+  }
+  else if (success)
+  {
+    printf("Failed to open '%s'\n", path);
+    success = false;
+  }
+
+  free(output.planes[0]);
+  return success;
+}
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool has_jpeg_extension(const char* name)
+{
+  const char* ext = strrchr(name, '.');
+  if (ext == NULL)
+    return false;
+
+  return strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0;
+}
+
+static int compare_strings(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Takes ownership of path, freeing it if it can't be added. Returns false if memory ran out.
+static bool add_path(char*** paths, size_t* count, size_t* capacity, char* path)
+{
+  if (path == NULL)
+    return false;
+
+  if (*count == *capacity)
+  {
+    const size_t grown_capacity = *capacity ? *capacity * 2 : 16;
+    char** grown = (char**)realloc(*paths, sizeof(char*) * grown_capacity);
+    if (grown == NULL)
+    {
+      free(path);
+      return false;
+    }
+
+    *paths = grown;
+    *capacity = grown_capacity;
+  }
+
+  (*paths)[(*count)++] = path;
+  return true;
+}
+
+// Adds input to paths: itself if it's a file, every JPEG directly in it, sorted, if it's a directory.
+// Returns false if memory ran out, with whatever was added before that still in paths.
+static bool collect_inputs(const char* input, char*** paths, size_t* count, size_t* capacity)
+{
+  struct stat st;
+  if (stat(input, &st) != 0 || !S_ISDIR(st.st_mode))
+  {
+    // Unreadable files still go in, so the loader reports them like any other failure.
+    const size_t path_len = strlen(input) + 1;
+    char* path = (char*)malloc(path_len);
+    if (path != NULL)
+      memcpy(path, input, path_len);
+    return add_path(paths, count, capacity, path);
+  }
+
+  DIR* dir = opendir(input);
+  if (dir == NULL)
+  {
+    printf("Failed to open directory '%s'\n", input);
+    return true;
+  }
+
+  const size_t first = *count;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (!has_jpeg_extension(entry->d_name))
+      continue;
+
+    const size_t path_len = strlen(input) + strlen(entry->d_name) + 2;
+    char* path = (char*)malloc(path_len);
+    if (path != NULL)
+      snprintf(path, path_len, "%s/%s", input, entry->d_name);
+    if (!add_path(paths, count, capacity, path))
+    {
+      closedir(dir);
+      return false;
+    }
+  }
+
+  closedir(dir);
+  qsort(*paths + first, *count - first, sizeof(char*), compare_strings);
+  return true;
+}
+
+// Decodes every input with the loader reading ahead, so the decoder rarely waits on the disk.
+// With out_dir each image is written there as <name>.ppm, otherwise the pixels are just decoded.
+static int decode_batch(char** inputs, int input_count, unsigned depth, file_loader_backend_t backend, const char* out_dir)
+{
+  char** paths = NULL;
+  size_t count = 0, capacity = 0;
+  for (int i = 0; i != input_count; ++i)
+  {
+    if (!collect_inputs(inputs[i], &paths, &count, &capacity))
+    {
+      printf("Out of memory collecting the files to decode.\n");
+      for (size_t p = 0; p != count; ++p)
+        free(paths[p]);
+      free(paths);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (count == 0)
+  {
+    printf("No JPEG files to decode.\n");
+    free(paths);
+    return EXIT_FAILURE;
+  }
+
+  const double start = now_seconds();
+  file_loader_t* loader = file_loader_create((const char* const*)paths, count, depth, backend);
+  if (loader == NULL)
+  {
+    printf("Failed to start loading files.\n");
+    for (size_t i = 0; i != count; ++i)
+      free(paths[i]);
+    free(paths);
+    return EXIT_FAILURE;
+  }
+
+  size_t failures = 0, total_bytes = 0, peak_memory = 0;
+  loaded_file_t file;
+  while (file_loader_next(loader, &file))
+  {
+    const char* path = paths[file.index];
+    if (file.data == NULL)
+    {
+      printf("Failed to read '%s': %s\n", path, strerror(file.error));
+      ++failures;
+      continue;
+    }
+
+    char* ppm_path = NULL;
+    if (out_dir != NULL)
+    {
+      const char* name = strrchr(path, '/');
+      name = name ? name + 1 : path;
+      const size_t name_len = strcspn(name, ".");
+      const size_t path_len = strlen(out_dir) + name_len + 6;
+      ppm_path = (char*)malloc(path_len);
+      if (ppm_path == NULL)
+      {
+        printf("Failed to allocate the output path for '%s'\n", path);
+        ++failures;
+        free(file.data);
+        continue;
+      }
+      snprintf(ppm_path, path_len, "%s/%.*s.ppm", out_dir, (int)name_len, name);
+    }
+
+    total_bytes += file.size;
+    if (!decode_to_ppm(file.data, file.size, ppm_path))
+    {
+      printf("Failed to decode '%s'\n", path);
+      ++failures;
+    }
+
+    if (jpeg_peak_memory() > peak_memory)
+      peak_memory = jpeg_peak_memory();
+
+    free(ppm_path);
+    free(file.data);
+  }
+
+  const double seconds = now_seconds() - start;
+  const double wait_seconds = file_loader_wait_seconds(loader);
+  printf("Decoded %zu of %zu files, %.1f MB in %.3f s with %s loading. Waited %.3f s (%.1f%%) on reads.\n",
+         count - failures, count, (double)total_bytes / (1024.0 * 1024.0), seconds, file_loader_backend_name(loader),
+         wait_seconds, seconds > 0.0 ? 100.0 * wait_seconds / seconds : 0.0);
+  printf("Peak decoder memory: %.1f MB.\n", (double)peak_memory / (1024.0 * 1024.0));
+
+  file_loader_destroy(loader);
+  for (size_t i = 0; i != count; ++i)
+    free(paths[i]);
+  free(paths);
+
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void print_usage(void)
+{
+  printf("Usage: main [-m memory limit] <jpeg file> [output ppm].\n"
+         "       main -b [-m memory limit] [-q queue depth] [-l auto|uring|threads] [-o output dir] <jpeg files or dirs...>\n");
+}
 
 int main(int argc, char** argv)
 {
-  if (argc != 2)
+  bool batch = false;
+  unsigned depth = 0;
+  file_loader_backend_t backend = FLB_AUTO;
+  const char* out_dir = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bm:q:l:o:h")) != -1)
   {
-    printf("Missing argument <jpeg file>.\n");
+    switch (opt)
+    {
+      case 'b':
+        batch = true;
+        break;
+      case 'm':
+        // In bytes, 0 for no limit.
+        jpeg_set_memory_limit((size_t)strtoull(optarg, NULL, 10));
+        break;
+      case 'q':
+        depth = (unsigned)strtoul(optarg, NULL, 10);
+        break;
+      case 'l':
+        if (strcmp(optarg, "auto") == 0)
+          backend = FLB_AUTO;
+        else if (strcmp(optarg, "uring") == 0)
+          backend = FLB_IO_URING;
+        else if (strcmp(optarg, "threads") == 0)
+          backend = FLB_THREADS;
+        else
+        {
+          print_usage();
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'o':
+        out_dir = optarg;
+        break;
+      default:
+        print_usage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  // Batch runs stay quiet, per-segment logging for a whole directory would drown out the summary.
+  if (batch)
+  {
+    if (optind == argc)
+    {
+      print_usage();
+      return EXIT_FAILURE;
+    }
+
+    return decode_batch(argv + optind, argc - optind, depth, backend, out_dir);
+  }
+
+  argv += optind - 1;
+  argc -= optind - 1;
+  if (argc != 2 && argc != 3)
+  {
+    print_usage();
     return EXIT_FAILURE;
   }
 
+  // The CLI is the verbose front end, so everything the decoder logs goes to the console.
+  log_set_sink(log_stdout_sink, NULL);
+
   FILE* jpeg = fopen(argv[1], "rb");
 
   if (jpeg == NULL)
@@ -41,37 +365,16 @@ int main(int argc, char** argv)
 
   fclose(jpeg);
 
-  process_func_t process_func = NULL;
-  char segment_name_buf[64];
-  if (!get_segment_process_func(JFIF_SOI, &process_func, segment_name_buf))
+  const bool success = argc == 3 ? decode_to_ppm(img_buf, byte_size, argv[2]) : jpeg_decode_buffer(img_buf, byte_size);
+  if (!success)
   {
-    printf("Failed to get initial stage.\n");
     free(img_buf);
     return EXIT_FAILURE;
   }
 
-  // TODO(kaiyen): Maintain iterators instead of using a counter.
-  for (unsigned short s = 0; s < byte_size;)
-  {
-    if (img_buf[s] == JFIF_MFF)
-    {
-      if (get_segment_process_func(img_buf[s+1], &process_func, segment_name_buf))
-      {
-        printf("> Processing %s ", segment_name_buf);
-      }
-      else
-      {
-        get_default_stage(img_buf[s+1], &process_func, segment_name_buf);
-        printf("> Skipping %s ", segment_name_buf);
-      }
-
-      s += sizeof(unsigned short);
-    }
-
-    unsigned short stage_len = process_func(&img_buf[s]);
-
-    s += stage_len;
-  }
+#if ENABLE_PROFILE
+  profile_print_stats(stdout);
+#endif
 
   free(img_buf);
   return EXIT_SUCCESS;
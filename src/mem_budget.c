@@ -0,0 +1,178 @@
+/*--------------------------------------------------------------------------
+File:   mem_budget.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "mem_budget.h"
+
+#include "log.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sits in front of every block. Padded so the block itself keeps malloc's alignment.
+typedef union _mem_header
+{
+  struct
+  {
+    size_t size;
+
+    // Which decode the block was allocated in, 0 for none. Only that decode's count goes down when it's freed.
+    unsigned epoch;
+  } info;
+  unsigned char pad[16];
+} mem_header_t;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool s_counting = false;
+static unsigned s_epoch = 0;
+static size_t s_limit = 0;
+static size_t s_in_use = 0;
+static size_t s_peak = 0;
+
+void mem_budget_begin(size_t limit)
+{
+  pthread_mutex_lock(&s_lock);
+  if (++s_epoch == 0)
+    s_epoch = 1;
+  s_counting = true;
+  s_limit = limit;
+  s_in_use = s_peak = 0;
+  pthread_mutex_unlock(&s_lock);
+}
+
+void mem_budget_end(void)
+{
+  pthread_mutex_lock(&s_lock);
+  s_counting = false;
+  s_limit = 0;
+  pthread_mutex_unlock(&s_lock);
+}
+
+bool mem_budget_fits(size_t bytes)
+{
+  pthread_mutex_lock(&s_lock);
+  const bool fits = s_limit == 0 || (bytes <= s_limit && s_in_use <= s_limit - bytes);
+  pthread_mutex_unlock(&s_lock);
+  return fits;
+}
+
+size_t mem_budget_peak(void)
+{
+  pthread_mutex_lock(&s_lock);
+  const size_t peak = s_peak;
+  pthread_mutex_unlock(&s_lock);
+  return peak;
+}
+
+// Counts added bytes against the budget, replacing old's if it's being resized. Returns false, counting
+// nothing, if they don't fit.
+static bool charge(size_t added, const mem_header_t* old, unsigned* out_epoch)
+{
+  bool fits = true;
+
+  pthread_mutex_lock(&s_lock);
+  if (!s_counting)
+  {
+    // Allocations outside a decode (the encoder's, say) aren't anyone's to count.
+    *out_epoch = 0;
+    pthread_mutex_unlock(&s_lock);
+    return true;
+  }
+
+  // Blocks from an earlier decode aren't part of this one's count, so all of the new size is.
+  const size_t in_use = old != NULL && old->info.epoch == s_epoch ? s_in_use - old->info.size : s_in_use;
+  if (s_limit != 0 && (added > s_limit || in_use > s_limit - added))
+  {
+    LOG_WARN("Memory budget of %zu bytes exceeded, %zu in use and %zu more requested.", s_limit, in_use, added);
+    fits = false;
+  }
+  else
+  {
+    s_in_use = in_use + added;
+    if (s_in_use > s_peak)
+      s_peak = s_in_use;
+  }
+  *out_epoch = s_epoch;
+
+  pthread_mutex_unlock(&s_lock);
+  return fits;
+}
+
+static void uncharge(size_t size, unsigned epoch)
+{
+  pthread_mutex_lock(&s_lock);
+  if (epoch == s_epoch && s_counting)
+    s_in_use -= size;
+  pthread_mutex_unlock(&s_lock);
+}
+
+void* mem_malloc(size_t size)
+{
+  unsigned epoch;
+  if (size > SIZE_MAX - sizeof(mem_header_t) || !charge(size, NULL, &epoch))
+    return NULL;
+
+  mem_header_t* header = (mem_header_t*)malloc(sizeof(mem_header_t) + size);
+  if (header == NULL)
+  {
+    uncharge(size, epoch);
+    return NULL;
+  }
+
+  header->info.size = size;
+  header->info.epoch = epoch;
+  return header + 1;
+}
+
+void* mem_calloc(size_t count, size_t size)
+{
+  if (size != 0 && count > SIZE_MAX / size)
+    return NULL;
+
+  void* ptr = mem_malloc(count * size);
+  if (ptr != NULL)
+    memset(ptr, 0, count * size);
+
+  return ptr;
+}
+
+void* mem_realloc(void* ptr, size_t size)
+{
+  if (ptr == NULL)
+    return mem_malloc(size);
+
+  mem_header_t* header = (mem_header_t*)ptr - 1;
+  const mem_header_t old = *header;
+
+  unsigned epoch;
+  if (size > SIZE_MAX - sizeof(mem_header_t) || !charge(size, &old, &epoch))
+    return NULL;
+
+  mem_header_t* resized = (mem_header_t*)realloc(header, sizeof(mem_header_t) + size);
+  if (resized == NULL)
+  {
+    // The old block is still there, so it goes back to being what's counted.
+    uncharge(size, epoch);
+    pthread_mutex_lock(&s_lock);
+    if (old.info.epoch == s_epoch && s_counting)
+      s_in_use += old.info.size;
+    pthread_mutex_unlock(&s_lock);
+    return NULL;
+  }
+
+  resized->info.size = size;
+  resized->info.epoch = epoch;
+  return resized + 1;
+}
+
+void mem_free(void* ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  mem_header_t* header = (mem_header_t*)ptr - 1;
+  uncharge(header->info.size, header->info.epoch);
+  free(header);
+}
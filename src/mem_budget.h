@@ -0,0 +1,42 @@
+/*--------------------------------------------------------------------------/
+File:   mem_budget.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef MEM_BUDGET_H
+#define MEM_BUDGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+----------------
+Memory Budget:
+----------------
+Every allocation the decoder makes goes through here, so the bytes it holds are counted and can be
+capped. A decode opens a budget with mem_budget_begin and closes it with mem_budget_end. In between,
+allocations that would take it past the limit fail like an out of memory malloc would.
+
+Each block carries its size in a small header, so memory from these functions has to be freed with
+mem_free. Blocks outlive their decode fine (coefficients are handed to the caller), they just stop
+counting towards anything, and blocks allocated outside a decode never count. Safe to call from the
+entropy decoding threads.
+*/
+
+// Starts counting a new decode from zero. A limit of 0 is unlimited.
+void mem_budget_begin(size_t limit);
+
+// Stops counting and enforcing the limit. The peak stays readable until the next begin.
+void mem_budget_end(void);
+
+// Whether bytes more would still fit in the current budget. For checking sizes before committing to them.
+bool mem_budget_fits(size_t bytes);
+
+// Most bytes held at once since the last begin.
+size_t mem_budget_peak(void);
+
+void* mem_malloc(size_t size);
+void* mem_calloc(size_t count, size_t size);
+void* mem_realloc(void* ptr, size_t size);
+void mem_free(void* ptr);
+
+#endif
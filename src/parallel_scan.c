@@ -0,0 +1,450 @@
+/*--------------------------------------------------------------------------
+File:   parallel_scan.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel_scan.h"
+
+#include "bitstream.h"
+#include "dct_utils.h"
+#include "log.h"
+#include "mem_budget.h"
+#include "profile.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// More chunks than this stop paying for themselves, whatever the core count.
+#define MAX_CHUNKS 64
+
+// Everything one chunk decoded, in the order it decoded it.
+typedef struct _scan_chunk
+{
+  const parallel_scan_t* scan;
+
+  // The chunk covers MCUs that start in [begin_bit, end_bit). It decodes on past end_bit to finish its last one.
+  size_t begin_bit;
+  size_t end_bit;
+
+  // MCUs decoded, and room for. starts has one more entry than there are MCUs: where the next one would start.
+  size_t count;
+  size_t capacity;
+  size_t* starts;
+  int16_t* blocks;
+
+  // Running sum of the DC differences per component, so any range of MCUs can be summed in one subtraction.
+  int* dc_sums;
+
+#if ENABLE_PROFILE
+  // Running sums of the profile counters the same way, so only the MCUs of the real stream get counted.
+  unsigned long long* counter_sums;
+#endif
+
+  // MCUs before this index came before the last place decoding failed, so they can't be part of the real stream.
+  size_t chain_start;
+
+  // MCUs of the real stream decoded from where the previous chunk left off up to where this one got in step, if it hadn't yet.
+  struct _scan_chunk* bridge;
+
+  // After the merge: the range of MCUs that are the real stream, where the first one goes, and the DC predictors going into it.
+  size_t valid_begin;
+  size_t valid_end;
+  size_t first_mcu;
+  int base_dc[MAX_BLOCKS_PER_MCU];
+
+  bool failed;
+} scan_chunk_t;
+
+unsigned parallel_scan_chunk_count(size_t len, unsigned threads, size_t min_chunk_bytes)
+{
+  if (threads == 0)
+  {
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cores > 0 ? (unsigned)cores : 1;
+  }
+
+  if (min_chunk_bytes == 0)
+    min_chunk_bytes = 1;
+
+  const size_t by_size = len / min_chunk_bytes;
+  size_t chunks = by_size < threads ? by_size : threads;
+  if (chunks > MAX_CHUNKS)
+    chunks = MAX_CHUNKS;
+
+  return chunks > 1 ? (unsigned)chunks : 1;
+}
+
+size_t parallel_scan_memory(const parallel_scan_t* scan, unsigned chunk_count)
+{
+  // What chunk_reserve allocates per MCU. Capacities double, so chunks hold up to twice what they decoded, and
+  // every chunk and bridge starts out with room for 256. Bridges only cover the few MCUs before a chunk got in step.
+  unsigned long long mcu_bytes = sizeof(int16_t) * DCT_BLOCK_SIZE * scan->blocks_per_mcu + sizeof(size_t) + sizeof(int) * scan->num_components;
+#if ENABLE_PROFILE
+  mcu_bytes += sizeof(unsigned long long) * PC_COUNT;
+#endif
+  const unsigned long long bytes = 2ull * scan->mcu_count * mcu_bytes + 2ull * chunk_count * (256 * mcu_bytes + sizeof(scan_chunk_t));
+
+  return bytes > SIZE_MAX ? SIZE_MAX : (size_t)bytes;
+}
+
+static bool chunk_reserve(scan_chunk_t* chunk)
+{
+  if (chunk->count < chunk->capacity)
+    return true;
+
+  const parallel_scan_t* scan = chunk->scan;
+  const size_t capacity = chunk->capacity ? chunk->capacity * 2 : 256;
+
+  size_t* starts = (size_t*)mem_realloc(chunk->starts, sizeof(size_t) * (capacity + 1));
+  if (starts != NULL)
+    chunk->starts = starts;
+
+  int16_t* blocks = (int16_t*)mem_realloc(chunk->blocks, sizeof(int16_t) * DCT_BLOCK_SIZE * scan->blocks_per_mcu * capacity);
+  if (blocks != NULL)
+    chunk->blocks = blocks;
+
+  int* dc_sums = (int*)mem_realloc(chunk->dc_sums, sizeof(int) * scan->num_components * (capacity + 1));
+  if (dc_sums != NULL)
+    chunk->dc_sums = dc_sums;
+
+  if (starts == NULL || blocks == NULL || dc_sums == NULL)
+    return false;
+
+#if ENABLE_PROFILE
+  unsigned long long* counter_sums = (unsigned long long*)mem_realloc(chunk->counter_sums, sizeof(unsigned long long) * PC_COUNT * (capacity + 1));
+  if (counter_sums == NULL)
+    return false;
+  chunk->counter_sums = counter_sums;
+#endif
+
+  chunk->capacity = capacity;
+  return true;
+}
+
+// Index of the MCU in chunk that started at position, or chunk->count if none did. starts is sorted.
+static size_t find_start(const scan_chunk_t* chunk, size_t position)
+{
+  size_t lo = 0, hi = chunk->count;
+  while (lo < hi)
+  {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (chunk->starts[mid] < position)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo < chunk->count && chunk->starts[lo] == position ? lo : chunk->count;
+}
+
+/*
+Decodes MCUs from start_bit until one would start at or past end_bit, or max_mcus are done. Exact
+decoding knows start_bit is a real MCU boundary, so a bad code means the data is corrupt. Speculative
+decoding just treats wherever the bad code ended as the next MCU boundary to try.
+
+With sync_with, exact decoding also stops at the first MCU boundary sync_with decoded from too, and
+returns its index there. From then on sync_with is in step and holds the rest. Returns sync_with->count otherwise.
+*/
+static size_t decode_chunk(scan_chunk_t* chunk, size_t start_bit, size_t end_bit, size_t max_mcus, bool exact, const scan_chunk_t* sync_with)
+{
+  const parallel_scan_t* scan = chunk->scan;
+  const size_t start_byte = start_bit / 8;
+
+  bit_reader_t reader;
+  bit_reader_init(&reader, scan->data + start_byte, scan->len - start_byte);
+  bit_reader_read(&reader, (unsigned)(start_bit % 8));
+
+  chunk->count = chunk->chain_start = 0;
+  if (!chunk_reserve(chunk))
+  {
+    chunk->failed = true;
+    return 0;
+  }
+
+  // Both chunks only ever move forwards, so one walk through sync_with's starts finds every match.
+  size_t sync_idx = sync_with ? sync_with->chain_start : 0;
+  size_t synced = sync_with ? sync_with->count : 0;
+
+  memset(chunk->dc_sums, 0, sizeof(int) * scan->num_components);
+
+#if ENABLE_PROFILE
+  // Counting starts over for every MCU and goes into counter_sums. What this thread had is put back at the end.
+  unsigned long long thread_counters[PC_COUNT];
+  memcpy(thread_counters, profile_counters, sizeof(thread_counters));
+  memset(chunk->counter_sums, 0, sizeof(unsigned long long) * PC_COUNT);
+#endif
+
+  const size_t data_bits = scan->len * 8;
+  for (;;)
+  {
+    const size_t position = start_byte * 8 + bit_reader_position(&reader);
+    chunk->starts[chunk->count] = position;
+
+    if (position >= end_bit || chunk->count == max_mcus)
+      break;
+
+    if (sync_with != NULL)
+    {
+      while (sync_idx < sync_with->count && sync_with->starts[sync_idx] < position)
+        ++sync_idx;
+      if (sync_idx < sync_with->count && sync_with->starts[sync_idx] == position)
+      {
+        synced = sync_idx;
+        break;
+      }
+    }
+
+    if (position >= data_bits)
+    {
+      // Only the guard is left. Fine while speculating, the merge never gets this far on real data.
+      chunk->failed = exact;
+      break;
+    }
+
+    if (!chunk_reserve(chunk))
+    {
+      chunk->failed = true;
+      break;
+    }
+
+    int16_t* blocks = chunk->blocks + chunk->count * scan->blocks_per_mcu * DCT_BLOCK_SIZE;
+    memset(blocks, 0, sizeof(int16_t) * DCT_BLOCK_SIZE * scan->blocks_per_mcu);
+
+    const int* prev_sums = chunk->dc_sums + chunk->count * scan->num_components;
+    int* sums = chunk->dc_sums + (chunk->count + 1) * scan->num_components;
+    memcpy(sums, prev_sums, sizeof(int) * scan->num_components);
+
+#if ENABLE_PROFILE
+    memset(profile_counters, 0, sizeof(profile_counters));
+#endif
+
+    bool decoded = true;
+    for (unsigned char b = 0; b != scan->blocks_per_mcu && decoded; ++b, blocks += DCT_BLOCK_SIZE)
+    {
+      // Each block's DC comes out as its difference to the one before, the real predictor isn't known yet.
+      int dc_diff = 0;
+      decoded = bits_to_dct_block(&reader, (const huff_table_t**)scan->block_tables[b], blocks, &dc_diff);
+      sums[scan->block_components[b]] = dc_predictor_add(sums[scan->block_components[b]], dc_diff);
+    }
+
+    if (decoded)
+    {
+#if ENABLE_PROFILE
+      const unsigned long long* prev_counts = chunk->counter_sums + chunk->count * PC_COUNT;
+      unsigned long long* counts = chunk->counter_sums + (chunk->count + 1) * PC_COUNT;
+      for (unsigned i = 0; i != PC_COUNT; ++i)
+        counts[i] = prev_counts[i] + profile_counters[i];
+#endif
+
+      ++chunk->count;
+      continue;
+    }
+
+    if (exact)
+    {
+      chunk->failed = true;
+      break;
+    }
+
+    // A lookup that fails on its very first bit doesn't move the reader, so step past it by hand.
+    if (start_byte * 8 + bit_reader_position(&reader) == position)
+      bit_reader_read(&reader, 1);
+
+    chunk->chain_start = chunk->count;
+  }
+
+#if ENABLE_PROFILE
+  memcpy(profile_counters, thread_counters, sizeof(thread_counters));
+#endif
+
+  return synced;
+}
+
+static void* speculate_thread(void* arg)
+{
+  scan_chunk_t* chunk = (scan_chunk_t*)arg;
+  decode_chunk(chunk, chunk->begin_bit, chunk->end_bit, chunk->scan->mcu_count, false, NULL);
+  return NULL;
+}
+
+// Hands MCUs [begin, end) of chunk to the caller from mcu_index on, turning DC differences into values as it goes.
+static void store_mcus(const scan_chunk_t* chunk, size_t begin, size_t end, size_t mcu_index, int* dc)
+{
+  const parallel_scan_t* scan = chunk->scan;
+  for (size_t i = begin; i != end; ++i, ++mcu_index)
+  {
+    int16_t* blocks = chunk->blocks + i * scan->blocks_per_mcu * DCT_BLOCK_SIZE;
+    for (unsigned char b = 0; b != scan->blocks_per_mcu; ++b)
+    {
+      int16_t* dc_coefficient = blocks + b * DCT_BLOCK_SIZE;
+      dc[scan->block_components[b]] = dc_predictor_add(dc[scan->block_components[b]], *dc_coefficient);
+      *dc_coefficient = (int16_t)dc[scan->block_components[b]];
+    }
+
+    scan->store_mcu(scan->user, mcu_index, blocks);
+  }
+}
+
+// Hands the chunk's part of the real stream to the caller, with the DC predictors carried over from the chunks before it.
+static void* store_thread(void* arg)
+{
+  const scan_chunk_t* chunk = (const scan_chunk_t*)arg;
+
+  int dc[MAX_BLOCKS_PER_MCU];
+  memcpy(dc, chunk->base_dc, sizeof(dc));
+
+  const size_t bridged = chunk->bridge->count;
+  store_mcus(chunk->bridge, 0, bridged, chunk->first_mcu, dc);
+  store_mcus(chunk, chunk->valid_begin, chunk->valid_end, chunk->first_mcu + bridged, dc);
+  return NULL;
+}
+
+// Runs func over every chunk, the first on this thread and the rest on their own. Falls back to this thread if one can't start.
+static void run_chunks(scan_chunk_t* chunks, unsigned chunk_count, void* (*func)(void*))
+{
+  pthread_t threads[MAX_CHUNKS];
+  bool started[MAX_CHUNKS] = {false};
+
+  for (unsigned k = 1; k != chunk_count; ++k)
+    started[k] = pthread_create(&threads[k], NULL, func, &chunks[k]) == 0;
+
+  func(&chunks[0]);
+
+  for (unsigned k = 1; k != chunk_count; ++k)
+  {
+    if (started[k])
+      pthread_join(threads[k], NULL);
+    else
+      func(&chunks[k]);
+  }
+}
+
+// Adds MCUs [first, last) of chunk to the real stream: moves position past them and sums their DC differences into dc.
+static bool take_mcus(const scan_chunk_t* chunk, size_t first, size_t last, size_t* position, size_t* mcus, int* dc)
+{
+  const parallel_scan_t* scan = chunk->scan;
+
+  // The real stream can't have read into the guard.
+  if (chunk->starts[last] > scan->len * 8)
+    return false;
+
+  for (unsigned char c = 0; c != scan->num_components; ++c)
+    dc[c] = dc_predictor_add(dc[c], chunk->dc_sums[last * scan->num_components + c] - chunk->dc_sums[first * scan->num_components + c]);
+
+  *position = chunk->starts[last];
+  *mcus += last - first;
+  return true;
+}
+
+/*
+Follows the real stream through the chunks in order and sets every chunk's valid range. Where a chunk
+hadn't got in step by the time the real stream reaches it, the real stream is decoded into its bridge
+until it runs into an MCU the chunk decoded too.
+*/
+static bool merge_chunks(scan_chunk_t* chunks, unsigned chunk_count)
+{
+  const parallel_scan_t* scan = chunks[0].scan;
+
+  size_t position = 0, mcus = 0;
+  int dc[MAX_BLOCKS_PER_MCU] = {0};
+
+  for (unsigned k = 0; k != chunk_count; ++k)
+  {
+    scan_chunk_t* chunk = &chunks[k];
+    chunk->first_mcu = mcus;
+    chunk->valid_begin = chunk->valid_end = 0;
+    memcpy(chunk->base_dc, dc, sizeof(dc));
+
+    // The MCU before it ran right over this chunk.
+    if (position >= chunk->end_bit || mcus == scan->mcu_count)
+      continue;
+
+    size_t first = find_start(chunk, position);
+    if (first == chunk->count || first < chunk->chain_start)
+    {
+      first = decode_chunk(chunk->bridge, position, chunk->end_bit, scan->mcu_count - mcus, true, chunk);
+      if (chunk->bridge->failed || !take_mcus(chunk->bridge, 0, chunk->bridge->count, &position, &mcus, dc))
+        return false;
+
+      LOG_DEBUG("Chunk %u got in step %zu MCUs after where the real stream reached it.", k, chunk->bridge->count);
+      if (first == chunk->count)
+        continue;
+    }
+
+    size_t last = chunk->count;
+    if (last - first > scan->mcu_count - mcus)
+      last = first + (scan->mcu_count - mcus);
+
+    chunk->valid_begin = first;
+    chunk->valid_end = last;
+    if (!take_mcus(chunk, first, last, &position, &mcus, dc))
+      return false;
+  }
+
+  return mcus == scan->mcu_count;
+}
+
+// Adds what the merged real stream decoded to this thread's profile counters, the way a serial decode counts it.
+static void count_real_stream(const scan_chunk_t* chunks, unsigned chunk_count)
+{
+#if ENABLE_PROFILE
+  for (unsigned k = 0; k != chunk_count; ++k)
+  {
+    const scan_chunk_t* bridge = chunks[k].bridge;
+    for (unsigned i = 0; i != PC_COUNT; ++i)
+    {
+      if (bridge->count != 0)
+        profile_counters[i] += bridge->counter_sums[bridge->count * PC_COUNT + i];
+      if (chunks[k].valid_end != chunks[k].valid_begin)
+        profile_counters[i] += chunks[k].counter_sums[chunks[k].valid_end * PC_COUNT + i] - chunks[k].counter_sums[chunks[k].valid_begin * PC_COUNT + i];
+    }
+  }
+#endif
+}
+
+bool parallel_scan_decode(const parallel_scan_t* scan, unsigned chunk_count)
+{
+  if (chunk_count == 0 || chunk_count > MAX_CHUNKS || scan->blocks_per_mcu == 0 || scan->blocks_per_mcu > MAX_BLOCKS_PER_MCU)
+    return false;
+
+  // The chunks, then a bridge for each.
+  scan_chunk_t* chunks = (scan_chunk_t*)mem_calloc(chunk_count * 2, sizeof(scan_chunk_t));
+  if (chunks == NULL)
+    return false;
+
+  // Chunk boundaries are only a guess at where MCUs start, so byte granularity is as good as any.
+  for (unsigned k = 0; k != chunk_count; ++k)
+  {
+    chunks[k].scan = chunks[chunk_count + k].scan = scan;
+    chunks[k].bridge = &chunks[chunk_count + k];
+    chunks[k].begin_bit = scan->len * k / chunk_count * 8;
+    chunks[k].end_bit = scan->len * (k + 1) / chunk_count * 8;
+  }
+  chunks[chunk_count - 1].end_bit = scan->len * 8;
+
+  run_chunks(chunks, chunk_count, speculate_thread);
+
+  // A chunk that ran out of memory part way just gets in step later, if at all, so only the merge can fail.
+  const bool success = merge_chunks(chunks, chunk_count);
+  if (success)
+  {
+    count_real_stream(chunks, chunk_count);
+    run_chunks(chunks, chunk_count, store_thread);
+  }
+
+  for (unsigned k = 0; k != chunk_count * 2; ++k)
+  {
+    mem_free(chunks[k].starts);
+    mem_free(chunks[k].blocks);
+    mem_free(chunks[k].dc_sums);
+#if ENABLE_PROFILE
+    mem_free(chunks[k].counter_sums);
+#endif
+  }
+  mem_free(chunks);
+
+  return success;
+}
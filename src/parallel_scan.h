@@ -0,0 +1,67 @@
+/*--------------------------------------------------------------------------/
+File:   parallel_scan.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef PARALLEL_SCAN_H
+#define PARALLEL_SCAN_H
+
+#include "huffman.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Interleaved MCUs are capped at 10 blocks by the spec, the frame header parser allows up to 4x4 per component.
+#define MAX_BLOCKS_PER_MCU 64
+
+/*
+----------------
+Parallel Entropy Decoding:
+----------------
+Splits one scan's entropy coded data into chunks at arbitrary byte offsets and decodes them all
+at once, without needing restart markers.
+
+Only the first chunk starts on a known MCU boundary. Every other one starts mid-code and decodes
+garbage until Huffman codes fall back into step with the real stream, which JPEG's usually do within
+a few blocks. Each chunk records where every MCU it decoded started. A serial merge then follows the
+real stream from chunk to chunk: where the previous chunk's last MCU ends is where the next one's
+first real MCU starts, and if the next chunk passed through that position it's been in step since.
+A chunk that never got in step is decoded again from the right position. DC values are decoded as
+differences, so the predictors are fixed up afterwards once every chunk knows where it starts.
+
+This holds the whole scan's coefficients, so it's only worth it for scans big enough to split.
+*/
+typedef struct _parallel_scan
+{
+  // Unstuffed entropy coded data, followed by BITSTREAM_GUARD_BYTES of zeros.
+  const unsigned char* data;
+  size_t len;
+
+  // One entry per block of an MCU, in decode order: the DC and AC tables, and which of the scan's
+  // components the block belongs to, which is also the DC predictor it uses.
+  unsigned char blocks_per_mcu;
+  const huff_table_t* block_tables[MAX_BLOCKS_PER_MCU][2];
+  unsigned char block_components[MAX_BLOCKS_PER_MCU];
+  unsigned char num_components;
+
+  size_t mcu_count;
+
+  // Called once per MCU, with its blocks back to back and their final DC values. Called from several
+  // threads at once, each with different MCUs.
+  void (*store_mcu)(void* user, size_t mcu_index, const int16_t* blocks);
+  void* user;
+} parallel_scan_t;
+
+// How many chunks a scan len bytes long gets split into. 1 means it isn't worth splitting.
+// threads of 0 means one per core, min_chunk_bytes keeps chunks big enough to get in step and pay for a thread.
+unsigned parallel_scan_chunk_count(size_t len, unsigned threads, size_t min_chunk_bytes);
+
+// Roughly the most bytes parallel_scan_decode holds at once for scan, on top of wherever store_mcu puts the MCUs.
+// Saturates instead of overflowing.
+size_t parallel_scan_memory(const parallel_scan_t* scan, unsigned chunk_count);
+
+// Decodes the scan over chunk_count threads, the calling one included. Returns false on corrupt data,
+// data that runs out before mcu_count MCUs, or if allocating fails. MCUs may have been stored either way.
+bool parallel_scan_decode(const parallel_scan_t* scan, unsigned chunk_count);
+
+#endif
@@ -12,114 +12,125 @@ Author: kaiyen
 #include <stdio.h>
 #include <string.h>
 
+// Every dump is sent to the log one line at a time, so the lines are built up here first.
+#define PRINT_LINE_MAX 256
+
 void print_jpeg_header(decode_context_t* ctx, unsigned char jfif_major, unsigned char jfif_minor)
 {
-  if (ctx == NULL)
+  if (ctx == NULL || !LOG_ENABLED(LL_DEBUG))
     return;
 
   char buf[16];
   snprintf(buf, 16, "%d.%d", jfif_major, jfif_minor);
 
-  printf("+-------------------------+\n");
-  printf("| JPEG Header Information |\n");
-  printf("+-------------------------+\n");
-  printf("| JFIF %-19s|\n", buf);
+  LOG_DEBUG("+-------------------------+");
+  LOG_DEBUG("| JPEG Header Information |");
+  LOG_DEBUG("+-------------------------+");
+  LOG_DEBUG("| JFIF %-19s|", buf);
 
   snprintf(buf, 16, "%1d", ctx->density_units);
-  printf("| Density Units: %-9s|\n", buf);
+  LOG_DEBUG("| Density Units: %-9s|", buf);
 
   snprintf(buf, 16, "%dx%d", ctx->x_density, ctx->y_density);
-  printf("| Density: %-15s|\n", buf);
-  printf("+-------------------------+\n");
+  LOG_DEBUG("| Density: %-15s|", buf);
+  LOG_DEBUG("+-------------------------+");
 }
 
 void print_quant_tables(decode_context_t* ctx, unsigned char qt_info, unsigned char qt_precision)
 {
-  if (ctx == NULL)
+  if (ctx == NULL || !LOG_ENABLED(LL_DEBUG))
     return;
 
-  printf("qt_info:\t0x%03X\n", qt_info);
+  LOG_DEBUG("qt_info:\t0x%03X", qt_info);
 
   if (qt_precision == 0)
   {
-    printf("Each element in the quant table is 1 byte.\n");
+    LOG_DEBUG("Each element in the quant table is 1 byte.");
   }
   else
   {
-    printf("Each element in the quant table is 2 bytes.\n");
+    LOG_DEBUG("Each element in the quant table is 2 bytes.");
   }
 
-  printf("+---------------------------------+   +---------------------------------+\n");
-  printf("|              LUMA               |   |              CHROMA             |\n");
-  printf("+---------------------------------+   +---------------------------------+\n");
+  char line[PRINT_LINE_MAX];
+  const unsigned short* table = ctx->quant_tables[qt_info & 0x0F];
+
+  LOG_DEBUG("+---------------------------------+");
+  LOG_DEBUG("|             TABLE %d             |", qt_info & 0x0F);
+  LOG_DEBUG("+---------------------------------+");
   for (unsigned char i = 0; i != 8; ++i)
   {
     const unsigned char offset = i * 8;
-    printf("| ");
-    for (unsigned char j = 0; j != 8; ++j)
-    {
-        printf("%03d ", ctx->luma_q_table[offset + j]);
-    }
-
-    printf("|   | ");
-
+    int len = snprintf(line, PRINT_LINE_MAX, "| ");
     for (unsigned char j = 0; j != 8; ++j)
     {
-        printf("%03d ", ctx->chrm_q_table[offset + j]);
+        len += snprintf(line + len, PRINT_LINE_MAX - len, "%03d ", table[offset + j]);
     }
-    printf("|\n");
+    snprintf(line + len, PRINT_LINE_MAX - len, "|");
+    LOG_DEBUG("%s", line);
   }
-  printf("+---------------------------------+   +---------------------------------+\n");
+  LOG_DEBUG("+---------------------------------+");
 }
 
 void print_component_info(struct _jfif_component* component, unsigned char component_counter, unsigned char component_id)
 {
-  if (component == NULL)
+  if (component == NULL || !LOG_ENABLED(LL_DEBUG))
     return;
 
   static const char* COMP_ID_TO_NAME[] = {"Undefined", "Y", "Cb", "Cr", "I", "Q"};
+  static const unsigned char COMP_ID_COUNT = sizeof(COMP_ID_TO_NAME) / sizeof(COMP_ID_TO_NAME[0]);
+
+  // Not every encoder numbers components from 1 (Adobe uses 'R', 'G', 'B' for instance).
+  const char* component_name = COMP_ID_TO_NAME[component_id < COMP_ID_COUNT ? component_id : 0];
+  (void)component_name; // Only referenced when debug logging is compiled in.
 
-  printf("Component %d:\n", component_counter);
-  printf("  Component:\t\t\t%s\n", COMP_ID_TO_NAME[component_id]);
-  printf("  Quantization Table ID:\t%d\n", component->quant_table_id);
-  printf("  Vertical Sample Factor:\t%d\n", component->sample_factor_vert);
-  printf("  Horizontal Sample Factor:\t%d\n", component->sample_factor_horiz);
+  LOG_DEBUG("Component %d:", component_counter);
+  LOG_DEBUG("  Component:\t\t\t%s", component_name);
+  LOG_DEBUG("  Quantization Table ID:\t%d", component->quant_table_id);
+  LOG_DEBUG("  Vertical Sample Factor:\t%d", component->sample_factor_vert);
+  LOG_DEBUG("  Horizontal Sample Factor:\t%d", component->sample_factor_horiz);
 }
 
 void print_huffman_info(unsigned char ht_header, unsigned char ht_count, unsigned char ht_type, unsigned char* ht_lengths, unsigned char* ht_items, unsigned char ht_items_count)
 {
-  if (ht_lengths == NULL || ht_items == NULL)
+  if (ht_lengths == NULL || ht_items == NULL || !LOG_ENABLED(LL_DEBUG))
     return;
 
-  printf("ht_header:\t0x%02x\nht_count:\t0x%02x\nht_type:\t0x%02x\n", ht_header, ht_count, ht_type);
+  LOG_DEBUG("ht_header:\t0x%02x", ht_header);
+  LOG_DEBUG("ht_count:\t0x%02x", ht_count);
+  LOG_DEBUG("ht_type:\t0x%02x", ht_type);
+
+  char line[PRINT_LINE_MAX];
 
   // Lengths
-  printf("ht_lengths:\t{ ");
+  int len = snprintf(line, PRINT_LINE_MAX, "ht_lengths:\t{ ");
   for (unsigned char i = 0; i != 16; ++i)
-    printf("%d ", ht_lengths[i]);
-
-  printf("}\n");
+    len += snprintf(line + len, PRINT_LINE_MAX - len, "%d ", ht_lengths[i]);
 
+  LOG_DEBUG("%s}", line);
 
-  // Items
-  printf("ht_items(%d):\t{ ", ht_items_count);
-  for (unsigned i = 0; i != ht_items_count; ++i)
+  // Items, wrapped every 16 so a full table still fits the line buffer.
+  LOG_DEBUG("ht_items(%d):", ht_items_count);
+  for (unsigned row = 0; row < ht_items_count; row += 16)
   {
-    printf("%d ", ht_items[i]);
+    len = snprintf(line, PRINT_LINE_MAX, "\t");
+    for (unsigned i = row; i != ht_items_count && i != row + 16; ++i)
+    {
+      len += snprintf(line + len, PRINT_LINE_MAX - len, "%d ", ht_items[i]);
+    }
+    LOG_DEBUG("%s", line);
   }
-  printf("}\n");
-
 }
 
 
-static void print_byte(const char* elem_fmt, const void* item) { printf(elem_fmt, *(const unsigned char*)item);}
-static void print_short(const char* elem_fmt, const void* item) { printf(elem_fmt, *(const short*)item);}
-static void print_float(const char* elem_fmt, const void* item) { printf(elem_fmt, *(const float*)item);}
-static void print_int(const char* elem_fmt, const void* item) { printf(elem_fmt, *(const int*)item);}
+static int print_byte(char* buf, size_t buf_len, const char* elem_fmt, const void* item) { return snprintf(buf, buf_len, elem_fmt, *(const unsigned char*)item);}
+static int print_short(char* buf, size_t buf_len, const char* elem_fmt, const void* item) { return snprintf(buf, buf_len, elem_fmt, *(const short*)item);}
+static int print_float(char* buf, size_t buf_len, const char* elem_fmt, const void* item) { return snprintf(buf, buf_len, elem_fmt, *(const float*)item);}
+static int print_int(char* buf, size_t buf_len, const char* elem_fmt, const void* item) { return snprintf(buf, buf_len, elem_fmt, *(const int*)item);}
 
-void print_block(const char* header, const char* elem_fmt, void* block, size_t block_side_len, print_t type)
+void print_block(log_level_t level, const char* header, const char* elem_fmt, void* block, size_t block_side_len, print_t type)
 {
-  typedef void (*print_elem_func_t)(const char*, const void*);
+  typedef int (*print_elem_func_t)(char*, size_t, const char*, const void*);
   static print_elem_func_t PT_FUNCS[PT_COUNT] =
   {
     print_byte,
@@ -137,7 +148,10 @@ void print_block(const char* header, const char* elem_fmt, void* block, size_t b
   };
 
   // Guard Usage
-  if (elem_fmt == NULL || block == NULL || block_side_len == 0 || type < 0 || type > PT_COUNT)
+  if (elem_fmt == NULL || block == NULL || block_side_len == 0 || type < 0 || type >= PT_COUNT)
+    return;
+
+  if (!log_is_enabled(level))
     return;
 
   print_elem_func_t print_func = PT_FUNCS[type];
@@ -147,18 +161,19 @@ void print_block(const char* header, const char* elem_fmt, void* block, size_t b
 
   // Print header, if it was passed in.
   if (header != NULL)
-    printf("\n%s:\n", header);
+    log_write(level, "%s:", header);
 
+  char line[PRINT_LINE_MAX];
   for (size_t offset, j, i = 0; i != block_side_len; ++i)
   {
-    putchar(' ');
+    int len = snprintf(line, PRINT_LINE_MAX, " ");
     offset = i * block_side_len;
-    for (j = 0; j != block_side_len; ++j)
+    for (j = 0; j != block_side_len && len < PRINT_LINE_MAX; ++j)
     {
       block_it = (const unsigned char*)block + (elem_size * (offset + j));
-      print_func(elem_fmt, block_it);
+      len += print_func(line + len, PRINT_LINE_MAX - len, elem_fmt, block_it);
     }
-    putchar('\n');
+    log_write(level, "%s", line);
   }
 
 }
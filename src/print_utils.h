@@ -6,6 +6,8 @@ Author: kaiyen
 #ifndef PRINT_UTILS_H
 #define PRINT_UTILS_H
 
+#include "log.h"
+
 #include <stddef.h>
 
 typedef enum _print_type
@@ -20,6 +22,8 @@ typedef enum _print_type
 struct _decode_context;
 struct _jfif_component;
 
+// Note: Everything here goes through the log sink at LL_DEBUG, except print_block which takes its level.
+
 // Prints the jpeg header information obtained from APP0
 void print_jpeg_header(struct _decode_context* ctx, unsigned char jfif_major, unsigned char jfif_minor);
 
@@ -32,7 +36,7 @@ void print_huffman_info(unsigned char ht_header, unsigned char ht_count, unsigne
 // Prints the component information for a single jpeg channel
 void print_component_info(struct _jfif_component* component, unsigned char component_counter, unsigned char component_id);
 
-// Prints a single block to the console, and a caller specified header string
-void print_block(const char* header, const char* elem_fmt, void* block, size_t block_side_len, print_t type);
+// Logs a single block at the given level, and a caller specified header string
+void print_block(log_level_t level, const char* header, const char* elem_fmt, void* block, size_t block_side_len, print_t type);
 
 #endif
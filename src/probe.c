@@ -0,0 +1,186 @@
+/*--------------------------------------------------------------------------
+File:   probe.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "probe.h"
+
+#include "segment_index.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Length, precision, height, width and component count come before the component list.
+#define SOF_HEADER_LEN 8
+#define SOF_MAX_LEN (SOF_HEADER_LEN + MAX_COMPONENTS * 3)
+
+const char* probe_parse_frame_header(const unsigned char* segment, size_t segment_len, unsigned char frame_marker, jpeg_info_t* out_info)
+{
+  // Sample factor masks
+  static const unsigned char SF_VERT_MASK  = 0x0F; // 0b00001111
+  static const unsigned char SF_HORIZ_MASK = 0xF0; // 0b11110000
+
+  if (segment_len < SOF_HEADER_LEN || get_short(segment) < SOF_HEADER_LEN)
+    return "Frame header is too short.";
+
+  // Callers may hand over less than the declared length, as long as the component list is there.
+  if (get_short(segment) < segment_len)
+    segment_len = get_short(segment);
+
+  memset(out_info, 0, sizeof(jpeg_info_t));
+
+  out_info->frame_marker = frame_marker;
+  out_info->bits_per_sample = segment[2];
+
+  // The frame header stores the number of lines first.
+  out_info->height = get_short(segment + 3);
+  out_info->width = get_short(segment + 5);
+
+  const unsigned char num_components = segment[7];
+  if (num_components == 0 || num_components > MAX_COMPONENTS || SOF_HEADER_LEN + num_components * 3u > segment_len)
+    return "Invalid component count in frame header.";
+
+  out_info->num_components = num_components;
+
+  const unsigned char* component_it = segment + SOF_HEADER_LEN;
+  for (unsigned char i = 0; i != num_components; ++i, component_it += 3)
+  {
+    jfif_component_t* component = &out_info->components[i];
+
+    component->id = component_it[0];
+    component->sample_factor_vert  = (component_it[1] & SF_VERT_MASK );
+    component->sample_factor_horiz = (component_it[1] & SF_HORIZ_MASK) >> 4;
+    component->quant_table_id = component_it[2];
+
+    if (component->sample_factor_vert  < 1 || component->sample_factor_vert  > 4 ||
+        component->sample_factor_horiz < 1 || component->sample_factor_horiz > 4 || component->quant_table_id > 3)
+      return "Invalid sampling factors or quantization table in frame header.";
+  }
+
+  return NULL;
+}
+
+bool jpeg_planar_format_matches(const jpeg_info_t* info, jpeg_pixel_format_t format)
+{
+  // Planes are a byte per sample.
+  if (info->bits_per_sample != 8)
+    return false;
+
+  const jfif_component_t* c = info->components;
+  switch (format)
+  {
+    case JPF_NATIVE:
+      return info->num_components != 0;
+    case JPF_YUV444:
+      return info->num_components == 3 &&
+             c[0].sample_factor_horiz == c[1].sample_factor_horiz && c[1].sample_factor_horiz == c[2].sample_factor_horiz &&
+             c[0].sample_factor_vert  == c[1].sample_factor_vert  && c[1].sample_factor_vert  == c[2].sample_factor_vert;
+    case JPF_I420:
+    case JPF_NV12:
+      return info->num_components == 3 &&
+             c[0].sample_factor_horiz == 2 * c[1].sample_factor_horiz && c[1].sample_factor_horiz == c[2].sample_factor_horiz &&
+             c[0].sample_factor_vert  == 2 * c[1].sample_factor_vert  && c[1].sample_factor_vert  == c[2].sample_factor_vert;
+    default:
+      return false;
+  }
+}
+
+bool jpeg_plane_size(const jpeg_info_t* info, jpeg_pixel_format_t format, unsigned char plane, size_t* out_row_bytes, unsigned* out_rows)
+{
+  if (!jpeg_planar_format_matches(info, format) || plane >= info->num_components || (format == JPF_NV12 && plane > 1))
+    return false;
+
+  unsigned char h_max = 1, v_max = 1;
+  for (unsigned char c = 0; c != info->num_components; ++c)
+  {
+    if (info->components[c].sample_factor_horiz > h_max)
+      h_max = info->components[c].sample_factor_horiz;
+    if (info->components[c].sample_factor_vert > v_max)
+      v_max = info->components[c].sample_factor_vert;
+  }
+
+  // Component dimensions round up, see A.1.1 in the spec.
+  const jfif_component_t* component = &info->components[plane];
+  const size_t width = ((size_t)info->width * component->sample_factor_horiz + h_max - 1) / h_max;
+
+  *out_rows = (unsigned)(((size_t)info->height * component->sample_factor_vert + v_max - 1) / v_max);
+  *out_row_bytes = format == JPF_NV12 && plane == 1 ? width * 2 : width;
+  return true;
+}
+
+bool jpeg_probe(const unsigned char* buf, size_t len, jpeg_info_t* out_info)
+{
+  if (buf == NULL || out_info == NULL)
+    return false;
+
+  segment_index_t index = {0};
+  segment_index_build(buf, len, SI_STOP_AT_FRAME, &index);
+
+  // A truncated index is fine as long as it got as far as the frame header.
+  bool found = false;
+  if (index.count != 0)
+  {
+    const segment_entry_t* last = &index.entries[index.count - 1];
+    found = segment_is_frame_marker(last->marker) &&
+            probe_parse_frame_header(buf + last->offset, last->length, last->marker, out_info) == NULL;
+  }
+
+  segment_index_free(&index);
+  return found;
+}
+
+bool jpeg_probe_file(const char* path, jpeg_info_t* out_info)
+{
+  if (path == NULL || out_info == NULL)
+    return false;
+
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+    return false;
+
+  bool found = false;
+  for (int byte = fgetc(file); byte != EOF; byte = fgetc(file))
+  {
+    if (byte != JFIF_MFF)
+      continue;
+
+    // Skip any fill bytes in front of the marker.
+    int marker;
+    do
+    {
+      marker = fgetc(file);
+    } while (marker == JFIF_MFF);
+
+    // The frame header always comes before the first scan.
+    if (marker == EOF || marker == JFIF_SOS || marker == JFIF_EOI)
+      break;
+
+    if (marker == 0x00 || segment_is_standalone_marker((unsigned char)marker))
+      continue;
+
+    unsigned char segment[SOF_MAX_LEN];
+    if (fread(segment, 1, sizeof(unsigned short), file) != sizeof(unsigned short))
+      break;
+
+    const unsigned short segment_len = get_short(segment);
+    if (segment_len < sizeof(unsigned short))
+      break;
+
+    if (segment_is_frame_marker((unsigned char)marker))
+    {
+      // Anything past the last component isn't needed.
+      const size_t read_len = segment_len < SOF_MAX_LEN ? segment_len : SOF_MAX_LEN;
+      const size_t body_len = read_len - sizeof(unsigned short);
+
+      found = fread(segment + sizeof(unsigned short), 1, body_len, file) == body_len &&
+              probe_parse_frame_header(segment, read_len, (unsigned char)marker, out_info) == NULL;
+      break;
+    }
+
+    if (fseek(file, segment_len - sizeof(unsigned short), SEEK_CUR) != 0)
+      break;
+  }
+
+  fclose(file);
+  return found;
+}
@@ -0,0 +1,56 @@
+/*--------------------------------------------------------------------------/
+File:   probe.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef PROBE_H
+#define PROBE_H
+
+#include "decoder.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+----------------
+Probe:
+----------------
+Header only queries. Everything here stops at the first frame header,
+so the entropy coded data is never read, let alone decoded.
+*/
+typedef struct _jpeg_info
+{
+  unsigned short width;
+  unsigned short height;
+
+  unsigned char bits_per_sample;
+  unsigned char num_components;
+
+  // Which SOFn the frame came from. 0xC0 is baseline, 0xC1 extended, 0xC2 progressive...
+  unsigned char frame_marker;
+
+  // Id, sampling factors and quantization table per component.
+  jfif_component_t components[MAX_COMPONENTS];
+} jpeg_info_t;
+
+// True if the planar format is just a different name for how this frame is already sampled,
+// so it can be output without resampling. Packed formats and 12 bit frames are never a match.
+bool jpeg_planar_format_matches(const jpeg_info_t* info, jpeg_pixel_format_t format);
+
+// Bytes per row and number of rows of one plane of a planar format for this frame.
+// Returns false if the format doesn't match the frame or doesn't use that plane.
+bool jpeg_plane_size(const jpeg_info_t* info, jpeg_pixel_format_t format, unsigned char plane, size_t* out_row_bytes, unsigned* out_rows);
+
+// Parses a frame header starting at its length field. Shared with the decoder's SOF handler.
+// Only checks that the header is well formed, not whether the decoder supports it.
+// Returns NULL on success or a description of what is wrong with it.
+const char* probe_parse_frame_header(const unsigned char* segment, size_t segment_len, unsigned char frame_marker, jpeg_info_t* out_info);
+
+// Fills out_info from the first frame header in buf. buf can be just the start of the file,
+// as long as it reaches the end of the frame header. Returns false if no frame header was found.
+bool jpeg_probe(const unsigned char* buf, size_t len, jpeg_info_t* out_info);
+
+// Same as jpeg_probe, but reads the file itself. Segments before the frame header are seeked over,
+// so only the marker and length of each one is read.
+bool jpeg_probe_file(const char* path, jpeg_info_t* out_info);
+
+#endif
@@ -0,0 +1,153 @@
+/*--------------------------------------------------------------------------
+File:   profile.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 199309L
+
+#include "profile.h"
+
+#include <string.h>
+#include <time.h>
+
+#if ENABLE_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define READ_CYCLES() __rdtsc()
+#else
+// No cheap cycle counter available, fall back to nanoseconds.
+static unsigned long long read_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+#define READ_CYCLES() read_ns()
+#endif
+#endif
+
+static double s_stage_seconds[PS_COUNT];
+static unsigned long long s_stage_cycles[PS_COUNT];
+
+#if ENABLE_PROFILE
+__thread unsigned long long profile_counters[PC_COUNT];
+
+static struct timespec s_stage_start[PS_COUNT];
+static unsigned long long s_stage_start_cycles[PS_COUNT];
+#endif
+
+static const char* STAGE_NAMES[PS_COUNT] =
+{
+  "marker_parse",
+  "unstuff",
+  "entropy_decode",
+  "idct",
+  "color_convert"
+};
+
+static const char* COUNTER_NAMES[PC_COUNT] =
+{
+  "blocks",
+  "dc_only_blocks",
+  "symbols",
+  "eobs",
+  "code_bits",
+  "fast_symbols"
+};
+
+void profile_reset(void)
+{
+  memset(s_stage_seconds, 0, sizeof(s_stage_seconds));
+  memset(s_stage_cycles, 0, sizeof(s_stage_cycles));
+#if ENABLE_PROFILE
+  memset(profile_counters, 0, sizeof(profile_counters));
+#endif
+}
+
+double profile_get_stage_seconds(profile_stage_t stage)
+{
+  if (stage >= PS_COUNT)
+    return 0.0;
+
+  return s_stage_seconds[stage];
+}
+
+const char* profile_get_stage_name(profile_stage_t stage)
+{
+  if (stage >= PS_COUNT)
+    return "unknown";
+
+  return STAGE_NAMES[stage];
+}
+
+const char* profile_get_counter_name(profile_counter_t counter)
+{
+  if (counter >= PC_COUNT)
+    return "unknown";
+
+  return COUNTER_NAMES[counter];
+}
+
+void profile_get_stats(profile_stats_t* out_stats)
+{
+  if (out_stats == NULL)
+    return;
+
+  memcpy(out_stats->stage_seconds, s_stage_seconds, sizeof(s_stage_seconds));
+  memcpy(out_stats->stage_cycles, s_stage_cycles, sizeof(s_stage_cycles));
+#if ENABLE_PROFILE
+  memcpy(out_stats->counters, profile_counters, sizeof(profile_counters));
+#else
+  memset(out_stats->counters, 0, sizeof(out_stats->counters));
+#endif
+}
+
+double profile_get_avg_code_len(const profile_stats_t* stats)
+{
+  if (stats == NULL || stats->counters[PC_SYMBOLS] == 0)
+    return 0.0;
+
+  return (double)stats->counters[PC_CODE_BITS] / (double)stats->counters[PC_SYMBOLS];
+}
+
+void profile_print_stats(FILE* out)
+{
+  if (out == NULL)
+    return;
+
+  profile_stats_t stats;
+  profile_get_stats(&stats);
+
+  fprintf(out, "+----------------------+----------------+------------------+\n");
+  fprintf(out, "| Stage                |    Seconds     |      Cycles      |\n");
+  fprintf(out, "+----------------------+----------------+------------------+\n");
+  for (unsigned s = 0; s != PS_COUNT; ++s)
+  {
+    fprintf(out, "| %-20s | %14.6f | %16llu |\n", STAGE_NAMES[s], stats.stage_seconds[s], stats.stage_cycles[s]);
+  }
+  fprintf(out, "+----------------------+----------------+------------------+\n");
+  for (unsigned c = 0; c != PC_COUNT; ++c)
+  {
+    fprintf(out, "| %-20s | %33llu |\n", COUNTER_NAMES[c], stats.counters[c]);
+  }
+  fprintf(out, "| %-20s | %33.3f |\n", "avg_code_len", profile_get_avg_code_len(&stats));
+  fprintf(out, "+----------------------+-----------------------------------+\n");
+}
+
+#if ENABLE_PROFILE
+void profile_stage_begin(profile_stage_t stage)
+{
+  clock_gettime(CLOCK_MONOTONIC, &s_stage_start[stage]);
+  s_stage_start_cycles[stage] = READ_CYCLES();
+}
+
+void profile_stage_end(profile_stage_t stage)
+{
+  s_stage_cycles[stage] += READ_CYCLES() - s_stage_start_cycles[stage];
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  const struct timespec* start = &s_stage_start[stage];
+  s_stage_seconds[stage] += (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+#endif
@@ -0,0 +1,85 @@
+/*--------------------------------------------------------------------------/
+File:   profile.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+// Instrumentation switch. When 0 every PROFILE_* macro compiles to nothing and the
+// hot paths carry no timing or counting overhead. The Makefile sets this via PROFILE=0|1.
+#ifndef ENABLE_PROFILE
+#define ENABLE_PROFILE 1
+#endif
+
+// Decode pipeline stages that are timed individually.
+typedef enum _profile_stage
+{
+  PS_MARKER_PARSE,
+  PS_UNSTUFF,
+  PS_ENTROPY_DECODE,
+  PS_IDCT,
+  PS_COLOR_CONVERT,
+  PS_COUNT
+} profile_stage_t;
+
+// Event counters bumped from the entropy decoder.
+typedef enum _profile_counter
+{
+  PC_BLOCKS,         // 8x8 blocks decoded
+  PC_DC_ONLY_BLOCKS, // Blocks whose first AC symbol was an EOB
+  PC_SYMBOLS,        // Huffman symbols decoded (DC and AC)
+  PC_EOBS,           // End of block symbols
+  PC_CODE_BITS,      // Sum of the lengths of every decoded huffman code
+  PC_FAST_SYMBOLS,   // Symbols decoded along with their value by a single fast table probe
+  PC_COUNT
+} profile_counter_t;
+
+// Snapshot of everything gathered since the last reset.
+typedef struct _profile_stats
+{
+  double stage_seconds[PS_COUNT];
+  unsigned long long stage_cycles[PS_COUNT];
+  unsigned long long counters[PC_COUNT];
+} profile_stats_t;
+
+// Clears all accumulated stage timings and counters.
+void profile_reset(void);
+
+// Returns the seconds accumulated in a stage since the last reset.
+double profile_get_stage_seconds(profile_stage_t stage);
+
+// Returns a short, machine friendly name for the stage. eg: "entropy_decode"
+const char* profile_get_stage_name(profile_stage_t stage);
+
+// Returns a short, machine friendly name for the counter. eg: "dc_only_blocks"
+const char* profile_get_counter_name(profile_counter_t counter);
+
+// Copies the current timings and counters into out_stats.
+void profile_get_stats(profile_stats_t* out_stats);
+
+// Average huffman code length in bits, or 0 if no symbols were decoded.
+double profile_get_avg_code_len(const profile_stats_t* stats);
+
+// Writes a human readable table of the current stats to out.
+void profile_print_stats(FILE* out);
+
+#if ENABLE_PROFILE
+// Exposed so the counting macro stays a single add on the hot path. Each thread counts into its own, so the
+// parallel entropy decoder's threads never race, and it hands back only what the real stream decoded.
+extern __thread unsigned long long profile_counters[PC_COUNT];
+
+void profile_stage_begin(profile_stage_t stage);
+void profile_stage_end(profile_stage_t stage);
+
+#define PROFILE_BEGIN(stage)        profile_stage_begin(stage)
+#define PROFILE_END(stage)          profile_stage_end(stage)
+#define PROFILE_COUNT(counter, n)   (profile_counters[counter] += (n))
+#else
+#define PROFILE_BEGIN(stage)        ((void)0)
+#define PROFILE_END(stage)          ((void)0)
+#define PROFILE_COUNT(counter, n)   ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/*--------------------------------------------------------------------------
+File:   segment_index.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "segment_index.h"
+
+#include "bitstream.h"
+#include "decoder.h"
+#include "mem_budget.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SEGMENT_INDEX_INITIAL_CAPACITY 32
+
+bool segment_is_standalone_marker(unsigned char marker)
+{
+  return marker == JFIF_SOI || marker == JFIF_EOI || marker == JFIF_TEM ||
+         (marker >= JFIF_RST0 && marker <= JFIF_RST7);
+}
+
+bool segment_is_frame_marker(unsigned char marker)
+{
+  // SOF0 through SOF15, minus the three codes in that range that mean something else.
+  return marker >= 0xC0 && marker <= 0xCF && marker != JFIF_DHT && marker != 0xC8 && marker != 0xCC;
+}
+
+static bool append_entry(segment_index_t* index, unsigned char marker, size_t offset, size_t length)
+{
+  if (index->count == index->capacity)
+  {
+    const size_t capacity = index->capacity ? index->capacity * 2 : SEGMENT_INDEX_INITIAL_CAPACITY;
+    segment_entry_t* entries = (segment_entry_t*)mem_realloc(index->entries, sizeof(segment_entry_t) * capacity);
+    if (entries == NULL)
+      return false;
+
+    index->entries = entries;
+    index->capacity = capacity;
+  }
+
+  segment_entry_t* entry = &index->entries[index->count++];
+  entry->marker = marker;
+  entry->offset = offset;
+  entry->length = length;
+  return true;
+}
+
+bool segment_index_build(const unsigned char* buf, size_t len, unsigned flags, segment_index_t* index)
+{
+  index->count = 0;
+  index->truncated = false;
+
+  size_t pos = 0;
+  while (pos + 1 < len)
+  {
+    if (buf[pos] != JFIF_MFF)
+    {
+      // Junk between segments. Jump straight to the next candidate.
+      const unsigned char* next = (const unsigned char*)memchr(buf + pos, JFIF_MFF, len - pos);
+      if (next == NULL)
+        break;
+
+      pos = (size_t)(next - buf);
+      continue;
+    }
+
+    const unsigned char marker = buf[pos + 1];
+    if (marker == JFIF_MFF)
+    {
+      // Fill byte in front of a marker.
+      ++pos;
+      continue;
+    }
+
+    if (marker == 0x00)
+    {
+      // A stuffed byte outside of a scan. Not a marker.
+      pos += 2;
+      continue;
+    }
+
+    const size_t offset = pos + 2;
+    size_t length = 0;
+
+    if (!segment_is_standalone_marker(marker))
+    {
+      if (len - offset < sizeof(unsigned short))
+      {
+        index->truncated = true;
+        break;
+      }
+
+      length = get_short(buf + offset);
+      if (length < sizeof(unsigned short) || length > len - offset)
+      {
+        index->truncated = true;
+        break;
+      }
+
+      // The entropy coded data belongs to the scan, up to the next marker that isn't RSTn.
+      // Header only queries never look at it.
+      if (marker == JFIF_SOS && !(flags & SI_STOP_AT_FRAME))
+        length += bitstream_scan_length(buf + offset + length, len - offset - length);
+    }
+
+    if (!append_entry(index, marker, offset, length))
+      return false;
+
+    pos = offset + length;
+
+    if (marker == JFIF_EOI)
+      break;
+
+    if ((flags & SI_STOP_AT_FRAME) && (segment_is_frame_marker(marker) || marker == JFIF_SOS))
+      break;
+  }
+
+  return !index->truncated;
+}
+
+void segment_index_free(segment_index_t* index)
+{
+  mem_free(index->entries);
+  index->entries = NULL;
+  index->count = index->capacity = 0;
+}
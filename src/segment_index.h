@@ -0,0 +1,60 @@
+/*--------------------------------------------------------------------------/
+File:   segment_index.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef SEGMENT_INDEX_H
+#define SEGMENT_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+----------------
+Segment Index:
+----------------
+One pass over the file that finds every marker before anything is decoded.
+Segments with a length field are jumped over without looking at their contents,
+and the only bytes that get searched are the entropy coded data after SOS and any
+junk between segments. Both are searched for 0xFF with memchr, which is vectorized.
+*/
+typedef struct _segment_entry
+{
+  unsigned char marker;
+
+  // Offset of the first byte after the marker.
+  size_t offset;
+
+  // Bytes up to the next marker. For SOS this is the header plus its entropy coded data.
+  size_t length;
+} segment_entry_t;
+
+typedef struct _segment_index
+{
+  segment_entry_t* entries;
+  size_t count;
+  size_t capacity;
+
+  // Set if indexing stopped on a segment that doesn't fit in the file.
+  bool truncated;
+} segment_index_t;
+
+// Flags for segment_index_build
+enum
+{
+  SI_STOP_AT_FRAME = 1 << 0 // Stop once the first start of frame (or a scan, which can't come before one) is indexed.
+};
+
+// True for the SOFn markers, which all share the same header layout.
+bool segment_is_frame_marker(unsigned char marker);
+
+// True for markers that aren't followed by a length field.
+bool segment_is_standalone_marker(unsigned char marker);
+
+// Indexes buf from its first marker until EOI, the end of the buffer or a stop flag.
+// Returns false if memory ran out or the index is truncated. Whatever was indexed before that is kept.
+bool segment_index_build(const unsigned char* buf, size_t len, unsigned flags, segment_index_t* index);
+
+// Releases the entries. The index can be built again afterwards.
+void segment_index_free(segment_index_t* index);
+
+#endif
@@ -0,0 +1,230 @@
+/*--------------------------------------------------------------------------
+File:   thumbnail.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "thumbnail.h"
+
+#include "probe.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Area filter from the scaled decode to the thumbnail. Both axes work in units where an input
+pixel is out_size long and an output pixel in_size long, so every boundary is an integer and
+each input pixel's share of an output pixel is exact.
+*/
+typedef struct _thumbnail_state
+{
+  jpeg_encoder_t encoder;
+  unsigned char channels;
+
+  unsigned in_width;
+  unsigned in_height;
+  unsigned out_width;
+  unsigned out_height;
+
+  // Horizontal taps: output pixel x sums inputs tap_inputs[tap_offsets[x]..tap_offsets[x + 1]).
+  unsigned* tap_offsets;
+  unsigned* tap_inputs;
+  float* tap_weights;
+
+  // The current input row filtered horizontally, and the output row being built from them.
+  float* filtered_row;
+  float* accumulated_row;
+  unsigned char* out_row;
+
+  unsigned in_row;
+  unsigned out_row_idx;
+} thumbnail_state_t;
+
+void jpeg_thumbnail_size(unsigned width, unsigned height, const jpeg_thumbnail_params_t* params,
+                         unsigned short* out_width, unsigned short* out_height)
+{
+  unsigned long long w = width, h = height;
+  if (w > params->max_width || h > params->max_height)
+  {
+    // Whichever side runs into the box first decides the scale.
+    if (w * params->max_height > h * params->max_width)
+    {
+      h = (h * params->max_width + w / 2) / w;
+      w = params->max_width;
+    }
+    else
+    {
+      w = (w * params->max_height + h / 2) / h;
+      h = params->max_height;
+    }
+  }
+
+  *out_width = (unsigned short)(w ? w : 1);
+  *out_height = (unsigned short)(h ? h : 1);
+}
+
+static void thumbnail_state_cleanup(thumbnail_state_t* state)
+{
+  free(state->tap_offsets);
+  free(state->tap_inputs);
+  free(state->tap_weights);
+  free(state->filtered_row);
+  free(state->accumulated_row);
+  free(state->out_row);
+}
+
+static bool thumbnail_state_init(thumbnail_state_t* state)
+{
+  const unsigned in_w = state->in_width, out_w = state->out_width;
+
+  // An output pixel covers in_w / out_w inputs, plus one more on each side for the partial ones.
+  const size_t max_taps = (size_t)out_w * (in_w / out_w + 2);
+  state->tap_offsets = (unsigned*)malloc(sizeof(unsigned) * (out_w + 1));
+  state->tap_inputs = (unsigned*)malloc(sizeof(unsigned) * max_taps);
+  state->tap_weights = (float*)malloc(sizeof(float) * max_taps);
+  state->filtered_row = (float*)malloc(sizeof(float) * out_w * state->channels);
+  state->accumulated_row = (float*)calloc((size_t)out_w * state->channels, sizeof(float));
+  state->out_row = (unsigned char*)malloc((size_t)out_w * state->channels);
+
+  if (!state->tap_offsets || !state->tap_inputs || !state->tap_weights || !state->filtered_row || !state->accumulated_row || !state->out_row)
+    return false;
+
+  unsigned tap = 0;
+  for (unsigned x = 0; x != out_w; ++x)
+  {
+    state->tap_offsets[x] = tap;
+
+    const unsigned long long begin = (unsigned long long)x * in_w, end = begin + in_w;
+    for (unsigned long long i = begin / out_w; i * out_w < end; ++i)
+    {
+      const unsigned long long lo = i * out_w > begin ? i * out_w : begin;
+      const unsigned long long hi = (i + 1) * out_w < end ? (i + 1) * out_w : end;
+
+      state->tap_inputs[tap] = (unsigned)i;
+      state->tap_weights[tap] = (float)(hi - lo) / (float)in_w;
+      ++tap;
+    }
+  }
+  state->tap_offsets[out_w] = tap;
+
+  return true;
+}
+
+static bool emit_row(thumbnail_state_t* state)
+{
+  const size_t samples = (size_t)state->out_width * state->channels;
+  for (size_t i = 0; i != samples; ++i)
+  {
+    const float value = state->accumulated_row[i] + 0.5f;
+    state->out_row[i] = value <= 0.0f ? 0 : (value >= 255.0f ? 255 : (unsigned char)value);
+  }
+
+  memset(state->accumulated_row, 0, sizeof(float) * samples);
+  ++state->out_row_idx;
+  return jpeg_encoder_write_rows(&state->encoder, state->out_row, (ptrdiff_t)samples, 1);
+}
+
+static bool resample_row(thumbnail_state_t* state, const unsigned char* row)
+{
+  const unsigned char channels = state->channels;
+
+  for (unsigned x = 0; x != state->out_width; ++x)
+  {
+    float sums[3] = {0};
+    for (unsigned tap = state->tap_offsets[x]; tap != state->tap_offsets[x + 1]; ++tap)
+    {
+      const unsigned char* in = row + (size_t)state->tap_inputs[tap] * channels;
+      for (unsigned char c = 0; c != channels; ++c)
+        sums[c] += state->tap_weights[tap] * in[c];
+    }
+
+    memcpy(state->filtered_row + (size_t)x * channels, sums, sizeof(float) * channels);
+  }
+
+  // Spread the row over the one or two output rows it overlaps.
+  const size_t samples = (size_t)state->out_width * channels;
+  unsigned long long lo = (unsigned long long)state->in_row * state->out_height;
+  const unsigned long long hi = lo + state->out_height;
+  ++state->in_row;
+
+  while (lo < hi && state->out_row_idx != state->out_height)
+  {
+    const unsigned long long row_end = (unsigned long long)(state->out_row_idx + 1) * state->in_height;
+    const unsigned long long end = hi < row_end ? hi : row_end;
+    const float weight = (float)(end - lo) / (float)state->in_height;
+
+    for (size_t i = 0; i != samples; ++i)
+      state->accumulated_row[i] += weight * state->filtered_row[i];
+
+    lo = end;
+    if (end == row_end && !emit_row(state))
+      return false;
+  }
+
+  return true;
+}
+
+static bool thumbnail_row_sink(void* user, const unsigned char* rows, ptrdiff_t stride, unsigned first_row, unsigned row_count)
+{
+  thumbnail_state_t* state = (thumbnail_state_t*)user;
+
+  // The DCT scaling alone got it to size.
+  if (state->in_width == state->out_width && state->in_height == state->out_height)
+    return jpeg_encoder_write_rows(&state->encoder, rows, stride, row_count);
+
+  for (unsigned r = 0; r != row_count; ++r)
+  {
+    if (!resample_row(state, rows + (ptrdiff_t)r * stride))
+      return false;
+  }
+
+  return true;
+}
+
+bool jpeg_thumbnail(const unsigned char* img_buf, size_t byte_size, const jpeg_thumbnail_params_t* params,
+                    unsigned char** out_buf, size_t* out_len)
+{
+  if (img_buf == NULL || params == NULL || out_buf == NULL || out_len == NULL || params->max_width == 0 || params->max_height == 0)
+    return false;
+
+  jpeg_info_t info;
+  if (!jpeg_probe(img_buf, byte_size, &info) || info.width == 0 || info.height == 0)
+    return false;
+
+  unsigned short width, height;
+  jpeg_thumbnail_size(info.width, info.height, params, &width, &height);
+
+  // Let the IDCT do as much of the shrinking as it can without going under the target.
+  unsigned char scale = 8;
+  while (scale > 1 && (jpeg_scaled_size(info.width, scale) < width || jpeg_scaled_size(info.height, scale) < height))
+    scale /= 2;
+
+  thumbnail_state_t state;
+  memset(&state, 0, sizeof(state));
+  state.channels = info.num_components == 1 ? 1 : 3;
+  state.in_width = jpeg_scaled_size(info.width, scale);
+  state.in_height = jpeg_scaled_size(info.height, scale);
+  state.out_width = width;
+  state.out_height = height;
+
+  jpeg_output_t output = {0};
+  output.format = state.channels == 1 ? JPF_GRAY8 : JPF_RGB24;
+  output.scale_denom = scale;
+  output.row_sink = thumbnail_row_sink;
+  output.row_sink_user = &state;
+
+  if (!thumbnail_state_init(&state) || !jpeg_encoder_init(&state.encoder, width, height, output.format, &params->encode))
+  {
+    thumbnail_state_cleanup(&state);
+    return false;
+  }
+
+  if (!jpeg_decode_to(img_buf, byte_size, &output))
+  {
+    jpeg_encoder_cleanup(&state.encoder);
+    thumbnail_state_cleanup(&state);
+    return false;
+  }
+
+  *out_buf = jpeg_encoder_finish(&state.encoder, out_len);
+  thumbnail_state_cleanup(&state);
+  return *out_buf != NULL;
+}
@@ -0,0 +1,40 @@
+/*--------------------------------------------------------------------------/
+File:   thumbnail.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include "encoder.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+----------------
+Thumbnails:
+----------------
+Decode, downscale and encode as one stream. The decoder's row sink hands over each MCU row,
+already shrunk by the largest power of two the DCT can drop for free, an area filter takes it
+the rest of the way, and finished rows go straight into the encoder. Only a few MCU rows of
+pixels are ever held, whatever the size of the source, unless jpeg_set_entropy_threads turned
+on parallel scans and the memory limit has room for the whole frame.
+*/
+typedef struct _jpeg_thumbnail_params
+{
+  // Box the thumbnail has to fit in. The aspect ratio is kept and images are never upscaled.
+  unsigned short max_width;
+  unsigned short max_height;
+
+  jpeg_encode_params_t encode;
+} jpeg_thumbnail_params_t;
+
+// Size of the thumbnail an image this big gets.
+void jpeg_thumbnail_size(unsigned width, unsigned height, const jpeg_thumbnail_params_t* params,
+                         unsigned short* out_width, unsigned short* out_height);
+
+// Writes a new JPEG to out_buf, to be freed by the caller. Returns false if the source doesn't decode.
+bool jpeg_thumbnail(const unsigned char* img_buf, size_t byte_size, const jpeg_thumbnail_params_t* params,
+                    unsigned char** out_buf, size_t* out_len);
+
+#endif
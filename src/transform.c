@@ -0,0 +1,218 @@
+/*--------------------------------------------------------------------------
+File:   transform.c
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#include "transform.h"
+
+#include "dct_utils.h"
+#include "jpeg_writer.h"
+#include "mem_budget.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+jpeg_transform_op_t jpeg_transform_from_exif_orientation(unsigned orientation)
+{
+  static const jpeg_transform_op_t EXIF_OPS[9] =
+  {
+    JXF_NONE, JXF_NONE, JXF_FLIP_H, JXF_ROTATE_180, JXF_FLIP_V, JXF_TRANSPOSE, JXF_ROTATE_90, JXF_TRANSVERSE, JXF_ROTATE_270
+  };
+
+  return orientation < 9 ? EXIF_OPS[orientation] : JXF_NONE;
+}
+
+static bool op_transposes(jpeg_transform_op_t op)
+{
+  return op == JXF_TRANSPOSE || op == JXF_TRANSVERSE || op == JXF_ROTATE_90 || op == JXF_ROTATE_270;
+}
+
+// Whether the source's x or y axis ends up running backwards.
+static bool op_mirrors_x(jpeg_transform_op_t op)
+{
+  return op == JXF_FLIP_H || op == JXF_ROTATE_180 || op == JXF_ROTATE_270 || op == JXF_TRANSVERSE;
+}
+
+static bool op_mirrors_y(jpeg_transform_op_t op)
+{
+  return op == JXF_FLIP_V || op == JXF_ROTATE_180 || op == JXF_ROTATE_90 || op == JXF_TRANSVERSE;
+}
+
+// Where each coefficient of an output block comes from. Mirroring a block in the pixel domain
+// flips the sign of every odd frequency along that axis, transposing it transposes the coefficients.
+static void build_block_mapping(jpeg_transform_op_t op, unsigned char* out_src_idx, signed char* out_sign)
+{
+  const bool transposed = op_transposes(op);
+
+  for (unsigned char v = 0; v != DCT_BLOCK_SIDE; ++v)
+  {
+    for (unsigned char u = 0; u != DCT_BLOCK_SIDE; ++u)
+    {
+      bool negate = false;
+      switch (op)
+      {
+        case JXF_FLIP_H:
+        case JXF_ROTATE_90:
+          negate = u & 1;
+          break;
+        case JXF_FLIP_V:
+        case JXF_ROTATE_270:
+          negate = v & 1;
+          break;
+        case JXF_ROTATE_180:
+        case JXF_TRANSVERSE:
+          negate = (u + v) & 1;
+          break;
+        default:
+          break;
+      }
+
+      const unsigned char idx = v * DCT_BLOCK_SIDE + u;
+      out_src_idx[idx] = transposed ? u * DCT_BLOCK_SIDE + v : idx;
+      out_sign[idx] = negate ? -1 : 1;
+    }
+  }
+}
+
+// Maps a block position in the transformed image back to the source grid.
+// mirror_w and mirror_h are the block extents of the mirrored (trimmed) axes.
+static void map_block(jpeg_transform_op_t op, long tx, long ty, long mirror_w, long mirror_h, long* out_sx, long* out_sy)
+{
+  switch (op)
+  {
+    case JXF_FLIP_H:     *out_sx = mirror_w - 1 - tx; *out_sy = ty;                break;
+    case JXF_FLIP_V:     *out_sx = tx;                *out_sy = mirror_h - 1 - ty; break;
+    case JXF_ROTATE_180: *out_sx = mirror_w - 1 - tx; *out_sy = mirror_h - 1 - ty; break;
+    case JXF_TRANSPOSE:  *out_sx = ty;                *out_sy = tx;                break;
+    case JXF_ROTATE_90:  *out_sx = ty;                *out_sy = mirror_h - 1 - tx; break;
+    case JXF_ROTATE_270: *out_sx = mirror_w - 1 - ty; *out_sy = tx;                break;
+    case JXF_TRANSVERSE: *out_sx = mirror_w - 1 - ty; *out_sy = mirror_h - 1 - tx; break;
+    default:             *out_sx = tx;                *out_sy = ty;                break;
+  }
+}
+
+bool jpeg_transform_coefficients(const jpeg_coefficients_t* src, const jpeg_transform_t* transform, jpeg_coefficients_t* out)
+{
+  if (src == NULL || transform == NULL || out == NULL)
+    return false;
+
+  memset(out, 0, sizeof(jpeg_coefficients_t));
+
+  const jpeg_transform_op_t op = transform->op;
+  const unsigned char num_components = src->num_components;
+  if (op >= JXF_COUNT || num_components == 0 || num_components > MAX_COMPONENTS)
+    return false;
+
+  // A single component is laid out one block per MCU, whatever its factors say.
+  unsigned char h_factors[MAX_COMPONENTS], v_factors[MAX_COMPONENTS];
+  unsigned char h_max = 1, v_max = 1;
+  for (unsigned char c = 0; c != num_components; ++c)
+  {
+    h_factors[c] = num_components == 1 ? 1 : src->components[c].component.sample_factor_horiz;
+    v_factors[c] = num_components == 1 ? 1 : src->components[c].component.sample_factor_vert;
+    h_max = h_factors[c] > h_max ? h_factors[c] : h_max;
+    v_max = v_factors[c] > v_max ? v_factors[c] : v_max;
+  }
+
+  const unsigned mcu_w = h_max * 8u, mcu_h = v_max * 8u;
+  const bool transposed = op_transposes(op);
+
+  // Trim the partial MCU off any axis that gets mirrored.
+  const unsigned src_w = op_mirrors_x(op) ? src->width / mcu_w * mcu_w : src->width;
+  const unsigned src_h = op_mirrors_y(op) ? src->height / mcu_h * mcu_h : src->height;
+  if (src_w == 0 || src_h == 0)
+    return false;
+
+  const unsigned full_w = transposed ? src_h : src_w, full_h = transposed ? src_w : src_h;
+  const unsigned out_mcu_w = transposed ? mcu_h : mcu_w, out_mcu_h = transposed ? mcu_w : mcu_h;
+
+  if (transform->crop_x % out_mcu_w != 0 || transform->crop_y % out_mcu_h != 0 ||
+      transform->crop_x >= full_w || transform->crop_y >= full_h)
+    return false;
+
+  const unsigned out_w = transform->crop_width ? transform->crop_width : full_w - transform->crop_x;
+  const unsigned out_h = transform->crop_height ? transform->crop_height : full_h - transform->crop_y;
+  if (transform->crop_x + out_w > full_w || transform->crop_y + out_h > full_h)
+    return false;
+
+  out->width = (unsigned short)out_w;
+  out->height = (unsigned short)out_h;
+  out->num_components = num_components;
+  out->adobe_transform = src->adobe_transform;
+
+  unsigned char src_idx[DCT_BLOCK_SIZE];
+  signed char sign[DCT_BLOCK_SIZE];
+  build_block_mapping(op, src_idx, sign);
+
+  const unsigned x_mcus = (out_w + out_mcu_w - 1) / out_mcu_w, y_mcus = (out_h + out_mcu_h - 1) / out_mcu_h;
+
+  for (unsigned char c = 0; c != num_components; ++c)
+  {
+    const jpeg_component_coefficients_t* src_component = &src->components[c];
+    jpeg_component_coefficients_t* out_component = &out->components[c];
+
+    const unsigned char out_h_factor = transposed ? v_factors[c] : h_factors[c];
+    const unsigned char out_v_factor = transposed ? h_factors[c] : v_factors[c];
+
+    out_component->component = src_component->component;
+    if (transposed)
+    {
+      out_component->component.sample_factor_horiz = src_component->component.sample_factor_vert;
+      out_component->component.sample_factor_vert = src_component->component.sample_factor_horiz;
+    }
+
+    for (unsigned char i = 0; i != QUANT_TABLE_SIZE; ++i)
+      out_component->quant_table[i] = src_component->quant_table[src_idx[i]];
+
+    out_component->blocks_wide = x_mcus * out_h_factor;
+    out_component->blocks_high = y_mcus * out_v_factor;
+    out_component->blocks = (int16_t*)mem_calloc((size_t)out_component->blocks_wide * out_component->blocks_high, sizeof(int16_t) * DCT_BLOCK_SIZE);
+    if (out_component->blocks == NULL)
+    {
+      jpeg_coefficients_free(out);
+      return false;
+    }
+
+    // Block extents of the trimmed source, in this component's resolution.
+    const long mirror_w = (long)(src_w / mcu_w) * h_factors[c];
+    const long mirror_h = (long)(src_h / mcu_h) * v_factors[c];
+    const long offset_x = (long)(transform->crop_x / out_mcu_w) * out_h_factor;
+    const long offset_y = (long)(transform->crop_y / out_mcu_h) * out_v_factor;
+
+    for (unsigned y = 0; y != out_component->blocks_high; ++y)
+    {
+      for (unsigned x = 0; x != out_component->blocks_wide; ++x)
+      {
+        long sx, sy;
+        map_block(op, x + offset_x, y + offset_y, mirror_w, mirror_h, &sx, &sy);
+
+        // Padding blocks past the source grid stay zero.
+        if (sx < 0 || sy < 0 || (unsigned long)sx >= src_component->blocks_wide || (unsigned long)sy >= src_component->blocks_high)
+          continue;
+
+        const int16_t* src_block = src_component->blocks + ((size_t)sy * src_component->blocks_wide + (size_t)sx) * DCT_BLOCK_SIZE;
+        int16_t* out_block = out_component->blocks + ((size_t)y * out_component->blocks_wide + x) * DCT_BLOCK_SIZE;
+
+        for (unsigned char i = 0; i != DCT_BLOCK_SIZE; ++i)
+          out_block[i] = (int16_t)(sign[i] * src_block[src_idx[i]]);
+      }
+    }
+  }
+
+  return true;
+}
+
+bool jpeg_transform_buffer(const unsigned char* img_buf, size_t byte_size, const jpeg_transform_t* transform,
+                           unsigned char** out_buf, size_t* out_len)
+{
+  jpeg_coefficients_t src;
+  if (!jpeg_decode_coefficients(img_buf, byte_size, &src))
+    return false;
+
+  jpeg_coefficients_t transformed = {0};
+  const bool success = jpeg_transform_coefficients(&src, transform, &transformed) &&
+                       jpeg_write_coefficients(&transformed, transform->optimize_huffman, out_buf, out_len);
+
+  jpeg_coefficients_free(&src);
+  jpeg_coefficients_free(&transformed);
+  return success;
+}
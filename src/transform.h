@@ -0,0 +1,61 @@
+/*--------------------------------------------------------------------------/
+File:   transform.h
+Date:   2026/10/19
+---------------------------------------------------------------------------*/
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "decoder.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+----------------
+Lossless Transforms:
+----------------
+Rotations, flips and crops done on the quantized DCT blocks. Blocks move around the grid
+and coefficients inside a block get transposed or change sign, nothing is requantized.
+Mirroring an axis only works on whole MCUs, so a partial MCU at the edge that would end up
+on the other side is trimmed off instead, like jpegtran -trim.
+*/
+typedef enum _jpeg_transform_op
+{
+  JXF_NONE,
+  JXF_FLIP_H,     // Mirror left to right
+  JXF_FLIP_V,     // Mirror top to bottom
+  JXF_TRANSPOSE,  // Across the top left to bottom right diagonal
+  JXF_TRANSVERSE, // Across the top right to bottom left diagonal
+  JXF_ROTATE_90,  // Clockwise
+  JXF_ROTATE_180,
+  JXF_ROTATE_270,
+  JXF_COUNT
+} jpeg_transform_op_t;
+
+typedef struct _jpeg_transform
+{
+  jpeg_transform_op_t op;
+
+  // Crop rectangle in the transformed image. The corner has to sit on an MCU boundary,
+  // the size doesn't. A width or height of 0 runs to the edge.
+  unsigned short crop_x;
+  unsigned short crop_y;
+  unsigned short crop_width;
+  unsigned short crop_height;
+
+  // jpeg_transform_buffer only: re-encode with Huffman tables built for the result.
+  bool optimize_huffman;
+} jpeg_transform_t;
+
+// The transform that displays an image with this EXIF orientation (1-8) upright. JXF_NONE for anything else.
+jpeg_transform_op_t jpeg_transform_from_exif_orientation(unsigned orientation);
+
+// Writes the transformed coefficients to out. Free them with jpeg_coefficients_free.
+// Returns false if the crop doesn't fit or lands off an MCU boundary, or if trimming leaves nothing.
+bool jpeg_transform_coefficients(const jpeg_coefficients_t* src, const jpeg_transform_t* transform, jpeg_coefficients_t* out);
+
+// Decode, transform and re-encode in one go. The result is a new baseline JPEG, free it with free().
+bool jpeg_transform_buffer(const unsigned char* img_buf, size_t byte_size, const jpeg_transform_t* transform,
+                           unsigned char** out_buf, size_t* out_len);
+
+#endif
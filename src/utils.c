@@ -6,37 +6,6 @@ Author: kaiyen
 
 #include "utils.h"
 
-int read_stream(const unsigned char *src, unsigned offset, unsigned count, unsigned accum)
-{
-// Base of recursion
-if (count == 0)
-return accum;
-
-// Look at the source, how many bits there left in the current byte
-const unsigned char *cur_src = src + offset / 8;
-const unsigned bits_left = 8 - offset % 8;
-const unsigned char cur_data = *cur_src << (8 - bits_left);
-
-// How many bits we need and can write now
-const unsigned bits_to_use = bits_left < count ? bits_left : count;
-
-// Write the desired bits to the accumulator
-accum <<= bits_to_use;
-unsigned char mask = (1 << bits_to_use) - 1;
-const unsigned off = 8 - bits_to_use;
-accum |= (cur_data & (mask << off)) >> off;
-
-// Tail-recurse into the rest of required bits
-return read_stream(src, offset + bits_to_use, count - bits_to_use, accum);
-}
-
-// See Table 5 in https://www.impulseadventure.com/photo/jpeg-huffman-coding.html
-int dc_ac_value_decode(int read_bits, unsigned bit_count)
-{
-  const int sign = 1 << (bit_count - 1);
-  return read_bits & sign ? read_bits : (read_bits - (2 * sign) + 1);
-}
-
 static const unsigned short ZIG_ZAG_INDEX_TABLE[64] =
 {
     0,  1,  8, 16,  9,  2,  3, 10,
@@ -54,7 +23,7 @@ unsigned short get_zig_zagged_index(unsigned char idx)
   return ZIG_ZAG_INDEX_TABLE[idx];
 }
 
-unsigned short get_short(unsigned char* img_buf)
+unsigned short get_short(const unsigned char* img_buf)
 {
   return ((unsigned short)img_buf[0] << 8) | img_buf[1];
 }
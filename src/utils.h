@@ -6,16 +6,17 @@ Author: kaiyen
 #ifndef UTILS_H
 #define UTILS_H
 
-// Stream reader shamelessly copied from: https://github.com/sakhnik/cpp-sandbox/blob/737132386dc20009be2f1997cbd62302118a7125/BitStream.cpp
-// NOTE: Probably not very performant for this use case and probably doesn't guard too well against T overflow.
-int read_stream(const unsigned char *src, unsigned offset, unsigned count, unsigned accum);
-
 // See Table 5 in https://www.impulseadventure.com/photo/jpeg-huffman-coding.html
-int dc_ac_value_decode(int read_bits, unsigned bit_count);
+// Values with the top bit clear are negative. Branch free, and 0 bits decode to 0.
+static inline int dc_ac_value_decode(int read_bits, unsigned bit_count)
+{
+  const int half = (1 << bit_count) >> 1;
+  return read_bits + (((read_bits - half) >> 31) & (1 - (1 << bit_count)));
+}
 
 // Widely accessible table for zig zag indices.
 unsigned short get_zig_zagged_index(unsigned char idx);
 
 // Reverses the endianness of the first two bytes of img_buf and returns as a short.
-unsigned short get_short(unsigned char* img_buf);
+unsigned short get_short(const unsigned char* img_buf);
 #endif
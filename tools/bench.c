@@ -0,0 +1,423 @@
+/*--------------------------------------------------------------------------
+File:   bench.c
+Date:   2026/10/19
+
+Decodes every JPEG in a directory N times and reports per-stage timings,
+throughput and peak RSS as JSON or CSV. With -e the decoded image is also
+re-encoded every iteration, timed on its own.
+---------------------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "decoder.h"
+#include "encoder.h"
+#include "probe.h"
+#include "profile.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum _bench_format
+{
+  BF_JSON,
+  BF_CSV
+} bench_format_t;
+
+typedef struct _bench_result
+{
+  char* path;
+  size_t byte_size;
+  unsigned width;
+  unsigned height;
+  unsigned long long pixels;
+  unsigned iterations;
+  double seconds;
+  double stage_seconds[PS_COUNT];
+  unsigned long long stage_cycles[PS_COUNT];
+  unsigned long long counters[PC_COUNT];
+  long peak_rss_kb;
+
+  // Most the decoder itself held at once, see jpeg_peak_memory.
+  size_t peak_decode_bytes;
+
+  // Only with -e.
+  double encode_seconds;
+  size_t encoded_bytes;
+} bench_result_t;
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static long peak_rss_kb(void)
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+
+  // Linux reports ru_maxrss in kilobytes.
+  return usage.ru_maxrss;
+}
+
+static bool has_jpeg_extension(const char* name)
+{
+  const char* ext = strrchr(name, '.');
+  if (ext == NULL)
+    return false;
+
+  return strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0;
+}
+
+static int compare_strings(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Collects the sorted paths of every JPEG in dir_path. Returns the number of paths.
+static size_t collect_corpus(const char* dir_path, char*** out_paths)
+{
+  DIR* dir = opendir(dir_path);
+  if (dir == NULL)
+  {
+    fprintf(stderr, "Failed to open corpus directory '%s'\n", dir_path);
+    return 0;
+  }
+
+  size_t count = 0, capacity = 16;
+  char** paths = (char**)malloc(sizeof(char*) * capacity);
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (!has_jpeg_extension(entry->d_name))
+      continue;
+
+    if (count == capacity)
+    {
+      capacity *= 2;
+      paths = (char**)realloc(paths, sizeof(char*) * capacity);
+    }
+
+    const size_t path_len = strlen(dir_path) + strlen(entry->d_name) + 2;
+    paths[count] = (char*)malloc(path_len);
+    snprintf(paths[count], path_len, "%s/%s", dir_path, entry->d_name);
+    ++count;
+  }
+
+  closedir(dir);
+
+  qsort(paths, count, sizeof(char*), compare_strings);
+  *out_paths = paths;
+  return count;
+}
+
+static unsigned char* load_file(const char* path, size_t* out_size)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+  long byte_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  unsigned char* buf = byte_size > 0 ? (unsigned char*)malloc(byte_size) : NULL;
+  if (buf != NULL)
+  {
+    *out_size = fread(buf, sizeof(unsigned char), byte_size, file);
+  }
+
+  fclose(file);
+  return buf;
+}
+
+// quality 0 skips the encode.
+static bool bench_file(const char* path, unsigned iterations, unsigned char quality, bench_result_t* result)
+{
+  memset(result, 0, sizeof(bench_result_t));
+  result->path = strdup(path);
+
+  size_t byte_size = 0;
+  unsigned char* file_buf = load_file(path, &byte_size);
+  if (file_buf == NULL)
+  {
+    fprintf(stderr, "Failed to read '%s'\n", path);
+    return false;
+  }
+
+  result->byte_size = byte_size;
+  result->iterations = iterations;
+
+  // Decode all the way to RGB, the way a real caller would. Files the probe can't size only get entropy decoded.
+  jpeg_info_t info;
+  jpeg_output_t output = {0};
+  if (jpeg_probe(file_buf, byte_size, &info))
+  {
+    output.format = info.bits_per_sample == 12 ? JPF_RGB48 : JPF_RGB24;
+    output.strides[0] = (ptrdiff_t)info.width * jpeg_pixel_format_size(output.format);
+    output.planes[0] = (unsigned char*)malloc((size_t)output.strides[0] * info.height);
+  }
+
+  bool success = true;
+  for (unsigned i = 0; i != iterations && success; ++i)
+  {
+    profile_reset();
+
+    const double start = now_seconds();
+    success = output.planes[0] ? jpeg_decode_to(file_buf, byte_size, &output) : jpeg_decode_buffer(file_buf, byte_size);
+    result->seconds += now_seconds() - start;
+
+    if (jpeg_peak_memory() > result->peak_decode_bytes)
+      result->peak_decode_bytes = jpeg_peak_memory();
+
+    profile_stats_t stats;
+    profile_get_stats(&stats);
+    for (unsigned s = 0; s != PS_COUNT; ++s)
+    {
+      result->stage_seconds[s] += stats.stage_seconds[s];
+      result->stage_cycles[s] += stats.stage_cycles[s];
+    }
+    for (unsigned c = 0; c != PC_COUNT; ++c)
+      result->counters[c] += stats.counters[c];
+
+    // The encoder only takes 8 bit samples.
+    if (success && quality != 0 && output.planes[0] != NULL && output.format == JPF_RGB24)
+    {
+      jpeg_encode_params_t params;
+      jpeg_encode_params_default(&params);
+      params.quality = quality;
+
+      unsigned char* encoded = NULL;
+      const double encode_start = now_seconds();
+      success = jpeg_encode(output.planes[0], output.strides[0], info.width, info.height, JPF_RGB24, &params, &encoded, &result->encoded_bytes);
+      result->encode_seconds += now_seconds() - encode_start;
+      free(encoded);
+    }
+  }
+
+  const decode_context_t* ctx = get_decode_context();
+  result->width = ctx->x_length;
+  result->height = ctx->y_length;
+  result->pixels = (unsigned long long)ctx->x_length * ctx->y_length;
+  result->peak_rss_kb = peak_rss_kb();
+
+  free(output.planes[0]);
+  free(file_buf);
+  return success;
+}
+
+static double mb_per_second(const bench_result_t* r)
+{
+  return r->seconds > 0.0 ? ((double)r->byte_size * r->iterations) / r->seconds / 1e6 : 0.0;
+}
+
+static double mp_per_second(const bench_result_t* r)
+{
+  return r->seconds > 0.0 ? ((double)r->pixels * r->iterations) / r->seconds / 1e6 : 0.0;
+}
+
+static void accumulate_total(bench_result_t* total, const bench_result_t* r)
+{
+  // The total is a single pass over one large pseudo-file, so the throughput helpers still apply.
+  total->byte_size += r->byte_size * r->iterations;
+  total->pixels += r->pixels * r->iterations;
+  total->iterations = 1;
+  total->seconds += r->seconds;
+  for (unsigned s = 0; s != PS_COUNT; ++s)
+  {
+    total->stage_seconds[s] += r->stage_seconds[s];
+    total->stage_cycles[s] += r->stage_cycles[s];
+  }
+  for (unsigned c = 0; c != PC_COUNT; ++c)
+    total->counters[c] += r->counters[c];
+  total->peak_rss_kb = r->peak_rss_kb > total->peak_rss_kb ? r->peak_rss_kb : total->peak_rss_kb;
+  total->peak_decode_bytes = r->peak_decode_bytes > total->peak_decode_bytes ? r->peak_decode_bytes : total->peak_decode_bytes;
+  total->encode_seconds += r->encode_seconds;
+  total->encoded_bytes += r->encoded_bytes * r->iterations;
+}
+
+static double avg_code_len(const bench_result_t* r)
+{
+  return r->counters[PC_SYMBOLS] ? (double)r->counters[PC_CODE_BITS] / (double)r->counters[PC_SYMBOLS] : 0.0;
+}
+
+static void write_json_record(FILE* out, const bench_result_t* r, const char* indent)
+{
+  fprintf(out, "%s\"bytes\": %zu, \"width\": %u, \"height\": %u, \"pixels\": %llu, \"iterations\": %u,\n", indent, r->byte_size, r->width, r->height, r->pixels, r->iterations);
+  fprintf(out, "%s\"seconds\": %.9f, \"mb_per_s\": %.3f, \"mp_per_s\": %.3f, \"peak_rss_kb\": %ld, \"peak_decode_bytes\": %zu,\n", indent, r->seconds, mb_per_second(r), mp_per_second(r), r->peak_rss_kb, r->peak_decode_bytes);
+  fprintf(out, "%s\"encode_seconds\": %.9f, \"encoded_bytes\": %zu,\n", indent, r->encode_seconds, r->encoded_bytes);
+  fprintf(out, "%s\"stages\": {", indent);
+  for (unsigned s = 0; s != PS_COUNT; ++s)
+  {
+    fprintf(out, "%s\"%s\": %.9f", s ? ", " : " ", profile_get_stage_name((profile_stage_t)s), r->stage_seconds[s]);
+  }
+  fprintf(out, " },\n");
+  fprintf(out, "%s\"stage_cycles\": {", indent);
+  for (unsigned s = 0; s != PS_COUNT; ++s)
+  {
+    fprintf(out, "%s\"%s\": %llu", s ? ", " : " ", profile_get_stage_name((profile_stage_t)s), r->stage_cycles[s]);
+  }
+  fprintf(out, " },\n");
+  fprintf(out, "%s\"counters\": {", indent);
+  for (unsigned c = 0; c != PC_COUNT; ++c)
+  {
+    fprintf(out, " \"%s\": %llu,", profile_get_counter_name((profile_counter_t)c), r->counters[c]);
+  }
+  fprintf(out, " \"avg_code_len\": %.3f }\n", avg_code_len(r));
+}
+
+static void write_json(FILE* out, const bench_result_t* results, size_t count, const bench_result_t* total)
+{
+  fprintf(out, "{\n  \"files\": [\n");
+  for (size_t i = 0; i != count; ++i)
+  {
+    fprintf(out, "    {\n      \"file\": \"%s\",\n", results[i].path);
+    write_json_record(out, &results[i], "      ");
+    fprintf(out, "    }%s\n", i + 1 != count ? "," : "");
+  }
+  fprintf(out, "  ],\n  \"total\": {\n");
+  write_json_record(out, total, "    ");
+  fprintf(out, "  }\n}\n");
+}
+
+static void write_csv_record(FILE* out, const char* name, const bench_result_t* r)
+{
+  fprintf(out, "%s,%zu,%u,%u,%llu,%u,%.9f,%.3f,%.3f", name, r->byte_size, r->width, r->height, r->pixels, r->iterations, r->seconds, mb_per_second(r), mp_per_second(r));
+  for (unsigned s = 0; s != PS_COUNT; ++s)
+    fprintf(out, ",%.9f", r->stage_seconds[s]);
+  for (unsigned s = 0; s != PS_COUNT; ++s)
+    fprintf(out, ",%llu", r->stage_cycles[s]);
+  for (unsigned c = 0; c != PC_COUNT; ++c)
+    fprintf(out, ",%llu", r->counters[c]);
+  fprintf(out, ",%.3f,%ld,%zu,%.9f,%zu\n", avg_code_len(r), r->peak_rss_kb, r->peak_decode_bytes, r->encode_seconds, r->encoded_bytes);
+}
+
+static void write_csv(FILE* out, const bench_result_t* results, size_t count, const bench_result_t* total)
+{
+  fprintf(out, "file,bytes,width,height,pixels,iterations,seconds,mb_per_s,mp_per_s");
+  for (unsigned s = 0; s != PS_COUNT; ++s)
+    fprintf(out, ",%s_s", profile_get_stage_name((profile_stage_t)s));
+  for (unsigned s = 0; s != PS_COUNT; ++s)
+    fprintf(out, ",%s_cycles", profile_get_stage_name((profile_stage_t)s));
+  for (unsigned c = 0; c != PC_COUNT; ++c)
+    fprintf(out, ",%s", profile_get_counter_name((profile_counter_t)c));
+  fprintf(out, ",avg_code_len,peak_rss_kb,peak_decode_bytes,encode_s,encoded_bytes\n");
+
+  for (size_t i = 0; i != count; ++i)
+    write_csv_record(out, results[i].path, &results[i]);
+
+  write_csv_record(out, "TOTAL", total);
+}
+
+static void print_usage(const char* exec)
+{
+  fprintf(stderr, "Usage: %s [-n iterations] [-f json|csv] [-o output file] [-e encode quality] [-t entropy threads] <corpus dir>\n", exec);
+}
+
+int main(int argc, char** argv)
+{
+  unsigned iterations = 10;
+  bench_format_t format = BF_JSON;
+  const char* output_path = NULL;
+  unsigned long quality = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:f:o:e:t:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        iterations = (unsigned)strtoul(optarg, NULL, 10);
+        break;
+      case 'f':
+        if (strcmp(optarg, "json") == 0)
+          format = BF_JSON;
+        else if (strcmp(optarg, "csv") == 0)
+          format = BF_CSV;
+        else
+        {
+          print_usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'o':
+        output_path = optarg;
+        break;
+      case 'e':
+        quality = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        // The default of 1 times the serial entropy decoder, 0 uses every core on big enough scans.
+        jpeg_set_entropy_threads((unsigned)strtoul(optarg, NULL, 10), 64 * 1024);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 1 || iterations == 0 || quality > 100)
+  {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // No log sink is installed, so the decoder stays silent and the timings only cover decoding.
+  FILE* report = output_path ? fopen(output_path, "w") : stdout;
+  if (report == NULL)
+  {
+    fprintf(stderr, "Failed to open report output.\n");
+    return EXIT_FAILURE;
+  }
+
+  char** paths = NULL;
+  const size_t count = collect_corpus(argv[optind], &paths);
+  if (count == 0)
+  {
+    fprintf(stderr, "No JPEG files found in '%s'\n", argv[optind]);
+    free(paths);
+    if (report != stdout)
+      fclose(report);
+    return EXIT_FAILURE;
+  }
+
+  bench_result_t* results = (bench_result_t*)malloc(sizeof(bench_result_t) * count);
+  bench_result_t total;
+  memset(&total, 0, sizeof(total));
+
+  int exit_code = EXIT_SUCCESS;
+  for (size_t i = 0; i != count; ++i)
+  {
+    if (!bench_file(paths[i], iterations, (unsigned char)quality, &results[i]))
+    {
+      fprintf(stderr, "Failed to decode '%s'\n", paths[i]);
+      exit_code = EXIT_FAILURE;
+    }
+    accumulate_total(&total, &results[i]);
+  }
+
+  if (format == BF_JSON)
+    write_json(report, results, count, &total);
+  else
+    write_csv(report, results, count, &total);
+
+  for (size_t i = 0; i != count; ++i)
+  {
+    free(results[i].path);
+    free(paths[i]);
+  }
+
+  free(results);
+  free(paths);
+  if (report != stdout)
+    fclose(report);
+  return exit_code;
+}
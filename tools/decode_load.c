@@ -0,0 +1,476 @@
+/*--------------------------------------------------------------------------
+File:   decode_load.c
+Date:   2026/10/19
+
+Load generator for decode_server. Keeps a number of connections busy with
+decode requests for a set of JPEGs, then reports throughput and the
+latency distribution as seen by the client. With -M the JPEGs go over in
+memfds instead of by path, the way an in-memory caller would send them.
+---------------------------------------------------------------------------*/
+// memfd_create is a GNU extension.
+#define _GNU_SOURCE
+
+#include "decode_protocol.h"
+
+#include "decoder.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct _load_input
+{
+  char* path;
+
+  // Only with -M: the whole file in a sealed memfd, sent with every request for it.
+  int memfd;
+  size_t size;
+} load_input_t;
+
+typedef struct _load_sample
+{
+  uint64_t latency_ns;
+  uint64_t decode_ns;
+  uint64_t pixels;
+  bool ok;
+} load_sample_t;
+
+typedef struct _load_run
+{
+  const char* socket_path;
+  const load_input_t* inputs;
+  size_t input_count;
+  uint32_t format;
+  uint32_t scale_denom;
+
+  // Requests are handed out by index, each connection taking the next one as it gets free.
+  pthread_mutex_t lock;
+  size_t next_request;
+  size_t request_count;
+  load_sample_t* samples;
+} load_run_t;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static bool has_jpeg_extension(const char* name)
+{
+  const char* ext = strrchr(name, '.');
+  if (ext == NULL)
+    return false;
+
+  return strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0;
+}
+
+static int compare_strings(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+  const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void add_input(load_input_t** inputs, size_t* count, size_t* capacity, const char* path)
+{
+  // The server resolves paths from its own working directory, not ours.
+  char* full_path = realpath(path, NULL);
+  if (full_path == NULL)
+  {
+    fprintf(stderr, "Skipping '%s': %s\n", path, strerror(errno));
+    return;
+  }
+
+  if (*count == *capacity)
+  {
+    *capacity = *capacity ? *capacity * 2 : 16;
+    *inputs = (load_input_t*)realloc(*inputs, sizeof(load_input_t) * *capacity);
+  }
+
+  load_input_t* input = &(*inputs)[(*count)++];
+  input->path = full_path;
+  input->memfd = -1;
+  input->size = 0;
+}
+
+// Adds input itself if it's a file, every JPEG directly in it, sorted, if it's a directory.
+static void collect_inputs(const char* input, load_input_t** inputs, size_t* count, size_t* capacity)
+{
+  struct stat st;
+  if (stat(input, &st) != 0 || !S_ISDIR(st.st_mode))
+  {
+    add_input(inputs, count, capacity, input);
+    return;
+  }
+
+  DIR* dir = opendir(input);
+  if (dir == NULL)
+  {
+    fprintf(stderr, "Failed to open directory '%s'\n", input);
+    return;
+  }
+
+  size_t name_count = 0, name_capacity = 16;
+  char** names = (char**)malloc(sizeof(char*) * name_capacity);
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (!has_jpeg_extension(entry->d_name))
+      continue;
+
+    if (name_count == name_capacity)
+    {
+      name_capacity *= 2;
+      names = (char**)realloc(names, sizeof(char*) * name_capacity);
+    }
+
+    const size_t path_len = strlen(input) + strlen(entry->d_name) + 2;
+    names[name_count] = (char*)malloc(path_len);
+    snprintf(names[name_count], path_len, "%s/%s", input, entry->d_name);
+    ++name_count;
+  }
+
+  closedir(dir);
+
+  qsort(names, name_count, sizeof(char*), compare_strings);
+  for (size_t i = 0; i != name_count; ++i)
+  {
+    add_input(inputs, count, capacity, names[i]);
+    free(names[i]);
+  }
+  free(names);
+}
+
+// Copies the file at input->path into a sealed memfd. Returns false if that fails.
+static bool load_into_memfd(load_input_t* input)
+{
+  const int file_fd = open(input->path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (file_fd < 0 || fstat(file_fd, &st) != 0 || st.st_size == 0)
+  {
+    if (file_fd >= 0)
+      close(file_fd);
+    return false;
+  }
+
+  input->size = (size_t)st.st_size;
+  input->memfd = memfd_create("jpeg_input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  bool success = input->memfd >= 0 && ftruncate(input->memfd, st.st_size) == 0;
+  for (size_t done = 0; success && done < input->size;)
+  {
+    unsigned char buf[64 * 1024];
+    const ssize_t got = pread(file_fd, buf, sizeof(buf), (off_t)done);
+    success = got > 0 && pwrite(input->memfd, buf, (size_t)got, (off_t)done) == got;
+    done += got > 0 ? (size_t)got : 0;
+  }
+  close(file_fd);
+
+  // Sealed, the server can map it without worrying about it changing underneath.
+  success = success && fcntl(input->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0;
+  if (!success && input->memfd >= 0)
+  {
+    close(input->memfd);
+    input->memfd = -1;
+  }
+
+  return success;
+}
+
+static int connect_to_server(const char* socket_path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+  const int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sock >= 0 && connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+  {
+    close(sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+// One request, start to finish: send, wait for the answer, map the pixels the way a real client would use them.
+static bool run_request(int sock, const load_run_t* run, size_t index, load_sample_t* sample)
+{
+  const load_input_t* input = &run->inputs[index % run->input_count];
+
+  decode_request_t request;
+  memset(&request, 0, offsetof(decode_request_t, path));
+  request.magic = DECODE_PROTOCOL_MAGIC;
+  request.kind = input->memfd >= 0 ? DRK_MEMFD : DRK_PATH;
+  request.format = run->format;
+  request.scale_denom = run->scale_denom;
+  request.id = index;
+  request.size = input->size;
+
+  size_t request_len = offsetof(decode_request_t, path);
+  if (request.kind == DRK_PATH)
+  {
+    const size_t path_len = strlen(input->path) + 1;
+    if (path_len > sizeof(request.path))
+      return false;
+
+    memcpy(request.path, input->path, path_len);
+    request_len += path_len;
+  }
+
+  const uint64_t start = now_ns();
+  if (!decode_send(sock, &request, request_len, input->memfd))
+    return false;
+
+  decode_response_t response;
+  int pixels_fd;
+  const ssize_t received = decode_receive(sock, &response, sizeof(response), &pixels_fd);
+  if (received != (ssize_t)sizeof(response) || response.magic != DECODE_PROTOCOL_MAGIC || response.id != index)
+  {
+    if (pixels_fd >= 0)
+      close(pixels_fd);
+    return false;
+  }
+
+  sample->ok = response.status == DS_OK && pixels_fd >= 0;
+  if (sample->ok)
+  {
+    // Touch the last row, so the mapping is known good without reading every pixel.
+    const unsigned char* pixels = (const unsigned char*)mmap(NULL, response.size, PROT_READ, MAP_SHARED, pixels_fd, 0);
+    sample->ok = pixels != MAP_FAILED;
+    if (sample->ok)
+    {
+      volatile unsigned char last = pixels[response.size - 1];
+      (void)last;
+      munmap((void*)pixels, response.size);
+    }
+  }
+
+  if (pixels_fd >= 0)
+    close(pixels_fd);
+
+  sample->latency_ns = now_ns() - start;
+  sample->decode_ns = response.decode_ns;
+  sample->pixels = sample->ok ? (uint64_t)response.width * response.height : 0;
+  return true;
+}
+
+static void* connection_thread(void* arg)
+{
+  load_run_t* run = (load_run_t*)arg;
+
+  const int sock = connect_to_server(run->socket_path);
+  if (sock < 0)
+  {
+    fprintf(stderr, "Failed to connect to '%s': %s\n", run->socket_path, strerror(errno));
+    return NULL;
+  }
+
+  for (;;)
+  {
+    pthread_mutex_lock(&run->lock);
+    const size_t index = run->next_request < run->request_count ? run->next_request++ : SIZE_MAX;
+    pthread_mutex_unlock(&run->lock);
+
+    if (index == SIZE_MAX)
+      break;
+
+    // A broken connection leaves the rest of the requests to the others.
+    if (!run_request(sock, run, index, &run->samples[index]))
+    {
+      fprintf(stderr, "Connection lost on request %zu.\n", index);
+      break;
+    }
+  }
+
+  close(sock);
+  return NULL;
+}
+
+static bool parse_format(const char* name, uint32_t* out_format)
+{
+  static const struct
+  {
+    const char* name;
+    uint32_t format;
+  } FORMATS[] = {
+    {"auto", DECODE_FORMAT_AUTO}, {"gray", JPF_GRAY8}, {"rgb", JPF_RGB24}, {"bgr", JPF_BGR24},
+    {"rgba", JPF_RGBA32}, {"bgra", JPF_BGRA32}, {"gray16", JPF_GRAY16}, {"rgb48", JPF_RGB48}
+  };
+
+  for (size_t i = 0; i != sizeof(FORMATS) / sizeof(FORMATS[0]); ++i)
+  {
+    if (strcmp(name, FORMATS[i].name) == 0)
+    {
+      *out_format = FORMATS[i].format;
+      return true;
+    }
+  }
+  return false;
+}
+
+static double percentile_ms(const uint64_t* sorted, size_t count, double percentile)
+{
+  size_t rank = (size_t)(percentile / 100.0 * (double)count);
+  if (rank >= count)
+    rank = count - 1;
+  return (double)sorted[rank] / 1e6;
+}
+
+static void print_usage(const char* exec)
+{
+  fprintf(stderr, "Usage: %s [-s socket path] [-c connections] [-n requests] [-f auto|gray|rgb|bgr|rgba|bgra|gray16|rgb48] [-d scale denom] [-M] <jpeg files or dirs...>\n", exec);
+}
+
+int main(int argc, char** argv)
+{
+  load_run_t run;
+  memset(&run, 0, sizeof(run));
+  run.socket_path = DECODE_DEFAULT_SOCKET;
+  run.format = DECODE_FORMAT_AUTO;
+  run.request_count = 1000;
+
+  unsigned connections = 4;
+  bool use_memfd = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:c:n:f:d:Mh")) != -1)
+  {
+    switch (opt)
+    {
+      case 's':
+        run.socket_path = optarg;
+        break;
+      case 'c':
+        connections = (unsigned)strtoul(optarg, NULL, 10);
+        break;
+      case 'n':
+        run.request_count = (size_t)strtoull(optarg, NULL, 10);
+        break;
+      case 'f':
+        if (!parse_format(optarg, &run.format))
+        {
+          print_usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'd':
+        run.scale_denom = (uint32_t)strtoul(optarg, NULL, 10);
+        break;
+      case 'M':
+        use_memfd = true;
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind == argc || connections == 0 || run.request_count == 0)
+  {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  load_input_t* inputs = NULL;
+  size_t input_count = 0, input_capacity = 0;
+  for (int i = optind; i != argc; ++i)
+    collect_inputs(argv[i], &inputs, &input_count, &input_capacity);
+
+  for (size_t i = 0; i != input_count && use_memfd; ++i)
+  {
+    if (!load_into_memfd(&inputs[i]))
+      fprintf(stderr, "Failed to load '%s', it goes by path instead.\n", inputs[i].path);
+  }
+
+  if (input_count == 0)
+  {
+    fprintf(stderr, "No JPEG files to send.\n");
+    free(inputs);
+    return EXIT_FAILURE;
+  }
+
+  run.inputs = inputs;
+  run.input_count = input_count;
+  run.samples = (load_sample_t*)calloc(run.request_count, sizeof(load_sample_t));
+  pthread_mutex_init(&run.lock, NULL);
+
+  // Each request goes to whichever server worker is free, so extra connections only queue per request.
+  pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * connections);
+  const uint64_t start = now_ns();
+  unsigned started = 0;
+  for (; started != connections; ++started)
+  {
+    if (pthread_create(&threads[started], NULL, connection_thread, &run) != 0)
+      break;
+  }
+  for (unsigned t = 0; t != started; ++t)
+    pthread_join(threads[t], NULL);
+  const double seconds = (double)(now_ns() - start) / 1e9;
+
+  size_t ok = 0, failed = 0;
+  uint64_t pixels = 0, decode_ns = 0;
+  uint64_t* latencies = (uint64_t*)malloc(sizeof(uint64_t) * run.request_count);
+  for (size_t i = 0; i != run.request_count; ++i)
+  {
+    const load_sample_t* sample = &run.samples[i];
+    if (sample->latency_ns == 0)
+      continue;
+
+    if (!sample->ok)
+    {
+      ++failed;
+      continue;
+    }
+
+    latencies[ok++] = sample->latency_ns;
+    pixels += sample->pixels;
+    decode_ns += sample->decode_ns;
+  }
+
+  printf("%zu requests over %u connections to %s, %zu files by %s.\n", run.request_count, started, run.socket_path, input_count, use_memfd ? "memfd" : "path");
+  printf("%zu ok, %zu failed, %zu never answered.\n", ok, failed, run.request_count - ok - failed);
+
+  if (ok != 0)
+  {
+    qsort(latencies, ok, sizeof(uint64_t), compare_u64);
+    printf("Throughput: %.1f requests/s, %.1f MP/s over %.3f s.\n", (double)ok / seconds, (double)pixels / seconds / 1e6, seconds);
+    printf("Latency ms: p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f. Mean decode %.3f.\n",
+           percentile_ms(latencies, ok, 50.0), percentile_ms(latencies, ok, 90.0), percentile_ms(latencies, ok, 99.0),
+           percentile_ms(latencies, ok, 99.9), (double)latencies[ok - 1] / 1e6, (double)decode_ns / (double)ok / 1e6);
+  }
+
+  free(latencies);
+  free(threads);
+  free(run.samples);
+  pthread_mutex_destroy(&run.lock);
+  for (size_t i = 0; i != input_count; ++i)
+  {
+    if (inputs[i].memfd >= 0)
+      close(inputs[i].memfd);
+    free(inputs[i].path);
+  }
+  free(inputs);
+
+  return ok == run.request_count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
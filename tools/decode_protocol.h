@@ -0,0 +1,183 @@
+/*--------------------------------------------------------------------------/
+File:   decode_protocol.h
+Date:   2026/10/19
+
+What decode_server and its clients say to each other over the socket.
+---------------------------------------------------------------------------*/
+#ifndef DECODE_PROTOCOL_H
+#define DECODE_PROTOCOL_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+----------------
+Decode Protocol:
+----------------
+A SOCK_SEQPACKET Unix domain socket, so every request and response is exactly one message. A client
+sends a decode_request_t naming a file by path, or with the JPEG in a memfd passed along as
+SCM_RIGHTS. The answer is a decode_response_t with the pixels in a new, sealed memfd attached the same
+way. Pixels never go through the socket itself, the client just maps what it's handed.
+
+A connection can carry any number of requests, one at a time. Connections cost the server nothing
+while idle: each request goes to whichever worker is free when it arrives.
+*/
+#define DECODE_PROTOCOL_MAGIC 0x4A504744u // "JPGD"
+#define DECODE_DEFAULT_SOCKET "/tmp/jpeg_decode.sock"
+#define DECODE_MAX_PATH 4096
+
+// Lets the server pick: GRAY8 or RGB24, GRAY16 or RGB48 for 12 bit frames.
+#define DECODE_FORMAT_AUTO 0xFFFFFFFFu
+
+typedef enum _decode_request_kind
+{
+  DRK_PATH = 1,  // path holds a file the server can open
+  DRK_MEMFD = 2  // the JPEG is the first size bytes of the attached fd, sealed with at least F_SEAL_SHRINK and F_SEAL_WRITE
+} decode_request_kind_t;
+
+typedef enum _decode_status
+{
+  DS_OK,
+  DS_BAD_REQUEST,
+  DS_READ_FAILED,
+  DS_DECODE_FAILED,
+  DS_OUT_OF_MEMORY
+} decode_status_t;
+
+typedef struct _decode_request
+{
+  uint32_t magic;
+  uint32_t kind;
+
+  // A packed jpeg_pixel_format_t, or DECODE_FORMAT_AUTO.
+  uint32_t format;
+
+  // 1, 2, 4 or 8, and 0 is the same as 1.
+  uint32_t scale_denom;
+
+  // Echoed back in the response.
+  uint64_t id;
+  uint64_t size;
+
+  // Only as long as the nul terminated path, the message ends there.
+  char path[DECODE_MAX_PATH];
+} decode_request_t;
+
+typedef struct _decode_response
+{
+  uint32_t magic;
+  uint32_t status;
+  uint64_t id;
+
+  // The attached memfd holds height rows of stride bytes, in format.
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t reserved;
+  uint64_t stride;
+  uint64_t size;
+
+  // Time spent in the decoder itself, so clients can tell it apart from queueing and transport.
+  uint64_t decode_ns;
+} decode_response_t;
+
+static inline const char* decode_status_name(uint32_t status)
+{
+  switch (status)
+  {
+    case DS_OK: return "ok";
+    case DS_BAD_REQUEST: return "bad request";
+    case DS_READ_FAILED: return "read failed";
+    case DS_DECODE_FAILED: return "decode failed";
+    case DS_OUT_OF_MEMORY: return "out of memory";
+    default: return "unknown";
+  }
+}
+
+// Sends len bytes of msg as one message, with fd attached unless it's negative. Returns false on failure.
+static inline bool decode_send(int sock, const void* msg, size_t len, int fd)
+{
+  struct iovec iov;
+  iov.iov_base = (void*)msg;
+  iov.iov_len = len;
+
+  union
+  {
+    struct cmsghdr header;
+    unsigned char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+
+  if (fd >= 0)
+  {
+    hdr.msg_control = control.buf;
+    hdr.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  return sendmsg(sock, &hdr, MSG_NOSIGNAL) == (ssize_t)len;
+}
+
+// Receives one message of up to len bytes into msg. *out_fd gets the attached fd, or -1 without one.
+// Returns the message length, 0 once the peer is gone, -1 with errno set on failure.
+static inline ssize_t decode_receive(int sock, void* msg, size_t len, int* out_fd)
+{
+  struct iovec iov;
+  iov.iov_base = msg;
+  iov.iov_len = len;
+
+  union
+  {
+    struct cmsghdr header;
+    unsigned char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  struct msghdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  hdr.msg_control = control.buf;
+  hdr.msg_controllen = sizeof(control.buf);
+
+  *out_fd = -1;
+  const ssize_t received = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+  if (received <= 0)
+    return received;
+
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+  {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(out_fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  // A message cut short, or a second fd squeezed in, isn't anything either side sends.
+  if ((hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0)
+  {
+    if (*out_fd >= 0)
+      close(*out_fd);
+    *out_fd = -1;
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  return received;
+}
+
+#endif
@@ -0,0 +1,643 @@
+/*--------------------------------------------------------------------------
+File:   decode_server.c
+Date:   2026/10/19
+
+Resident decoder. Listens on a Unix domain socket and answers decode
+requests (see decode_protocol.h) from a pool of worker processes that stay
+up between requests, so clients pay neither process startup nor table
+setup per image. The supervisor holds the connections and hands each
+request to a free worker. Each worker has the decoder, and its cache of
+huffman tables, to itself. Workers that die are replaced.
+---------------------------------------------------------------------------*/
+// memfd_create and its seals are GNU extensions.
+#define _GNU_SOURCE
+
+#include "decode_protocol.h"
+
+#include "decoder.h"
+#include "probe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 256
+#define MAX_CLIENTS 1024
+
+static volatile sig_atomic_t s_stopping = 0;
+
+static void on_stop_signal(int signal)
+{
+  s_stopping = 1;
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Maps the JPEG a request points at. Returns false with *out_status set if it can't be had.
+static bool map_request_input(const decode_request_t* request, size_t request_len, int fd, const unsigned char** out_data, size_t* out_size, uint32_t* out_status)
+{
+  *out_status = DS_READ_FAILED;
+
+  int file_fd = -1;
+  if (request->kind == DRK_PATH)
+  {
+    // The path ends where the message does, and has to be terminated within it.
+    const size_t path_len = request_len - offsetof(decode_request_t, path);
+    if (memchr(request->path, '\0', path_len) == NULL)
+    {
+      *out_status = DS_BAD_REQUEST;
+      return false;
+    }
+
+    file_fd = open(request->path, O_RDONLY | O_CLOEXEC);
+    if (file_fd < 0)
+      return false;
+  }
+  else if (request->kind != DRK_MEMFD || fd < 0)
+  {
+    *out_status = DS_BAD_REQUEST;
+    return false;
+  }
+  else
+  {
+    // A memfd the client could still shrink would take the worker down with SIGBUS mid-decode.
+    const int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE))
+    {
+      *out_status = DS_BAD_REQUEST;
+      return false;
+    }
+  }
+
+  const int map_fd = file_fd >= 0 ? file_fd : fd;
+  struct stat st;
+  if (fstat(map_fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    if (file_fd >= 0)
+      close(file_fd);
+    return false;
+  }
+
+  // A memfd can be bigger than the JPEG in it, but never smaller.
+  size_t size = (size_t)st.st_size;
+  if (request->kind == DRK_MEMFD)
+  {
+    if (request->size == 0 || request->size > size)
+    {
+      *out_status = DS_BAD_REQUEST;
+      return false;
+    }
+    size = (size_t)request->size;
+  }
+
+  void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, map_fd, 0);
+  if (file_fd >= 0)
+    close(file_fd);
+
+  if (data == MAP_FAILED)
+    return false;
+
+  *out_data = (const unsigned char*)data;
+  *out_size = size;
+  return true;
+}
+
+// The format a request gets its pixels in: its own, or for DECODE_FORMAT_AUTO what main would write.
+static bool pick_format(uint32_t requested, const jpeg_info_t* info, jpeg_pixel_format_t* out_format)
+{
+  if (requested == DECODE_FORMAT_AUTO)
+  {
+    const bool grey = info->num_components == 1;
+    if (info->bits_per_sample == 12)
+      *out_format = grey ? JPF_GRAY16 : JPF_RGB48;
+    else
+      *out_format = grey ? JPF_GRAY8 : JPF_RGB24;
+    return true;
+  }
+
+  // Planar formats would need a plane layout in the response, and only packed ones are asked for.
+  if (requested >= JPF_COUNT || jpeg_pixel_format_is_planar((jpeg_pixel_format_t)requested))
+    return false;
+
+  *out_format = (jpeg_pixel_format_t)requested;
+  return true;
+}
+
+// Decodes into a fresh memfd, sealed so the client can trust it won't change under it. Returns the fd, or -1.
+static int decode_to_memfd(const unsigned char* data, size_t size, const decode_request_t* request, decode_response_t* response)
+{
+  if (request->scale_denom > 8 || (request->scale_denom & (request->scale_denom - 1)) != 0)
+  {
+    response->status = DS_BAD_REQUEST;
+    return -1;
+  }
+
+  jpeg_info_t info;
+  jpeg_pixel_format_t format;
+  if (!jpeg_probe(data, size, &info) || !pick_format(request->format, &info, &format))
+  {
+    response->status = DS_DECODE_FAILED;
+    return -1;
+  }
+
+  const unsigned char scale = (unsigned char)request->scale_denom;
+  response->width = jpeg_scaled_size(info.width, scale);
+  response->height = jpeg_scaled_size(info.height, scale);
+  response->format = format;
+  response->stride = (uint64_t)response->width * jpeg_pixel_format_size(format);
+  response->size = response->stride * response->height;
+  if (response->size == 0)
+  {
+    response->status = DS_DECODE_FAILED;
+    return -1;
+  }
+
+  const int fd = memfd_create("jpeg_pixels", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0 || ftruncate(fd, (off_t)response->size) != 0)
+  {
+    if (fd >= 0)
+      close(fd);
+    response->status = DS_OUT_OF_MEMORY;
+    return -1;
+  }
+
+  unsigned char* pixels = (unsigned char*)mmap(NULL, response->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (pixels == MAP_FAILED)
+  {
+    close(fd);
+    response->status = DS_OUT_OF_MEMORY;
+    return -1;
+  }
+
+  jpeg_output_t output;
+  memset(&output, 0, sizeof(output));
+  output.format = format;
+  output.planes[0] = pixels;
+  output.strides[0] = (ptrdiff_t)response->stride;
+  output.scale_denom = scale;
+
+  const uint64_t start = now_ns();
+  const bool success = jpeg_decode_to(data, size, &output);
+  response->decode_ns = now_ns() - start;
+
+  munmap(pixels, response->size);
+
+  // Write sealing needs the writable mapping gone, which it is.
+  if (!success || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+  {
+    close(fd);
+    response->status = DS_DECODE_FAILED;
+    return -1;
+  }
+
+  response->status = DS_OK;
+  return fd;
+}
+
+// Decodes one request received + fd. Returns the memfd with the pixels to send along with response, or -1.
+static int answer_request(const decode_request_t* request, ssize_t received, int fd, decode_response_t* response)
+{
+  memset(response, 0, sizeof(decode_response_t));
+  response->magic = DECODE_PROTOCOL_MAGIC;
+  response->status = DS_BAD_REQUEST;
+
+  if ((size_t)received < offsetof(decode_request_t, path) || request->magic != DECODE_PROTOCOL_MAGIC)
+    return -1;
+
+  response->id = request->id;
+
+  const unsigned char* data;
+  size_t size;
+  if (!map_request_input(request, (size_t)received, fd, &data, &size, &response->status))
+    return -1;
+
+  const int pixels_fd = decode_to_memfd(data, size, request, response);
+  munmap((void*)data, size);
+  return pixels_fd;
+}
+
+// Answers the requests the supervisor hands over, one at a time, until it goes away.
+static void worker_main(int sock)
+{
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTERM, SIG_DFL);
+
+  decode_request_t request;
+  for (;;)
+  {
+    int fd;
+    const ssize_t received = decode_receive(sock, &request, sizeof(request), &fd);
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received <= 0)
+      _exit(EXIT_SUCCESS);
+
+    decode_response_t response;
+    const int pixels_fd = answer_request(&request, received, fd, &response);
+    if (fd >= 0)
+      close(fd);
+
+    const bool sent = decode_send(sock, &response, sizeof(response), pixels_fd);
+    if (pixels_fd >= 0)
+      close(pixels_fd);
+
+    if (!sent)
+      _exit(EXIT_FAILURE);
+  }
+}
+
+/*
+The supervisor owns every client connection and hands their requests out one at a time, each to
+whichever worker is free. An idle connection ties up nothing, and a busy one only ever holds a worker
+for as long as its current request takes.
+*/
+
+// A worker process and the supervisor's end of the socket to it. client is whose request it has, -1 while idle.
+typedef struct _worker
+{
+  pid_t pid;
+  int sock;
+  int client;
+  uint64_t request_id;
+} worker_t;
+
+// A client connection. Its next request waits while the current one is with a worker, so answers stay in order.
+typedef struct _client
+{
+  int sock;
+  bool busy;
+} client_t;
+
+static int s_listen_fd = -1;
+static worker_t s_workers[MAX_WORKERS];
+static long s_worker_count = 0;
+static client_t s_clients[MAX_CLIENTS];
+static unsigned s_client_count = 0;
+
+// Starts worker w with a new socket to it. Leaves the worker without one if that fails.
+static void spawn_worker(long w)
+{
+  worker_t* worker = &s_workers[w];
+  worker->pid = -1;
+  worker->sock = -1;
+  worker->client = -1;
+
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) != 0)
+  {
+    perror("socketpair");
+    return;
+  }
+
+  const pid_t pid = fork();
+  if (pid == 0)
+  {
+    // The worker only ever talks to the supervisor.
+    close(pair[0]);
+    close(s_listen_fd);
+    for (long o = 0; o != s_worker_count; ++o)
+    {
+      if (s_workers[o].sock >= 0)
+        close(s_workers[o].sock);
+    }
+    for (unsigned c = 0; c != MAX_CLIENTS; ++c)
+    {
+      if (s_clients[c].sock >= 0)
+        close(s_clients[c].sock);
+    }
+
+    worker_main(pair[1]);
+  }
+
+  close(pair[1]);
+  if (pid < 0)
+  {
+    perror("fork");
+    close(pair[0]);
+    return;
+  }
+
+  worker->pid = pid;
+  worker->sock = pair[0];
+}
+
+static void close_client(int client)
+{
+  close(s_clients[client].sock);
+  s_clients[client].sock = -1;
+  s_clients[client].busy = false;
+  --s_client_count;
+}
+
+// Sends a client the answer to its request, if it's still there. Clients that don't take it get dropped.
+static void reply(int client, const decode_response_t* response, size_t len, int pixels_fd)
+{
+  if (client >= 0)
+  {
+    s_clients[client].busy = false;
+    if (!decode_send(s_clients[client].sock, response, len, pixels_fd))
+      close_client(client);
+  }
+
+  if (pixels_fd >= 0)
+    close(pixels_fd);
+}
+
+// Passes a worker's answer on. A worker that's gone, say after an image crashed the decoder, is replaced
+// and whoever it was decoding for gets a failure instead.
+static void handle_worker(long w)
+{
+  worker_t* worker = &s_workers[w];
+  const int client = worker->client;
+
+  decode_response_t response;
+  int pixels_fd;
+  const ssize_t received = decode_receive(worker->sock, &response, sizeof(response), &pixels_fd);
+  if (received < 0 && errno == EINTR)
+    return;
+
+  if (received > 0)
+  {
+    worker->client = -1;
+    reply(client, &response, (size_t)received, pixels_fd);
+    return;
+  }
+
+  memset(&response, 0, sizeof(response));
+  response.magic = DECODE_PROTOCOL_MAGIC;
+  response.status = DS_DECODE_FAILED;
+  response.id = worker->request_id;
+
+  int status = 0;
+  close(worker->sock);
+  waitpid(worker->pid, &status, 0);
+  fprintf(stderr, "Worker %ld exited with status %d, restarting it.\n", (long)worker->pid, status);
+
+  spawn_worker(w);
+  reply(client, &response, sizeof(response), -1);
+}
+
+// Hands the client's next request to worker. Returns false if there wasn't one after all.
+static bool dispatch_request(int client, worker_t* worker)
+{
+  decode_request_t request;
+  int fd;
+  const ssize_t received = decode_receive(s_clients[client].sock, &request, sizeof(request), &fd);
+  if (received < 0 && (errno == EINTR || errno == EAGAIN))
+    return false;
+
+  if (received <= 0)
+  {
+    close_client(client);
+    return false;
+  }
+
+  // The worker checks the rest, the supervisor only needs the id in case the worker dies on it.
+  worker->request_id = (size_t)received >= offsetof(decode_request_t, size) ? request.id : 0;
+  worker->client = client;
+  s_clients[client].busy = true;
+
+  // If the worker is gone, its socket says so on the next poll and the client gets its failure then.
+  decode_send(worker->sock, &request, (size_t)received, fd);
+  if (fd >= 0)
+    close(fd);
+
+  return true;
+}
+
+static worker_t* find_idle_worker(void)
+{
+  for (long w = 0; w != s_worker_count; ++w)
+  {
+    if (s_workers[w].sock >= 0 && s_workers[w].client < 0)
+      return &s_workers[w];
+  }
+
+  return NULL;
+}
+
+static void accept_client(void)
+{
+  // Non-blocking, so a client that stops reading its answers can't stall everyone else.
+  const int sock = accept4(s_listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (sock < 0)
+  {
+    if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED)
+      perror("accept");
+    return;
+  }
+
+  for (unsigned c = 0; c != MAX_CLIENTS; ++c)
+  {
+    if (s_clients[c].sock < 0)
+    {
+      s_clients[c].sock = sock;
+      s_clients[c].busy = false;
+      ++s_client_count;
+      return;
+    }
+  }
+
+  close(sock);
+}
+
+static void supervise(void)
+{
+  static struct pollfd polled[1 + MAX_WORKERS + MAX_CLIENTS];
+  static int polled_clients[MAX_CLIENTS];
+
+  // Where the walk over clients starts, moved past the last one served so none can starve the others.
+  unsigned first_client = 0;
+
+  while (!s_stopping)
+  {
+    nfds_t count = 0;
+
+    // A full table leaves new connections waiting in the listen backlog.
+    const bool accepting = s_client_count != MAX_CLIENTS;
+    if (accepting)
+    {
+      polled[count].fd = s_listen_fd;
+      polled[count++].events = POLLIN;
+    }
+
+    const nfds_t first_worker = count;
+    for (long w = 0; w != s_worker_count; ++w)
+    {
+      polled[count].fd = s_workers[w].sock;
+      polled[count++].events = POLLIN;
+    }
+
+    // Requests are only read once there's a worker to take them, until then they wait in the socket.
+    const nfds_t first_polled_client = count;
+    unsigned client_count = 0;
+    for (unsigned i = 0; i != MAX_CLIENTS && find_idle_worker() != NULL; ++i)
+    {
+      const unsigned c = (first_client + i) % MAX_CLIENTS;
+      if (s_clients[c].sock < 0 || s_clients[c].busy)
+        continue;
+
+      polled_clients[client_count++] = (int)c;
+      polled[count].fd = s_clients[c].sock;
+      polled[count++].events = POLLIN;
+    }
+
+    if (poll(polled, count, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      perror("poll");
+      return;
+    }
+
+    for (long w = 0; w != s_worker_count; ++w)
+    {
+      if (polled[first_worker + w].fd >= 0 && polled[first_worker + w].revents != 0)
+        handle_worker(w);
+    }
+
+    for (unsigned i = 0; i != client_count; ++i)
+    {
+      if (polled[first_polled_client + i].revents == 0)
+        continue;
+
+      worker_t* worker = find_idle_worker();
+      if (worker == NULL)
+        break;
+
+      if (dispatch_request(polled_clients[i], worker))
+        first_client = (unsigned)polled_clients[i] + 1;
+    }
+
+    if (accepting && polled[0].revents != 0)
+      accept_client();
+  }
+}
+
+static void print_usage(const char* exec)
+{
+  fprintf(stderr, "Usage: %s [-s socket path] [-w workers] [-m memory limit per decode] [-t entropy threads per worker]\n", exec);
+}
+
+int main(int argc, char** argv)
+{
+  const char* socket_path = DECODE_DEFAULT_SOCKET;
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+  // Workers already keep every core busy, so by default each decodes its scans serially.
+  unsigned entropy_threads = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:w:m:t:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 's':
+        socket_path = optarg;
+        break;
+      case 'w':
+        workers = strtol(optarg, NULL, 10);
+        break;
+      case 'm':
+        jpeg_set_memory_limit((size_t)strtoull(optarg, NULL, 10));
+        break;
+      case 't':
+        entropy_threads = (unsigned)strtoul(optarg, NULL, 10);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (optind != argc || workers < 1 || workers > MAX_WORKERS || strlen(socket_path) >= sizeof(addr.sun_path))
+  {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  jpeg_set_entropy_threads(entropy_threads, 64 * 1024);
+  jpeg_set_huff_table_cache(true);
+
+  s_listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (s_listen_fd < 0)
+  {
+    perror("socket");
+    return EXIT_FAILURE;
+  }
+
+  // Whatever a previous run left behind.
+  unlink(socket_path);
+  if (bind(s_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(s_listen_fd, 128) != 0)
+  {
+    perror("bind");
+    close(s_listen_fd);
+    return EXIT_FAILURE;
+  }
+
+  // No SA_RESTART, so a stop signal gets the supervisor out of poll.
+  struct sigaction stop;
+  memset(&stop, 0, sizeof(stop));
+  stop.sa_handler = on_stop_signal;
+  sigemptyset(&stop.sa_mask);
+  sigaction(SIGINT, &stop, NULL);
+  sigaction(SIGTERM, &stop, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  for (unsigned c = 0; c != MAX_CLIENTS; ++c)
+    s_clients[c].sock = -1;
+  for (long w = 0; w != workers; ++w)
+    s_workers[w].sock = -1;
+
+  s_worker_count = workers;
+  for (long w = 0; w != workers; ++w)
+    spawn_worker(w);
+
+  fprintf(stderr, "Listening on %s with %ld workers.\n", socket_path, workers);
+
+  supervise();
+
+  for (unsigned c = 0; c != MAX_CLIENTS; ++c)
+  {
+    if (s_clients[c].sock >= 0)
+      close_client((int)c);
+  }
+
+  for (long w = 0; w != workers; ++w)
+  {
+    if (s_workers[w].pid > 0)
+      kill(s_workers[w].pid, SIGTERM);
+  }
+  for (long w = 0; w != workers; ++w)
+  {
+    if (s_workers[w].pid > 0)
+      waitpid(s_workers[w].pid, NULL, 0);
+    if (s_workers[w].sock >= 0)
+      close(s_workers[w].sock);
+  }
+
+  close(s_listen_fd);
+  unlink(socket_path);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*--------------------------------------------------------------------------
+File:   fuzz.c
+Date:   2026/10/19
+
+Fuzz target for the decoder. Builds as a libFuzzer target by default.
+With FUZZ_STANDALONE it gets its own main, which decodes each file on the
+command line (or stdin when there are none) so it can run under AFL or
+replay a crash without libFuzzer.
+---------------------------------------------------------------------------*/
+#include "decoder.h"
+#include "jpeg_writer.h"
+#include "probe.h"
+#include "thumbnail.h"
+#include "transform.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+  // Copy into an exact size allocation so ASAN catches reads one byte past the input.
+  unsigned char* buf = (unsigned char*)malloc(size ? size : 1);
+  if (buf == NULL)
+    return 0;
+
+  memcpy(buf, data, size);
+
+  // Every decode below, coefficient output included, turns down frames claiming more than this up front,
+  // instead of asking for gigabytes and looking like an out of memory crash.
+  jpeg_set_memory_limit(256u << 20);
+
+  // Tiny chunks put even small scans through the parallel entropy decoder. The input size picks it or the serial one.
+  jpeg_set_entropy_threads(size & 2 ? 4 : 1, 64);
+
+  // Run the output stages too, as long as the claimed dimensions are small enough to allocate.
+  static const size_t MAX_FUZZ_PIXELS = 1 << 22;
+
+  jpeg_info_t info;
+  jpeg_output_t output = {0};
+  if (jpeg_probe(buf, size, &info) && (size_t)info.width * info.height <= MAX_FUZZ_PIXELS)
+  {
+    if (info.bits_per_sample == 12)
+      output.format = info.num_components == 1 ? JPF_GRAY16 : JPF_RGB48;
+    else
+      output.format = info.num_components == 1 ? JPF_GRAY8 : JPF_RGBA32;
+    output.strides[0] = (ptrdiff_t)info.width * jpeg_pixel_format_size(output.format);
+    output.planes[0] = (unsigned char*)malloc((size_t)output.strides[0] * info.height + 1);
+  }
+
+  if (output.planes[0] != NULL)
+    jpeg_decode_to(buf, size, &output);
+  else
+    jpeg_decode_buffer(buf, size);
+
+  // The thumbnail path goes through scaled IDCT, the row sink and the encoder. The input size picks the box.
+  if (output.planes[0] != NULL)
+  {
+    jpeg_thumbnail_params_t thumbnail;
+    thumbnail.max_width = (unsigned short)(1 + size % 97);
+    thumbnail.max_height = (unsigned short)(1 + size % 61);
+    jpeg_encode_params_default(&thumbnail.encode);
+
+    unsigned char* encoded = NULL;
+    size_t encoded_len;
+    if (jpeg_thumbnail(buf, size, &thumbnail, &encoded, &encoded_len))
+      free(encoded);
+  }
+
+  free(output.planes[0]);
+
+  // Whatever decodes has to survive a transform and a re-encode too. The input size picks the transform and tables.
+  jpeg_coefficients_t coefficients;
+  if (jpeg_decode_coefficients(buf, size, &coefficients))
+  {
+    jpeg_transform_t transform = {0};
+    transform.op = (jpeg_transform_op_t)(size % JXF_COUNT);
+    transform.optimize_huffman = (size / JXF_COUNT) & 1;
+
+    jpeg_coefficients_t transformed;
+    unsigned char* encoded = NULL;
+    size_t encoded_len;
+    if (jpeg_transform_coefficients(&coefficients, &transform, &transformed) &&
+        jpeg_write_coefficients(&transformed, transform.optimize_huffman, &encoded, &encoded_len))
+      free(encoded);
+
+    jpeg_coefficients_free(&transformed);
+    jpeg_coefficients_free(&coefficients);
+  }
+
+  free(buf);
+  return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static unsigned char* read_all(FILE* file, size_t* out_size)
+{
+  size_t capacity = 1 << 16, size = 0;
+  unsigned char* buf = (unsigned char*)malloc(capacity);
+
+  size_t read;
+  while (buf && (read = fread(buf + size, 1, capacity - size, file)) > 0)
+  {
+    size += read;
+    if (size == capacity)
+    {
+      capacity *= 2;
+      unsigned char* grown = (unsigned char*)realloc(buf, capacity);
+      if (grown == NULL)
+        free(buf);
+      buf = grown;
+    }
+  }
+
+  *out_size = size;
+  return buf;
+}
+
+static int run_file(FILE* file)
+{
+  size_t size;
+  unsigned char* buf = read_all(file, &size);
+  if (buf == NULL)
+    return 1;
+
+  LLVMFuzzerTestOneInput(buf, size);
+  free(buf);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+    return run_file(stdin);
+
+  for (int i = 1; i != argc; ++i)
+  {
+    FILE* file = fopen(argv[i], "rb");
+    if (file == NULL)
+    {
+      fprintf(stderr, "Failed to open '%s'\n", argv[i]);
+      return 1;
+    }
+
+    const int result = run_file(file);
+    fclose(file);
+
+    if (result != 0)
+      return result;
+  }
+
+  return 0;
+}
+#endif